@@ -0,0 +1,62 @@
+#ifndef LL_BENCH_H
+#define LL_BENCH_H
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include "base.h"
+#include "mem.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Shared setup for the benchmarks in this directory. Build any of them from the repo root with
+//     cc -O2 -Isrc bench/<name>.c -o <name> -lvulkan -lglfw -lpthread -lm
+// and run them from the repo root too, since shaders are loaded from bench/.
+
+struct Bench {
+        GLFWwindow* window;
+        struct Base base;
+        struct MemAllocator allocator;
+};
+
+// base_create wants a surface, so there's a window, it's just never shown.
+void bench_create(uint32_t device_ext_ct, const char** device_exts, struct Bench* bench) {
+        if (!glfwInit()) {
+                fprintf(stderr, "Couldn't initialize GLFW\n");
+                exit(1);
+        }
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        bench->window = glfwCreateWindow(64, 64, "bench", NULL, NULL);
+        if (bench->window == NULL) {
+                fprintf(stderr, "Couldn't create a window\n");
+                exit(1);
+        }
+
+        base_create(bench->window, VK_API_VERSION_1_1, 0, 1, 0, NULL, device_ext_ct, device_exts,
+                    NULL, &bench->base);
+        mem_allocator_create(bench->base.phys_dev, bench->base.device, &bench->allocator);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(bench->base.phys_dev, &props);
+        printf("Device: %s\n", props.deviceName);
+}
+
+void bench_destroy(struct Bench* bench) {
+        vkDeviceWaitIdle(bench->base.device);
+        mem_allocator_destroy(&bench->allocator);
+        base_destroy(&bench->base);
+        glfwDestroyWindow(bench->window);
+        glfwTerminate();
+}
+
+double bench_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif // LL_BENCH_H
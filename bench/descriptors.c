@@ -0,0 +1,108 @@
+// Three ways to update the same set: set_write, set_write_template and set_push. Each one does
+// UPDATE_CT updates of a SetInfo with two uniform and two storage buffers, moving the offsets
+// around every time, and prints updates per second. This is CPU time only: pushes are recorded
+// into a command buffer that's never submitted. Needs VK_KHR_push_descriptor.
+#include "bench.h"
+
+#include "buffer.h"
+#include "cbuf.h"
+#include "pipeline.h"
+#include "set.h"
+
+#define UPDATE_CT 200000
+#define DESC_CT 4
+// Enough for any minUniformBufferOffsetAlignment
+#define SLOT_SIZE 256
+
+static void handles_fill(VkBuffer buffer, uint32_t i, union SetHandle* handles) {
+        for (uint32_t j = 0; j < DESC_CT; j++) {
+                handles[j].buffer.buffer = buffer;
+                handles[j].buffer.offset = (i + j) % DESC_CT * SLOT_SIZE;
+                handles[j].buffer.range = SLOT_SIZE;
+        }
+}
+
+static void report(const char* name, double start) {
+        double s = bench_now() - start;
+        printf("%-20s %6.2f M updates/s (%.0f ns each)\n", name, UPDATE_CT / s / 1e6,
+               s / UPDATE_CT * 1e9);
+}
+
+int main(void) {
+        const char* device_exts[] = {VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME};
+        struct Bench bench;
+        bench_create(1, device_exts, &bench);
+        VkDevice device = bench.base.device;
+
+        struct DescriptorInfo descs[DESC_CT] = {
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+                {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT},
+        };
+        struct SetInfo set_info = {DESC_CT, descs};
+
+        struct Buffer buffer;
+        buffer_create(&bench.allocator, device,
+                      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, DESC_CT * SLOT_SIZE, &buffer);
+        union SetHandle handles[DESC_CT];
+        handles_fill(buffer.handle, 0, handles);
+
+        VkDescriptorSetLayout layout;
+        set_layout_create(device, &set_info, &layout);
+        VkDescriptorPool dpool;
+        dpool_create(device, 1, DESC_CT, descs, &dpool);
+        VkDescriptorSet set;
+        set_create(device, dpool, layout, &set_info, handles, &set);
+        struct SetTemplate tmpl;
+        set_template_create(device, &set_info, layout, &tmpl);
+
+        VkDescriptorSetLayout push_layout;
+        set_layout_create_flags(device, &set_info,
+                                VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+                                &push_layout);
+        VkPipelineLayout push_pipeline_layout;
+        pipeline_layout_create(device, 1, &push_layout, 0, NULL, &push_pipeline_layout);
+        struct SetTemplate push_tmpl;
+        set_push_template_create(device, &set_info, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                 push_pipeline_layout, 0, &push_tmpl);
+
+        printf("%u updates of %u buffers each\n", UPDATE_CT, DESC_CT);
+
+        double start = bench_now();
+        for (uint32_t i = 0; i < UPDATE_CT; i++) {
+                handles_fill(buffer.handle, i, handles);
+                set_write(device, set, &set_info, handles);
+        }
+        report("set_write", start);
+
+        start = bench_now();
+        for (uint32_t i = 0; i < UPDATE_CT; i++) {
+                handles_fill(buffer.handle, i, handles);
+                set_write_template(device, set, &tmpl, handles);
+        }
+        report("set_write_template", start);
+
+        VkCommandBuffer cbuf;
+        cbuf_alloc(device, bench.base.cpool, &cbuf);
+        cbuf_begin_onetime(cbuf);
+        start = bench_now();
+        for (uint32_t i = 0; i < UPDATE_CT; i++) {
+                handles_fill(buffer.handle, i, handles);
+                set_push(cbuf, &push_tmpl, handles);
+        }
+        report("set_push", start);
+        VkResult res = vkEndCommandBuffer(cbuf);
+        assert(res == VK_SUCCESS);
+        vkFreeCommandBuffers(device, bench.base.cpool, 1, &cbuf);
+
+        set_template_destroy(device, &push_tmpl);
+        vkDestroyPipelineLayout(device, push_pipeline_layout, NULL);
+        vkDestroyDescriptorSetLayout(device, push_layout, NULL);
+        set_template_destroy(device, &tmpl);
+        vkDestroyDescriptorPool(device, dpool, NULL);
+        vkDestroyDescriptorSetLayout(device, layout, NULL);
+        buffer_destroy(device, &buffer);
+        bench_destroy(&bench);
+}
@@ -0,0 +1,151 @@
+// How recording scales with workers: the same draw list goes through recorder_record with 1, 2,
+// 4... worker threads, up to the core count, and the average Recorder.last_record_s is printed for
+// each.
+// Every draw is a push constant and a vkCmdDraw, so this is mostly command buffer overhead.
+// Needs bench/tri.vert.spv and bench/tri.frag.spv, see the top of the shaders.
+#include "bench.h"
+
+#include "frame.h"
+#include "image.h"
+#include "jobs.h"
+#include "pipeline.h"
+#include "record.h"
+#include "rpass.h"
+#include "shader.h"
+
+#include <unistd.h>
+
+#define WIDTH 512
+#define HEIGHT 512
+#define FORMAT VK_FORMAT_B8G8R8A8_UNORM
+#define ITEM_CT 50000
+#define FRAMES_IN_FLIGHT 2
+#define FRAME_CT 100
+// Chunks per worker, see recorder_record
+#define CHUNKS_PER_WORKER 4
+
+struct Scene {
+        VkPipeline pipeline;
+        VkPipelineLayout layout;
+};
+
+static void record_chunk(VkCommandBuffer cbuf, uint32_t first, uint32_t ct, void* data) {
+        struct Scene* scene = data;
+        vkCmdBindPipeline(cbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, scene->pipeline);
+
+        VkViewport viewport = {0, 0, WIDTH, HEIGHT, 0.0F, 1.0F};
+        VkRect2D scissor = {{0, 0}, {WIDTH, HEIGHT}};
+        vkCmdSetViewport(cbuf, 0, 1, &viewport);
+        vkCmdSetScissor(cbuf, 0, 1, &scissor);
+
+        for (uint32_t i = first; i < first + ct; i++) {
+                float offset[2] = {(i % 100) / 50.0F - 1.0F, (i / 100 % 100) / 50.0F - 1.0F};
+                vkCmdPushConstants(cbuf, scene->layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                   sizeof(offset), offset);
+                vkCmdDraw(cbuf, 3, 1, 0, 0);
+        }
+}
+
+// Average seconds per recorder_record, leaving out the first time round each frame, when the
+// secondaries are still being allocated
+static double run(struct Bench* bench, VkRenderPass rpass, VkFramebuffer fb, struct Scene* scene,
+                  uint32_t worker_ct)
+{
+        struct Base* base = &bench->base;
+
+        struct Jobs jobs;
+        jobs_create(worker_ct, &jobs);
+        struct Recorder rec;
+        recorder_create(base->device, base->queue_fam, &jobs, FRAMES_IN_FLIGHT, &rec);
+        struct Frames frames;
+        frames_create(&bench->allocator, base->device, base->queue, base->queue_fam,
+                      FRAMES_IN_FLIGHT, 0, 0, 0, &frames);
+
+        VkClearValue clear = {0};
+        VkRenderPassBeginInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        info.renderPass = rpass;
+        info.framebuffer = fb;
+        info.renderArea.extent.width = WIDTH;
+        info.renderArea.extent.height = HEIGHT;
+        info.clearValueCount = 1;
+        info.pClearValues = &clear;
+
+        double total_s = 0;
+        for (uint32_t i = 0; i < FRAME_CT + FRAMES_IN_FLIGHT; i++) {
+                VkCommandBuffer cbuf = frames_begin(&frames, NULL);
+                recorder_frame_begin(&rec, frames.idx);
+
+                vkCmdBeginRenderPass(cbuf, &info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                recorder_record(&rec, cbuf, rpass, 0, fb, ITEM_CT, worker_ct * CHUNKS_PER_WORKER,
+                                record_chunk, scene);
+                vkCmdEndRenderPass(cbuf);
+
+                frames_end(&frames, NULL);
+                if (i >= FRAMES_IN_FLIGHT) total_s += rec.last_record_s;
+        }
+
+        frames_destroy(&frames);
+        recorder_destroy(&rec);
+        jobs_destroy(&jobs);
+        return total_s / FRAME_CT;
+}
+
+int main(void) {
+        // rpass_color leaves the image ready to present
+        const char* device_exts[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+        struct Bench bench;
+        bench_create(1, device_exts, &bench);
+        VkDevice device = bench.base.device;
+
+        struct Image target;
+        image_create_color(&bench.allocator, device, FORMAT, WIDTH, HEIGHT, VK_SAMPLE_COUNT_1_BIT,
+                           &target);
+        VkRenderPass rpass;
+        rpass_color(device, FORMAT, &rpass);
+        VkFramebuffer fb;
+        framebuffer_create(device, rpass, WIDTH, HEIGHT, 1, &target.view, &fb);
+
+        struct ShaderCache shaders;
+        shader_cache_create(device, &shaders);
+        const struct Shader* stages[] = {
+                shader_cache_get(&shaders, "bench/tri.vert.spv"),
+                shader_cache_get(&shaders, "bench/tri.frag.spv"),
+        };
+        VkPipelineShaderStageCreateInfo stage_infos[2];
+        shader_stage_info(stages[0], &stage_infos[0]);
+        shader_stage_info(stages[1], &stage_infos[1]);
+
+        struct Scene scene;
+        VkPushConstantRange range;
+        shader_push_range(stages, 2, &range);
+        pipeline_layout_create(device, 0, NULL, 1, &range, &scene.layout);
+
+        struct PipelineSettings settings = PIPELINE_SETTINGS_DEFAULT;
+        settings.rasterizer.cullMode = VK_CULL_MODE_NONE;
+        pipeline_create(device, NULL, &settings, 2, stage_infos, scene.layout, rpass, 0,
+                        &scene.pipeline);
+
+        uint32_t core_ct = sysconf(_SC_NPROCESSORS_ONLN);
+        printf("%u draws, %u chunks per worker, %u frames each\n", ITEM_CT, CHUNKS_PER_WORKER,
+               FRAME_CT);
+        double one_s = 0;
+        // Powers of two, then every core
+        uint32_t worker_ct = 1;
+        while (1) {
+                double record_s = run(&bench, rpass, fb, &scene, worker_ct);
+                if (worker_ct == 1) one_s = record_s;
+                printf("%2u workers: %.3f ms per record (%.2fx)\n", worker_ct, record_s * 1e3,
+                       one_s / record_s);
+                if (worker_ct >= core_ct) break;
+                worker_ct = worker_ct * 2 < core_ct ? worker_ct * 2 : core_ct;
+        }
+
+        vkDestroyPipeline(device, scene.pipeline, NULL);
+        vkDestroyPipelineLayout(device, scene.layout, NULL);
+        shader_cache_destroy(&shaders);
+        vkDestroyFramebuffer(device, fb, NULL);
+        vkDestroyRenderPass(device, rpass, NULL);
+        image_destroy(device, &target);
+        bench_destroy(&bench);
+}
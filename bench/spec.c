@@ -0,0 +1,120 @@
+// Uniform branching against a specialized variant of the same compute shader. Both pipelines run
+// the same dispatches for a while, and the GPU time per frame comes from the Frames timestamps.
+// Needs bench/branch.comp.spv, see the top of bench/branch.comp.
+#include "bench.h"
+
+#include "buffer.h"
+#include "cbuf.h"
+#include "frame.h"
+#include "pipeline.h"
+#include "set.h"
+#include "shader.h"
+
+#define VALUE_CT (1 << 20)
+#define DISPATCH_CT 8
+#define FRAME_CT 200
+// Mode 0 is the first branch, which is the cheapest case for the branching version
+#define MODE 1
+
+struct Push {
+        int32_t mode;
+        uint32_t ct;
+};
+
+static double run(struct Bench* bench, const struct Shader* shader, VkPipeline pipeline,
+                  VkPipelineLayout layout, VkDescriptorSet set)
+{
+        struct Base* base = &bench->base;
+        struct Frames frames;
+        frames_create(&bench->allocator, base->device, base->queue, base->queue_fam, 2, 0, 0, 0,
+                      &frames);
+        if (frames.queries == VK_NULL_HANDLE) {
+                fprintf(stderr, "The queue doesn't support timestamps\n");
+                exit(1);
+        }
+
+        struct Push push = {MODE, VALUE_CT};
+        for (uint32_t i = 0; i < FRAME_CT; i++) {
+                VkCommandBuffer cbuf = frames_begin(&frames, NULL);
+                vkCmdBindPipeline(cbuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+                vkCmdBindDescriptorSets(cbuf, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0,
+                                        NULL);
+                vkCmdPushConstants(cbuf, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push),
+                                   &push);
+                for (uint32_t j = 0; j < DISPATCH_CT; j++) {
+                        cbuf_dispatch(cbuf, shader->refl.local_size, VALUE_CT, 1, 1);
+                        cbuf_barrier_memory(cbuf, VK_ACCESS_SHADER_WRITE_BIT,
+                                            VK_ACCESS_SHADER_WRITE_BIT,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+                }
+                frames_end(&frames, NULL);
+        }
+
+        // Timestamps are only read once a frame comes around again, so the last few don't count
+        double busy_s = frames.stats.gpu_busy_total_s / frames.stats.gpu_frame_ct;
+        frames_destroy(&frames);
+        return busy_s;
+}
+
+int main(void) {
+        struct Bench bench;
+        bench_create(0, NULL, &bench);
+        VkDevice device = bench.base.device;
+
+        struct ShaderCache shaders;
+        shader_cache_create(device, &shaders);
+        const struct Shader* shader = shader_cache_get(&shaders, "bench/branch.comp.spv");
+
+        struct SetInfo set_info;
+        shader_set_info(&shader, 1, 0, &set_info);
+        VkDescriptorSetLayout set_layout;
+        set_layout_create(device, &set_info, &set_layout);
+
+        VkPushConstantRange range;
+        shader_push_range(&shader, 1, &range);
+        VkPipelineLayout layout;
+        pipeline_layout_create(device, 1, &set_layout, 1, &range, &layout);
+
+        struct Buffer values;
+        buffer_create(&bench.allocator, device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VALUE_CT * sizeof(float), &values);
+
+        VkDescriptorPool dpool;
+        dpool_create(device, 1, set_info.desc_ct, set_info.descs, &dpool);
+        union SetHandle handle = {.buffer = {values.handle, 0, VK_WHOLE_SIZE}};
+        VkDescriptorSet set;
+        set_create(device, dpool, set_layout, &set_info, &handle, &set);
+
+        // Same module, once as it is and once with the mode baked in
+        VkPipelineShaderStageCreateInfo stage;
+        shader_stage_info(shader, &stage);
+        VkPipeline branching;
+        compute_pipeline_create(device, NULL, &stage, layout, &branching);
+
+        struct SpecMap spec;
+        spec_create(&spec);
+        spec_set_int(&spec, 0, MODE);
+        spec_apply(&spec, &stage);
+        VkPipeline specialized;
+        compute_pipeline_create(device, NULL, &stage, layout, &specialized);
+
+        double branching_s = run(&bench, shader, branching, layout, set);
+        double specialized_s = run(&bench, shader, specialized, layout, set);
+        printf("%u dispatches of %u invocations per frame, %u frames\n", DISPATCH_CT, VALUE_CT,
+               FRAME_CT);
+        printf("Uniform branch: %.3f ms GPU per frame\n", branching_s * 1e3);
+        printf("Specialized:    %.3f ms GPU per frame (%.2fx)\n", specialized_s * 1e3,
+               branching_s / specialized_s);
+
+        vkDestroyPipeline(device, specialized, NULL);
+        vkDestroyPipeline(device, branching, NULL);
+        spec_destroy(&spec);
+        vkDestroyDescriptorPool(device, dpool, NULL);
+        buffer_destroy(device, &values);
+        vkDestroyPipelineLayout(device, layout, NULL);
+        vkDestroyDescriptorSetLayout(device, set_layout, NULL);
+        free(set_info.descs);
+        shader_cache_destroy(&shaders);
+        bench_destroy(&bench);
+}
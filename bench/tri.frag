@@ -0,0 +1,9 @@
+#version 450
+
+// glslc bench/tri.frag -o bench/tri.frag.spv
+
+layout(location = 0) out vec4 color;
+
+void main() {
+        color = vec4(1.0);
+}
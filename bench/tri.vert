@@ -0,0 +1,12 @@
+#version 450
+
+// glslc bench/tri.vert -o bench/tri.vert.spv
+
+layout(push_constant) uniform Push {
+        vec2 offset;
+} push;
+
+void main() {
+        const vec2 corners[3] = vec2[](vec2(0.0, -0.01), vec2(0.01, 0.01), vec2(-0.01, 0.01));
+        gl_Position = vec4(corners[gl_VertexIndex] + push.offset, 0.0, 1.0);
+}
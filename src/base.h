@@ -3,6 +3,8 @@
 
 #include <vulkan/vulkan.h>
 
+#include "cbuf.h"
+
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -28,6 +30,14 @@ struct Base {
         VkDevice device;
         VkQueue queue;
         VkCommandPool cpool;
+        // For one-shot work on `queue` (buffer_create_staged, image_trans, ...)
+        struct CbufPool cbufs;
+        // A transfer-only queue family if the device has one (the copy engine on most discrete
+        // GPUs), otherwise the same family and queue as above. `transfer_cpool` is always its own
+        // pool so uploads can be recorded on another thread.
+        uint32_t transfer_queue_fam;
+        VkQueue transfer_queue;
+        VkCommandPool transfer_cpool;
         VkSampleCountFlagBits max_samples;
 };
 
@@ -209,6 +219,25 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
         }
         assert(queue_fam != UINT32_MAX);
         base->queue_fam = queue_fam;
+
+        // Prefer a family that can only transfer, then one that at least can't do graphics.
+        // Graphics and compute families can always transfer even if they don't say so.
+        uint32_t transfer_fam = UINT32_MAX;
+        for (int i = 0; i < queue_fam_ct && transfer_fam == UINT32_MAX; ++i) {
+                VkQueueFlags flags = queue_fam_props[i].queueFlags;
+                if ((flags & VK_QUEUE_TRANSFER_BIT)
+                    && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                        transfer_fam = i;
+                }
+        }
+        for (int i = 0; i < queue_fam_ct && transfer_fam == UINT32_MAX; ++i) {
+                VkQueueFlags flags = queue_fam_props[i].queueFlags;
+                if (i != queue_fam && (flags & VK_QUEUE_TRANSFER_BIT)
+                    && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                        transfer_fam = i;
+                }
+        }
+        base->transfer_queue_fam = transfer_fam == UINT32_MAX ? queue_fam : transfer_fam;
         free(queue_fam_props);
 
         // Query device extensions
@@ -230,11 +259,18 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
 
         // Create logical device
         const float queue_priority = 1.0F;
-        VkDeviceQueueCreateInfo dev_queue_info = {0};
-        dev_queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        dev_queue_info.queueFamilyIndex = base->queue_fam;
-        dev_queue_info.queueCount = 1;
-        dev_queue_info.pQueuePriorities = &queue_priority;
+        VkDeviceQueueCreateInfo dev_queue_infos[2] = {0};
+        dev_queue_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        dev_queue_infos[0].queueFamilyIndex = base->queue_fam;
+        dev_queue_infos[0].queueCount = 1;
+        dev_queue_infos[0].pQueuePriorities = &queue_priority;
+
+        dev_queue_infos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        dev_queue_infos[1].queueFamilyIndex = base->transfer_queue_fam;
+        dev_queue_infos[1].queueCount = 1;
+        dev_queue_infos[1].pQueuePriorities = &queue_priority;
+
+        const uint32_t dev_queue_info_ct = base->transfer_queue_fam == base->queue_fam ? 1 : 2;
 
         VkPhysicalDeviceFeatures real_features;
         vkGetPhysicalDeviceFeatures(base->phys_dev, &real_features);
@@ -249,8 +285,8 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
 
         VkDeviceCreateInfo device_info = {0};
         device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        device_info.pQueueCreateInfos = &dev_queue_info;
-        device_info.queueCreateInfoCount = 1;
+        device_info.pQueueCreateInfos = dev_queue_infos;
+        device_info.queueCreateInfoCount = dev_queue_info_ct;
         device_info.enabledLayerCount = 0;
         device_info.enabledExtensionCount = device_ext_ct;
         device_info.ppEnabledExtensionNames = device_exts;
@@ -259,8 +295,9 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
         res = vkCreateDevice(base->phys_dev, &device_info, NULL, &base->device);
         assert(res == VK_SUCCESS);
 
-        // Create queue
+        // Create queues
         vkGetDeviceQueue(base->device, base->queue_fam, 0, &base->queue);
+        vkGetDeviceQueue(base->device, base->transfer_queue_fam, 0, &base->transfer_queue);
 
         // Create command pool
         VkCommandPoolCreateInfo cpool_info = {0};
@@ -271,6 +308,12 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
         res = vkCreateCommandPool(base->device, &cpool_info, NULL, &base->cpool);
         assert(res == VK_SUCCESS);
 
+        cpool_info.queueFamilyIndex = base->transfer_queue_fam;
+        res = vkCreateCommandPool(base->device, &cpool_info, NULL, &base->transfer_cpool);
+        assert(res == VK_SUCCESS);
+
+        cbuf_pool_create(base->device, base->queue, base->queue_fam, &base->cbufs);
+
         // Make sure we have linear filtering support
         VkFormatProperties dev_format_props;
         vkGetPhysicalDeviceFormatProperties(base->phys_dev, VK_FORMAT_B8G8R8A8_SRGB,
@@ -301,7 +344,9 @@ void base_create(GLFWwindow *window, uint32_t api_version, int want_debug, int w
 void base_destroy(struct Base *base) {
         vkDeviceWaitIdle(base->device);
 
+        cbuf_pool_destroy(&base->cbufs);
         vkDestroyCommandPool(base->device, base->cpool, NULL);
+        vkDestroyCommandPool(base->device, base->transfer_cpool, NULL);
 
         vkDestroyDevice(base->device, NULL);
 
@@ -0,0 +1,223 @@
+#ifndef LL_BINDLESS_H
+#define LL_BINDLESS_H
+
+#include <vulkan/vulkan.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// In the shader:
+//     layout(set = N, binding = 0) uniform sampler2D textures[];
+//     layout(set = N, binding = 1) buffer Materials { ... } buffers[];
+#define BINDLESS_TEXTURE_BINDING 0
+#define BINDLESS_BUFFER_BINDING 1
+
+// Slots handed out so far are 0 to `top` - 1, minus whatever is on the free list.
+struct BindlessSlots {
+        uint32_t cap;
+        uint32_t top;
+        uint32_t free_ct;
+        uint32_t* free;
+        // One bit per slot, set while it's handed out
+        uint32_t* live;
+        uint32_t peak;
+};
+
+// One descriptor set with a big array of combined image samplers and one of storage buffers, bound
+// once per command buffer. Draws pick their textures and materials by index, e.g. through push
+// constants, instead of binding a set per material.
+//
+// Needs VK_EXT_descriptor_indexing (core in 1.2) with runtimeDescriptorArray,
+// descriptorBindingPartiallyBound, descriptorBindingUpdateUnusedWhilePending and the
+// SampledImage/StorageBuffer UpdateAfterBind features enabled through base_create's
+// `extra_features`, plus shaderSampledImageArrayNonUniformIndexing if the index isn't uniform.
+// The array sizes have to fit maxDescriptorSetUpdateAfterBind* from the device's
+// VkPhysicalDeviceDescriptorIndexingProperties.
+//
+// Slots can be added and removed while the set is in use. Only remove a slot once the GPU is done
+// with it, same as destroying the image or buffer behind it, since the slot gets reused.
+struct Bindless {
+        VkDevice device;
+        VkDescriptorPool dpool;
+        VkDescriptorSetLayout layout;
+        VkDescriptorSet set;
+        struct BindlessSlots textures;
+        struct BindlessSlots buffers;
+};
+
+void bindless_create(VkDevice device, uint32_t texture_ct, uint32_t buffer_ct, struct Bindless* b) {
+        bzero(b, sizeof(*b));
+        b->device = device;
+        b->textures.cap = texture_ct;
+        b->textures.free = malloc(texture_ct * sizeof(b->textures.free[0]));
+        b->textures.live = calloc((texture_ct + 31) / 32, sizeof(b->textures.live[0]));
+        b->buffers.cap = buffer_ct;
+        b->buffers.free = malloc(buffer_ct * sizeof(b->buffers.free[0]));
+        b->buffers.live = calloc((buffer_ct + 31) / 32, sizeof(b->buffers.live[0]));
+
+        VkDescriptorSetLayoutBinding bindings[2] = {0};
+        bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].descriptorCount = texture_ct;
+        bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+        bindings[1].binding = BINDLESS_BUFFER_BINDING;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = buffer_ct;
+        bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+        // Empty slots are never written, and slots change while the set is bound
+        VkDescriptorBindingFlags flags[2];
+        flags[0] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+                | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+                | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        flags[1] = flags[0];
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {0};
+        flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flags_info.bindingCount = 2;
+        flags_info.pBindingFlags = flags;
+
+        VkDescriptorSetLayoutCreateInfo layout_info = {0};
+        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layout_info.pNext = &flags_info;
+        layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layout_info.bindingCount = 2;
+        layout_info.pBindings = bindings;
+
+        VkResult res = vkCreateDescriptorSetLayout(device, &layout_info, NULL, &b->layout);
+        assert(res == VK_SUCCESS);
+
+        VkDescriptorPoolSize sizes[2];
+        sizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        sizes[0].descriptorCount = texture_ct;
+        sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        sizes[1].descriptorCount = buffer_ct;
+
+        VkDescriptorPoolCreateInfo pool_info = {0};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        pool_info.maxSets = 1;
+        pool_info.poolSizeCount = 2;
+        pool_info.pPoolSizes = sizes;
+
+        res = vkCreateDescriptorPool(device, &pool_info, NULL, &b->dpool);
+        assert(res == VK_SUCCESS);
+
+        VkDescriptorSetAllocateInfo alloc_info = {0};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorPool = b->dpool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts = &b->layout;
+
+        res = vkAllocateDescriptorSets(device, &alloc_info, &b->set);
+        assert(res == VK_SUCCESS);
+}
+
+void bindless_destroy(struct Bindless* b) {
+        vkDestroyDescriptorPool(b->device, b->dpool, NULL);
+        vkDestroyDescriptorSetLayout(b->device, b->layout, NULL);
+        free(b->textures.free);
+        free(b->textures.live);
+        free(b->buffers.free);
+        free(b->buffers.live);
+}
+
+// Freed slots first, so the arrays stay dense and the shader touches fewer descriptors.
+static uint32_t bindless_slot_take(struct BindlessSlots* slots, const char* what) {
+        uint32_t slot;
+        if (slots->free_ct > 0) {
+                slot = slots->free[--slots->free_ct];
+        } else if (slots->top < slots->cap) {
+                slot = slots->top++;
+        } else {
+                fprintf(stderr, "Out of bindless %s slots (%u)\n", what, slots->cap);
+                exit(1);
+        }
+        slots->live[slot / 32] |= 1u << (slot % 32);
+
+        uint32_t used = slots->top - slots->free_ct;
+        if (used > slots->peak) slots->peak = used;
+        return slot;
+}
+
+static void bindless_slot_give(struct BindlessSlots* slots, uint32_t slot) {
+        assert(slot < slots->top);
+        // Removed twice, it would end up on the free list twice and get handed out twice
+        assert((slots->live[slot / 32] & (1u << (slot % 32))) && "Slot isn't in use");
+        slots->live[slot / 32] &= ~(1u << (slot % 32));
+        slots->free[slots->free_ct++] = slot;
+}
+
+static void bindless_write(struct Bindless* b, uint32_t binding, uint32_t slot, VkDescriptorType type,
+                           const VkDescriptorImageInfo* image, const VkDescriptorBufferInfo* buffer)
+{
+        VkWriteDescriptorSet write = {0};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = b->set;
+        write.dstBinding = binding;
+        write.dstArrayElement = slot;
+        write.descriptorCount = 1;
+        write.descriptorType = type;
+        write.pImageInfo = image;
+        write.pBufferInfo = buffer;
+        vkUpdateDescriptorSets(b->device, 1, &write, 0, NULL);
+}
+
+// Returns the index to use in the shader. `layout` is the one the image will be in when sampled,
+// usually VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+uint32_t bindless_texture_add(struct Bindless* b, VkImageView view, VkSampler sampler,
+                              VkImageLayout layout)
+{
+        uint32_t slot = bindless_slot_take(&b->textures, "texture");
+
+        VkDescriptorImageInfo info = {0};
+        info.sampler = sampler;
+        info.imageView = view;
+        info.imageLayout = layout;
+        bindless_write(b, BINDLESS_TEXTURE_BINDING, slot, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                       &info, NULL);
+        return slot;
+}
+
+// The descriptor is left as it is. Partially bound arrays only care about slots the shader
+// actually reads.
+void bindless_texture_remove(struct Bindless* b, uint32_t slot) {
+        bindless_slot_give(&b->textures, slot);
+}
+
+uint32_t bindless_buffer_add(struct Bindless* b, VkBuffer buffer, VkDeviceSize offset,
+                             VkDeviceSize range)
+{
+        uint32_t slot = bindless_slot_take(&b->buffers, "buffer");
+
+        VkDescriptorBufferInfo info = {0};
+        info.buffer = buffer;
+        info.offset = offset;
+        info.range = range;
+        bindless_write(b, BINDLESS_BUFFER_BINDING, slot, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, NULL,
+                       &info);
+        return slot;
+}
+
+void bindless_buffer_remove(struct Bindless* b, uint32_t slot) {
+        bindless_slot_give(&b->buffers, slot);
+}
+
+// Once per command buffer (and pipeline bind point), not per draw. `layout` needs b->layout at
+// `set_idx`.
+void bindless_bind(const struct Bindless* b, VkCommandBuffer cbuf, VkPipelineBindPoint bind_point,
+                   VkPipelineLayout layout, uint32_t set_idx)
+{
+        vkCmdBindDescriptorSets(cbuf, bind_point, layout, set_idx, 1, &b->set, 0, NULL);
+}
+
+void bindless_stats_print(const struct Bindless* b) {
+        printf("Bindless: %u/%u textures (peak %u), %u/%u buffers (peak %u)\n",
+               b->textures.top - b->textures.free_ct, b->textures.cap, b->textures.peak,
+               b->buffers.top - b->buffers.free_ct, b->buffers.cap, b->buffers.peak);
+}
+
+#endif // LL_BINDLESS_H
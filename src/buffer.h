@@ -12,7 +12,7 @@
 
 struct Buffer {
         VkBuffer handle;
-        VkDeviceMemory mem;
+        struct MemAlloc alloc;
         VkDeviceSize size;
 };
 
@@ -27,7 +27,7 @@ void buffer_handle_create(VkDevice device, VkBufferUsageFlags usage, VkDeviceSiz
         check_vk("Could not create buffer handle!", res);
 }
 
-void buffer_create(VkPhysicalDevice phys_dev, VkDevice device,
+void buffer_create(struct MemAllocator* allocator, VkDevice device,
                    VkBufferUsageFlags usage, VkMemoryPropertyFlags props, VkDeviceSize size, 
                    struct Buffer* buf)
 {
@@ -36,56 +36,50 @@ void buffer_create(VkPhysicalDevice phys_dev, VkDevice device,
         VkMemoryRequirements mem_reqs;
         vkGetBufferMemoryRequirements(device, buf->handle, &mem_reqs);
 
-	uint32_t mem_type_idx = mem_type_idx_find(phys_dev, mem_reqs.memoryTypeBits, props);
-	mem_alloc(device, mem_type_idx, mem_reqs.size, &buf->mem);
+	mem_suballoc(allocator, &mem_reqs, props, 1, &buf->alloc);
 
-        vkBindBufferMemory(device, buf->handle, buf->mem, 0);
+        vkBindBufferMemory(device, buf->handle, buf->alloc.mem, buf->alloc.offset);
 
         buf->size = size;
 }
 
 void buffer_destroy(VkDevice device, struct Buffer* buf) {
         vkDestroyBuffer(device, buf->handle, NULL);
-        vkFreeMemory(device, buf->mem, NULL);
+        mem_free(&buf->alloc);
 }
 
-void buffer_copy(VkQueue queue, VkCommandBuffer cbuf, VkBuffer src, VkBuffer dst, VkDeviceSize size) {
-        cbuf_begin_onetime(cbuf);
+void buffer_copy(struct CbufPool* cbufs, VkBuffer src, VkBuffer dst, VkDeviceSize size) {
+        VkCommandBuffer cbuf = cbuf_pool_begin(cbufs);
 
         VkBufferCopy copy_region = {0};
         copy_region.size = size;
         vkCmdCopyBuffer(cbuf, src, dst, 1, &copy_region);
 
-        cbuf_submit_wait(queue, cbuf);
+        cbuf_pool_submit_wait(cbufs, cbuf);
 }
 
 // If `staging` is NULL, the staging buffer will be destroyed instead of being returned.
 //
 // If `data` is NULL, no data will be written.
-void buffer_create_staged(VkPhysicalDevice phys_dev, VkDevice device,
-			  VkQueue queue, VkCommandPool cpool,
-			  VkBufferUsageFlags usage, VkMemoryPropertyFlags props,
+void buffer_create_staged(struct MemAllocator* allocator, VkDevice device,
+			  struct CbufPool* cbufs, VkBufferUsageFlags usage, VkMemoryPropertyFlags props,
 			  VkDeviceSize size, const void* data,
 			  struct Buffer* final, struct Buffer* staging)
 {
 	assert(size > 0);
 
         struct Buffer _staging;
-        buffer_create(phys_dev, device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        buffer_create(allocator, device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                       size, &_staging);
 	if (data != NULL) {
-		mem_write(device, _staging.mem, size, data);
+		mem_write(device, &_staging.alloc, size, data);
 	}
 
 	VkBufferUsageFlags real_usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-        buffer_create(phys_dev, device, real_usage, props, size, final);
+        buffer_create(allocator, device, real_usage, props, size, final);
 
-        VkCommandBuffer cbuf;
-        cbuf_alloc(device, cpool, &cbuf);
-        buffer_copy(queue, cbuf, _staging.handle, final->handle, size);
-
-	vkFreeCommandBuffers(device, cpool, 1, &cbuf);
+        buffer_copy(cbufs, _staging.handle, final->handle, size);
 
 	if (staging == NULL) {
 		buffer_destroy(device, &_staging);
@@ -4,6 +4,10 @@
 #include <vulkan/vulkan.h>
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void cbuf_alloc(VkDevice device, VkCommandPool cpool, VkCommandBuffer* cbuf) {
         VkCommandBufferAllocateInfo info = {0};
@@ -16,6 +20,36 @@ void cbuf_alloc(VkDevice device, VkCommandPool cpool, VkCommandBuffer* cbuf) {
         assert(res == VK_SUCCESS);
 }
 
+void cbuf_alloc_secondary(VkDevice device, VkCommandPool cpool, VkCommandBuffer* cbuf) {
+        VkCommandBufferAllocateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        info.commandPool = cpool;
+        info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        info.commandBufferCount = 1;
+
+        VkResult res = vkAllocateCommandBuffers(device, &info, cbuf);
+        assert(res == VK_SUCCESS);
+}
+
+// For a secondary command buffer that will be executed inside `subpass` of `rpass`. `framebuffer`
+// can be VK_NULL_HANDLE if it isn't known yet, but passing it lets the driver optimize better.
+void cbuf_begin_secondary(VkCommandBuffer cbuf, VkRenderPass rpass, uint32_t subpass,
+                          VkFramebuffer framebuffer)
+{
+        VkCommandBufferInheritanceInfo inheritance = {0};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.renderPass = rpass;
+        inheritance.subpass = subpass;
+        inheritance.framebuffer = framebuffer;
+
+        VkCommandBufferBeginInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+                | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        info.pInheritanceInfo = &inheritance;
+        vkBeginCommandBuffer(cbuf, &info);
+}
+
 void cbuf_begin_onetime(VkCommandBuffer cbuf) {
         VkCommandBufferBeginInfo info = {0};
         info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -58,5 +92,359 @@ void cbuf_barrier_image(VkCommandBuffer cbuf, VkImage image, VkImageAspectFlags
 	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
 }
 
+void cbuf_barrier_buffer(VkCommandBuffer cbuf, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+                         VkAccessFlags src_access, VkAccessFlags dst_access,
+                         VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage)
+{
+	VkBufferMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+// For when a pass touches so many buffers that one barrier per buffer is silly. Drivers don't track
+// individual buffers anyway, so this costs the same as one buffer barrier.
+void cbuf_barrier_memory(VkCommandBuffer cbuf, VkAccessFlags src_access, VkAccessFlags dst_access,
+                         VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage)
+{
+	VkMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 1, &barrier, 0, NULL, 0, NULL);
+}
+
+// Enough workgroups of `local_size` to cover `x` * `y` * `z` invocations. The shader has to skip
+// the extra invocations in the last group of each dimension. `local_size` is what the shader
+// declares, e.g. Reflection.local_size.
+void cbuf_dispatch(VkCommandBuffer cbuf, const uint32_t local_size[3], uint32_t x, uint32_t y,
+                   uint32_t z)
+{
+	assert(local_size[0] > 0 && local_size[1] > 0 && local_size[2] > 0);
+	vkCmdDispatch(cbuf, (x + local_size[0] - 1) / local_size[0],
+		      (y + local_size[1] - 1) / local_size[1], (z + local_size[2] - 1) / local_size[2]);
+}
+
+// Queue family ownership transfers. Record the release in a command buffer for `src_fam`, then the
+// acquire with the same buffer/image, families and layouts in one for `dst_fam`. The acquiring
+// submission has to wait for the releasing one (semaphore, or a fence the host waits on).
+//
+// If both families are the same, the release is an ordinary barrier that makes the writes visible
+// to everything afterwards and the acquire does nothing, so callers don't need two code paths for
+// devices without a dedicated transfer queue.
+void cbuf_release_buffer(VkCommandBuffer cbuf, VkBuffer buffer, uint32_t src_fam, uint32_t dst_fam,
+                         VkAccessFlags src_access, VkPipelineStageFlags src_stage)
+{
+	VkBufferMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcAccessMask = src_access;
+
+	VkPipelineStageFlags dst_stage;
+	if (src_fam == dst_fam) {
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		dst_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	} else {
+		barrier.srcQueueFamilyIndex = src_fam;
+		barrier.dstQueueFamilyIndex = dst_fam;
+		dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	}
+
+	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void cbuf_acquire_buffer(VkCommandBuffer cbuf, VkBuffer buffer, uint32_t src_fam, uint32_t dst_fam,
+                         VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	if (src_fam == dst_fam) return;
+
+	VkBufferMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcQueueFamilyIndex = src_fam;
+	barrier.dstQueueFamilyIndex = dst_fam;
+	barrier.dstAccessMask = dst_access;
+
+	vkCmdPipelineBarrier(cbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage,
+			     0, 0, NULL, 1, &barrier, 0, NULL);
+}
+
+void cbuf_release_image(VkCommandBuffer cbuf, VkImage image, VkImageAspectFlags aspect,
+                        uint32_t mip_level_ct, VkImageLayout old_layout, VkImageLayout new_layout,
+                        uint32_t src_fam, uint32_t dst_fam,
+                        VkAccessFlags src_access, VkPipelineStageFlags src_stage)
+{
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspect;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.subresourceRange.levelCount = mip_level_ct;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcAccessMask = src_access;
+
+	VkPipelineStageFlags dst_stage;
+	if (src_fam == dst_fam) {
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		dst_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	} else {
+		barrier.srcQueueFamilyIndex = src_fam;
+		barrier.dstQueueFamilyIndex = dst_fam;
+		dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	}
+
+	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+void cbuf_acquire_image(VkCommandBuffer cbuf, VkImage image, VkImageAspectFlags aspect,
+                        uint32_t mip_level_ct, VkImageLayout old_layout, VkImageLayout new_layout,
+                        uint32_t src_fam, uint32_t dst_fam,
+                        VkAccessFlags dst_access, VkPipelineStageFlags dst_stage)
+{
+	if (src_fam == dst_fam) return;
+
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = aspect;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.subresourceRange.levelCount = mip_level_ct;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = src_fam;
+	barrier.dstQueueFamilyIndex = dst_fam;
+	barrier.dstAccessMask = dst_access;
+
+	vkCmdPipelineBarrier(cbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage,
+			     0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+// Command buffers handed out by a CbufPool. `RECORDING` and `PENDING` ones are owned by the
+// caller/the GPU, `RETIRED` ones are done but can only be reused after their command pool is reset.
+#define CBUF_POOL_FREE 0
+#define CBUF_POOL_RECORDING 1
+#define CBUF_POOL_PENDING 2
+#define CBUF_POOL_RETIRED 3
+
+// Command pools a CbufPool cycles through, so one can be reset while the others still have work in
+// flight. One per frame in flight plus one is plenty.
+#define CBUF_POOL_RING 4
+
+struct CbufPoolEntry {
+        VkCommandBuffer cbuf;
+        VkFence fence;
+        int state;
+};
+
+// One command pool and the buffers allocated from it
+struct CbufPoolSlot {
+        VkCommandPool cpool;
+        uint32_t ct;
+        uint32_t cap;
+        struct CbufPoolEntry* entries;
+};
+
+struct CbufPoolStats {
+        // Command buffers handed out by `cbuf_pool_begin`
+        uint64_t begin_ct;
+        // How many of those needed a vkAllocateCommandBuffers, the rest were recycled
+        uint64_t alloc_ct;
+        // vkResetCommandPool calls
+        uint64_t reset_ct;
+};
+
+// Primary command buffers and fences for one-shot work (staging copies, layout transitions) on
+// one queue. Buffers are never freed one by one: they come from a ring of command pools, and once
+// every submission from a pool has signaled its fence the whole pool is reset with
+// vkResetCommandPool and everything in it becomes free again. New buffers come from the current
+// pool, which `cbuf_pool_reset` moves on from while it's busy, so pools keep getting reset even if
+// something is always in flight. Not thread safe, give each thread its own.
+struct CbufPool {
+        VkDevice device;
+        VkQueue queue;
+        uint32_t current;
+        struct CbufPoolSlot slots[CBUF_POOL_RING];
+        struct CbufPoolStats stats;
+};
+
+void cbuf_pool_create(VkDevice device, VkQueue queue, uint32_t queue_fam, struct CbufPool* pool) {
+        bzero(pool, sizeof(*pool));
+        pool->device = device;
+        pool->queue = queue;
+
+        // Only ever reset as a whole
+        VkCommandPoolCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        info.queueFamilyIndex = queue_fam;
+
+        for (uint32_t i = 0; i < CBUF_POOL_RING; i++) {
+                VkResult res = vkCreateCommandPool(device, &info, NULL, &pool->slots[i].cpool);
+                assert(res == VK_SUCCESS);
+        }
+}
+
+// Waits for everything still in flight.
+void cbuf_pool_destroy(struct CbufPool* pool) {
+        for (uint32_t i = 0; i < CBUF_POOL_RING; i++) {
+                struct CbufPoolSlot* slot = &pool->slots[i];
+                for (uint32_t j = 0; j < slot->ct; j++) {
+                        struct CbufPoolEntry* entry = &slot->entries[j];
+                        if (entry->state == CBUF_POOL_PENDING) {
+                                vkWaitForFences(pool->device, 1, &entry->fence, VK_TRUE,
+                                                UINT64_MAX);
+                        }
+                        vkDestroyFence(pool->device, entry->fence, NULL);
+                }
+                vkDestroyCommandPool(pool->device, slot->cpool, NULL);
+                free(slot->entries);
+        }
+}
+
+static struct CbufPoolEntry* cbuf_pool_find(struct CbufPool* pool, VkCommandBuffer cbuf) {
+        for (uint32_t i = 0; i < CBUF_POOL_RING; i++) {
+                struct CbufPoolSlot* slot = &pool->slots[i];
+                for (uint32_t j = 0; j < slot->ct; j++) {
+                        if (slot->entries[j].cbuf == cbuf) return &slot->entries[j];
+                }
+        }
+        assert(0 && "Command buffer isn't from this pool");
+        return NULL;
+}
+
+// Retires submissions whose fence has signaled and resets every command pool with nothing
+// recording or in flight anymore. If the current pool still has work in flight, moves on to the
+// next idle one and leaves that work to finish. Called by `cbuf_pool_begin` when it runs out, and
+// meant to be called once a frame (after waiting on the frame's fence) so the pool doesn't grow.
+void cbuf_pool_reset(struct CbufPool* pool) {
+        int idle[CBUF_POOL_RING];
+        for (uint32_t i = 0; i < CBUF_POOL_RING; i++) {
+                struct CbufPoolSlot* slot = &pool->slots[i];
+                int busy = 0, retired = 0;
+                for (uint32_t j = 0; j < slot->ct; j++) {
+                        struct CbufPoolEntry* entry = &slot->entries[j];
+                        if (entry->state == CBUF_POOL_PENDING
+                            && vkGetFenceStatus(pool->device, entry->fence) == VK_SUCCESS) {
+                                entry->state = CBUF_POOL_RETIRED;
+                        }
+                        if (entry->state == CBUF_POOL_RECORDING
+                            || entry->state == CBUF_POOL_PENDING) {
+                                busy = 1;
+                        }
+                        if (entry->state == CBUF_POOL_RETIRED) retired = 1;
+                }
+                idle[i] = !busy;
+                if (busy || !retired) continue;
+
+                VkResult res = vkResetCommandPool(pool->device, slot->cpool, 0);
+                assert(res == VK_SUCCESS);
+                for (uint32_t j = 0; j < slot->ct; j++) slot->entries[j].state = CBUF_POOL_FREE;
+                pool->stats.reset_ct++;
+        }
+
+        // If every other pool is still busy, keep filling the current one
+        for (uint32_t i = 1; i < CBUF_POOL_RING && !idle[pool->current]; i++) {
+                uint32_t next = (pool->current + i) % CBUF_POOL_RING;
+                if (idle[next]) {
+                        pool->current = next;
+                        break;
+                }
+        }
+}
+
+// Returns a primary command buffer that's already begun for one-time submit. Finish it with
+// `cbuf_pool_submit` or `cbuf_pool_submit_wait`.
+VkCommandBuffer cbuf_pool_begin(struct CbufPool* pool) {
+        struct CbufPoolEntry* entry = NULL;
+        struct CbufPoolSlot* slot = NULL;
+        for (int pass = 0; pass < 2 && entry == NULL; pass++) {
+                if (pass == 1) cbuf_pool_reset(pool);
+                slot = &pool->slots[pool->current];
+                for (uint32_t i = 0; i < slot->ct && entry == NULL; i++) {
+                        if (slot->entries[i].state == CBUF_POOL_FREE) entry = &slot->entries[i];
+                }
+        }
+
+        if (entry == NULL) {
+                if (slot->ct == slot->cap) {
+                        slot->cap = slot->cap == 0 ? 4 : slot->cap * 2;
+                        slot->entries = realloc(slot->entries,
+                                                slot->cap * sizeof(slot->entries[0]));
+                }
+                entry = &slot->entries[slot->ct++];
+                cbuf_alloc(pool->device, slot->cpool, &entry->cbuf);
+
+                VkFenceCreateInfo fence_info = {0};
+                fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                VkResult res = vkCreateFence(pool->device, &fence_info, NULL, &entry->fence);
+                assert(res == VK_SUCCESS);
+
+                pool->stats.alloc_ct++;
+        }
+
+        entry->state = CBUF_POOL_RECORDING;
+        pool->stats.begin_ct++;
+        cbuf_begin_onetime(entry->cbuf);
+        return entry->cbuf;
+}
+
+// Ends and submits `cbuf` without waiting. Returns the fence that signals when it's done, it stays
+// valid until the next `cbuf_pool_reset` that reuses it, so don't hold on to it past the frame.
+VkFence cbuf_pool_submit(struct CbufPool* pool, VkCommandBuffer cbuf) {
+        struct CbufPoolEntry* entry = cbuf_pool_find(pool, cbuf);
+        assert(entry->state == CBUF_POOL_RECORDING);
+
+        VkResult res = vkEndCommandBuffer(cbuf);
+        assert(res == VK_SUCCESS);
+
+        res = vkResetFences(pool->device, 1, &entry->fence);
+        assert(res == VK_SUCCESS);
+
+        VkSubmitInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &cbuf;
+
+        res = vkQueueSubmit(pool->queue, 1, &info, entry->fence);
+        assert(res == VK_SUCCESS);
+
+        entry->state = CBUF_POOL_PENDING;
+        return entry->fence;
+}
+
+// Like `cbuf_submit_wait`, but only waits for this submission instead of idling the whole queue.
+void cbuf_pool_submit_wait(struct CbufPool* pool, VkCommandBuffer cbuf) {
+        VkFence fence = cbuf_pool_submit(pool, cbuf);
+        VkResult res = vkWaitForFences(pool->device, 1, &fence, VK_TRUE, UINT64_MAX);
+        assert(res == VK_SUCCESS);
+        cbuf_pool_find(pool, cbuf)->state = CBUF_POOL_RETIRED;
+}
+
+void cbuf_pool_stats_print(const struct CbufPool* pool) {
+        const struct CbufPoolStats* s = &pool->stats;
+        printf("Command buffers: %lu handed out, %lu allocated, %lu allocations avoided, "
+               "%lu pool resets\n", (unsigned long) s->begin_ct, (unsigned long) s->alloc_ct,
+               (unsigned long) (s->begin_ct - s->alloc_ct), (unsigned long) s->reset_ct);
+}
+
 #endif // LL_CBUF_H
 
@@ -0,0 +1,65 @@
+#ifndef LL_FILE_H
+#define LL_FILE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maps a whole file read-only. Returns 0 if it can't be opened. An empty file gives a NULL `data`
+// and a `size` of 0.
+int file_map(const char* path, size_t* size, void** data) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return 0;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return 0;
+        }
+
+        *size = st.st_size;
+        *data = NULL;
+        if (st.st_size == 0) {
+                close(fd);
+                return 1;
+        }
+
+        void* ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) return 0;
+
+        *data = ptr;
+        return 1;
+}
+
+void file_unmap(size_t size, void* data) {
+        if (data != NULL) munmap(data, size);
+}
+
+// Writes to a temporary file and renames it, so a crash never leaves a half-written file behind.
+// Returns 0 on failure.
+int file_write_atomic(const char* path, size_t size, const void* data) {
+        size_t path_len = strlen(path);
+        char* tmp_path = malloc(path_len + 5);
+        memcpy(tmp_path, path, path_len);
+        memcpy(tmp_path + path_len, ".tmp", 5);
+
+        FILE* fp = fopen(tmp_path, "wb");
+        if (fp == NULL) {
+                free(tmp_path);
+                return 0;
+        }
+        size_t written = fwrite(data, 1, size, fp);
+        int ok = fclose(fp) == 0 && written == size;
+        if (ok) ok = rename(tmp_path, path) == 0;
+        if (!ok) remove(tmp_path);
+
+        free(tmp_path);
+        return ok;
+}
+
+#endif // LL_FILE_H
@@ -0,0 +1,404 @@
+#ifndef LL_FRAME_H
+#define LL_FRAME_H
+
+#include <vulkan/vulkan.h>
+
+#include "cbuf.h"
+#include "mem.h"
+#include "ring.h"
+#include "swapchain.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Everything one frame in flight needs. It's only touched again once the GPU is done with it.
+struct Frame {
+        VkCommandPool cpool;
+        VkCommandBuffer cbuf;
+        // Only without timeline semaphores
+        VkFence fence;
+        // With timeline semaphores: the value the frame's submission signals, 0 if never submitted
+        uint64_t timeline_value;
+        int submitted;
+        // Signaled by vkAcquireNextImageKHR
+        VkSemaphore acquired;
+};
+
+struct FrameStats {
+        uint64_t frame_ct;
+        // Time the CPU spent blocked waiting for an old frame to finish or a swapchain image
+        double cpu_wait_s;
+        double cpu_wait_total_s;
+        // Time the GPU spent between the end of one frame and the start of the next, from timestamps.
+        // These lag behind by `frame_ct` frames, since they're only read once a frame is done.
+        uint64_t gpu_frame_ct;
+        double gpu_idle_s;
+        double gpu_idle_total_s;
+        double gpu_busy_s;
+        double gpu_busy_total_s;
+};
+
+// Runs N frames in flight: waits for a frame's previous use to finish, resets its command pool,
+// acquires a swapchain image, and submits and presents. With `sc` set to NULL everywhere it works
+// without a swapchain too (offscreen, headless).
+//
+// Timeline semaphores need Vulkan 1.2 (or VK_KHR_timeline_semaphore) and the timelineSemaphore
+// feature enabled, e.g. a VkPhysicalDeviceVulkan12Features in base_create's `extra_features`.
+// Without them every frame gets its own fence instead. The wait is loaded from the device, so the
+// KHR entry point is used on a 1.1 device with only the extension.
+struct Frames {
+        VkDevice device;
+        VkQueue queue;
+        uint32_t frame_ct;
+        struct Frame* frames;
+        // Current frame, and how many frames have been started so far
+        uint32_t idx;
+        uint64_t number;
+
+        int timeline;
+        VkSemaphore timeline_sem;
+        uint64_t timeline_value;
+        PFN_vkWaitSemaphores wait_semaphores;
+
+        // Signaled when rendering to a swapchain image is done, waited on by the present. One per
+        // image, not per frame, since the presentation engine can hold on to it for a while.
+        uint32_t image_ct;
+        VkSemaphore* rendered;
+        uint32_t image_idx;
+
+        // Host-visible memory for the current frame's uniforms and such, see ring.h
+        struct Ring scratch;
+
+        // Two timestamps per frame, 0 if the queue doesn't support them
+        VkQueryPool queries;
+        double timestamp_period_s;
+        uint64_t last_gpu_end;
+
+        struct FrameStats stats;
+};
+
+static double frames_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void frames_rendered_create(struct Frames* frames, uint32_t image_ct) {
+        frames->image_ct = image_ct;
+        frames->rendered = malloc((image_ct > 0 ? image_ct : 1) * sizeof(frames->rendered[0]));
+        for (uint32_t i = 0; i < image_ct; i++) {
+                VkSemaphoreCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                VkResult res = vkCreateSemaphore(frames->device, &info, NULL, &frames->rendered[i]);
+                assert(res == VK_SUCCESS);
+        }
+}
+
+static void frames_rendered_destroy(struct Frames* frames) {
+        for (uint32_t i = 0; i < frames->image_ct; i++) {
+                vkDestroySemaphore(frames->device, frames->rendered[i], NULL);
+        }
+        free(frames->rendered);
+        frames->rendered = NULL;
+        frames->image_ct = 0;
+}
+
+// `image_ct` is the swapchain's image count, or 0 without one. `scratch_size` is per frame and
+// can be 0 for no scratch memory. 2 or 3 frames in flight is usually plenty.
+void frames_create(struct MemAllocator* allocator, VkDevice device, VkQueue queue, uint32_t queue_fam,
+                   uint32_t frame_ct, int use_timeline, uint32_t image_ct, VkDeviceSize scratch_size,
+                   struct Frames* frames)
+{
+        assert(frame_ct > 0);
+        bzero(frames, sizeof(*frames));
+        frames->device = device;
+        frames->queue = queue;
+        frames->frame_ct = frame_ct;
+        frames->timeline = use_timeline;
+
+        frames->frames = calloc(frame_ct, sizeof(frames->frames[0]));
+        for (uint32_t i = 0; i < frame_ct; i++) {
+                struct Frame* frame = &frames->frames[i];
+
+                // Only ever reset as a whole
+                VkCommandPoolCreateInfo cpool_info = {0};
+                cpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                cpool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                cpool_info.queueFamilyIndex = queue_fam;
+                VkResult res = vkCreateCommandPool(device, &cpool_info, NULL, &frame->cpool);
+                assert(res == VK_SUCCESS);
+                cbuf_alloc(device, frame->cpool, &frame->cbuf);
+
+                if (!use_timeline) {
+                        VkFenceCreateInfo fence_info = {0};
+                        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+                        res = vkCreateFence(device, &fence_info, NULL, &frame->fence);
+                        assert(res == VK_SUCCESS);
+                }
+
+                VkSemaphoreCreateInfo sem_info = {0};
+                sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                res = vkCreateSemaphore(device, &sem_info, NULL, &frame->acquired);
+                assert(res == VK_SUCCESS);
+        }
+
+        if (use_timeline) {
+                // Core in 1.2, the extension's otherwise. They're the same function.
+                frames->wait_semaphores =
+                        (PFN_vkWaitSemaphores) vkGetDeviceProcAddr(device, "vkWaitSemaphores");
+                if (frames->wait_semaphores == NULL) {
+                        frames->wait_semaphores = (PFN_vkWaitSemaphores)
+                                vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+                }
+                if (frames->wait_semaphores == NULL) {
+                        fprintf(stderr, "Timeline semaphores need Vulkan 1.2 or "
+                                "VK_KHR_timeline_semaphore\n");
+                        exit(1);
+                }
+
+                VkSemaphoreTypeCreateInfo type_info = {0};
+                type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+                type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+                type_info.initialValue = 0;
+
+                VkSemaphoreCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                info.pNext = &type_info;
+                VkResult res = vkCreateSemaphore(device, &info, NULL, &frames->timeline_sem);
+                assert(res == VK_SUCCESS);
+        }
+
+        frames_rendered_create(frames, image_ct);
+
+        if (scratch_size > 0) {
+                ring_create(allocator, device, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+                            | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, scratch_size, frame_ct,
+                            &frames->scratch);
+        }
+
+        // Timestamps, if the queue can do them
+        uint32_t fam_ct = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(allocator->phys_dev, &fam_ct, NULL);
+        VkQueueFamilyProperties* fam_props = malloc((fam_ct > 0 ? fam_ct : 1) * sizeof(fam_props[0]));
+        vkGetPhysicalDeviceQueueFamilyProperties(allocator->phys_dev, &fam_ct, fam_props);
+        int have_timestamps = queue_fam < fam_ct && fam_props[queue_fam].timestampValidBits > 0;
+        free(fam_props);
+
+        if (have_timestamps) {
+                VkPhysicalDeviceProperties props;
+                vkGetPhysicalDeviceProperties(allocator->phys_dev, &props);
+                frames->timestamp_period_s = props.limits.timestampPeriod / 1e9;
+
+                VkQueryPoolCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                info.queryCount = 2 * frame_ct;
+                VkResult res = vkCreateQueryPool(device, &info, NULL, &frames->queries);
+                assert(res == VK_SUCCESS);
+        }
+
+        // The first `frames_begin` moves to frame 0
+        frames->idx = frame_ct - 1;
+}
+
+// Waits for every frame still in flight.
+void frames_destroy(struct Frames* frames) {
+        vkQueueWaitIdle(frames->queue);
+
+        for (uint32_t i = 0; i < frames->frame_ct; i++) {
+                struct Frame* frame = &frames->frames[i];
+                vkDestroyCommandPool(frames->device, frame->cpool, NULL);
+                if (frame->fence != VK_NULL_HANDLE) vkDestroyFence(frames->device, frame->fence, NULL);
+                vkDestroySemaphore(frames->device, frame->acquired, NULL);
+        }
+        free(frames->frames);
+
+        if (frames->timeline_sem != VK_NULL_HANDLE) {
+                vkDestroySemaphore(frames->device, frames->timeline_sem, NULL);
+        }
+        frames_rendered_destroy(frames);
+        if (frames->scratch.frame_ct > 0) ring_destroy(frames->device, &frames->scratch);
+        if (frames->queries != VK_NULL_HANDLE) vkDestroyQueryPool(frames->device, frames->queries, NULL);
+}
+
+// Call after recreating the swapchain. Waits for the queue to go idle.
+void frames_swapchain_changed(struct Frames* frames, uint32_t image_ct) {
+        vkQueueWaitIdle(frames->queue);
+        frames_rendered_destroy(frames);
+        frames_rendered_create(frames, image_ct);
+}
+
+static void frames_wait(struct Frames* frames, struct Frame* frame) {
+        if (!frame->submitted) return;
+
+        VkResult res;
+        if (frames->timeline) {
+                VkSemaphoreWaitInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+                info.semaphoreCount = 1;
+                info.pSemaphores = &frames->timeline_sem;
+                info.pValues = &frame->timeline_value;
+                res = frames->wait_semaphores(frames->device, &info, UINT64_MAX);
+        } else {
+                res = vkWaitForFences(frames->device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+                if (res == VK_SUCCESS) res = vkResetFences(frames->device, 1, &frame->fence);
+        }
+        assert(res == VK_SUCCESS);
+}
+
+// The frame is done, so its timestamps are in
+static void frames_read_timestamps(struct Frames* frames, uint32_t idx) {
+        if (frames->queries == VK_NULL_HANDLE || !frames->frames[idx].submitted) return;
+
+        uint64_t ts[2];
+        VkResult res = vkGetQueryPoolResults(frames->device, frames->queries, 2 * idx, 2, sizeof(ts),
+                                             ts, sizeof(ts[0]), VK_QUERY_RESULT_64_BIT);
+        if (res != VK_SUCCESS) return;
+
+        struct FrameStats* s = &frames->stats;
+        s->gpu_busy_s = (ts[1] - ts[0]) * frames->timestamp_period_s;
+        s->gpu_idle_s = frames->last_gpu_end > 0 && ts[0] > frames->last_gpu_end
+                ? (ts[0] - frames->last_gpu_end) * frames->timestamp_period_s : 0;
+        s->gpu_frame_ct++;
+        s->gpu_busy_total_s += s->gpu_busy_s;
+        s->gpu_idle_total_s += s->gpu_idle_s;
+        frames->last_gpu_end = ts[1];
+}
+
+// Starts the next frame and returns its command buffer, already begun. With a swapchain, also
+// acquires an image into `frames->image_idx`; returns VK_NULL_HANDLE if the swapchain is out of
+// date, in which case recreate it, call `frames_swapchain_changed` and try again.
+VkCommandBuffer frames_begin(struct Frames* frames, const struct Swapchain* sc) {
+        frames->idx = (frames->idx + 1) % frames->frame_ct;
+        struct Frame* frame = &frames->frames[frames->idx];
+
+        double wait_start = frames_now();
+        frames_wait(frames, frame);
+        frames_read_timestamps(frames, frames->idx);
+        frame->submitted = 0;
+
+        if (sc != NULL) {
+                VkResult res = vkAcquireNextImageKHR(frames->device, sc->handle, UINT64_MAX,
+                                                     frame->acquired, VK_NULL_HANDLE,
+                                                     &frames->image_idx);
+                if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+                        // Nothing was submitted for this frame, so give it back
+                        frames->idx = (frames->idx + frames->frame_ct - 1) % frames->frame_ct;
+                        return VK_NULL_HANDLE;
+                }
+                assert(res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR);
+                assert(frames->image_idx < frames->image_ct);
+        }
+
+        frames->stats.cpu_wait_s = frames_now() - wait_start;
+        frames->stats.cpu_wait_total_s += frames->stats.cpu_wait_s;
+
+        // The scratch region was protected by the wait above already
+        if (frames->scratch.frame_ct > 0) {
+                ring_frame_begin(frames->device, &frames->scratch, VK_NULL_HANDLE);
+        }
+
+        VkResult res = vkResetCommandPool(frames->device, frame->cpool, 0);
+        assert(res == VK_SUCCESS);
+        cbuf_begin_onetime(frame->cbuf);
+
+        if (frames->queries != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(frame->cbuf, frames->queries, 2 * frames->idx, 2);
+                vkCmdWriteTimestamp(frame->cbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frames->queries,
+                                    2 * frames->idx);
+        }
+
+        frames->number++;
+        frames->stats.frame_ct++;
+        return frame->cbuf;
+}
+
+// Ends and submits the frame's command buffer, then presents if there's a swapchain. The swapchain
+// image has to be in VK_IMAGE_LAYOUT_PRESENT_SRC_KHR by the end of the command buffer. Returns 0 if
+// the swapchain is out of date or suboptimal and should be recreated.
+int frames_end(struct Frames* frames, const struct Swapchain* sc) {
+        struct Frame* frame = &frames->frames[frames->idx];
+
+        if (frames->queries != VK_NULL_HANDLE) {
+                vkCmdWriteTimestamp(frame->cbuf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames->queries,
+                                    2 * frames->idx + 1);
+        }
+        VkResult res = vkEndCommandBuffer(frame->cbuf);
+        assert(res == VK_SUCCESS);
+
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        VkSemaphore signals[2];
+        uint64_t signal_values[2] = {0};
+        uint32_t signal_ct = 0;
+        if (sc != NULL) signals[signal_ct++] = frames->rendered[frames->image_idx];
+
+        VkSubmitInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &frame->cbuf;
+        if (sc != NULL) {
+                info.waitSemaphoreCount = 1;
+                info.pWaitSemaphores = &frame->acquired;
+                info.pWaitDstStageMask = &wait_stage;
+        }
+
+        // Binary semaphores ignore their value
+        uint64_t wait_value = 0;
+        VkTimelineSemaphoreSubmitInfo timeline_info = {0};
+        if (frames->timeline) {
+                frame->timeline_value = ++frames->timeline_value;
+                signal_values[signal_ct] = frame->timeline_value;
+                signals[signal_ct++] = frames->timeline_sem;
+
+                timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+                timeline_info.waitSemaphoreValueCount = info.waitSemaphoreCount;
+                timeline_info.pWaitSemaphoreValues = &wait_value;
+                timeline_info.signalSemaphoreValueCount = signal_ct;
+                timeline_info.pSignalSemaphoreValues = signal_values;
+                info.pNext = &timeline_info;
+        }
+        info.signalSemaphoreCount = signal_ct;
+        info.pSignalSemaphores = signals;
+
+        res = vkQueueSubmit(frames->queue, 1, &info, frames->timeline ? VK_NULL_HANDLE : frame->fence);
+        assert(res == VK_SUCCESS);
+        frame->submitted = 1;
+
+        if (sc == NULL) return 1;
+
+        VkPresentInfoKHR present_info = {0};
+        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present_info.waitSemaphoreCount = 1;
+        present_info.pWaitSemaphores = &frames->rendered[frames->image_idx];
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &sc->handle;
+        present_info.pImageIndices = &frames->image_idx;
+
+        res = vkQueuePresentKHR(frames->queue, &present_info);
+        if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR) return 0;
+        assert(res == VK_SUCCESS);
+        return 1;
+}
+
+// Averages over every frame so far. If the CPU rarely waits but the GPU idles, the CPU is the
+// bottleneck and more frames in flight won't help; if the CPU waits a lot, fewer frames in flight
+// cut latency for free.
+void frames_stats_print(const struct Frames* frames) {
+        const struct FrameStats* s = &frames->stats;
+        double n = s->frame_ct > 0 ? s->frame_ct : 1;
+        printf("%lu frames, %u in flight (%s): CPU wait %.3f ms avg", (unsigned long) s->frame_ct,
+               frames->frame_ct, frames->timeline ? "timeline semaphore" : "fences",
+               s->cpu_wait_total_s / n * 1e3);
+        if (frames->queries != VK_NULL_HANDLE && s->gpu_frame_ct > 0) {
+                printf(", GPU busy %.3f ms avg, GPU idle %.3f ms avg",
+                       s->gpu_busy_total_s / s->gpu_frame_ct * 1e3,
+                       s->gpu_idle_total_s / s->gpu_frame_ct * 1e3);
+        }
+        printf("\n");
+}
+
+#endif // LL_FRAME_H
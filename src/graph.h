@@ -0,0 +1,783 @@
+#ifndef LL_GRAPH_H
+#define LL_GRAPH_H
+
+#include <vulkan/vulkan.h>
+
+#include "image.h"
+#include "mem.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRAPH_MAX_PASS_USES 16
+// 8 color attachments plus depth
+#define GRAPH_MAX_ATTACHMENTS 9
+
+// How a pass uses a resource
+#define GRAPH_USE_COLOR 0
+#define GRAPH_USE_DEPTH 1
+#define GRAPH_USE_SAMPLED 2
+#define GRAPH_USE_STORAGE 3
+
+// Records the pass. For passes with attachments it's called inside the render pass the graph
+// made for it, so only the pipeline, sets, dynamic state and draws are left to do.
+typedef void (*GraphPassFn)(VkCommandBuffer cbuf, void* data);
+
+struct GraphUse {
+        uint32_t res;
+        int kind;
+        int clear;
+        VkClearValue clear_value;
+        // Only for sampled and storage uses
+        VkPipelineStageFlags stage;
+};
+
+struct GraphFramebuffer {
+        VkImageView views[GRAPH_MAX_ATTACHMENTS];
+        VkFramebuffer handle;
+};
+
+struct GraphPass {
+        const char* name;
+        GraphPassFn fn;
+        void* data;
+        uint32_t use_ct;
+        struct GraphUse uses[GRAPH_MAX_PASS_USES];
+
+        // Everything below is filled in by `graph_compile`
+        int culled;
+        // VK_NULL_HANDLE if the pass has no attachments (compute, copies)
+        VkRenderPass rpass;
+        uint32_t width;
+        uint32_t height;
+        uint32_t attachment_ct;
+        // Indices into `uses`, colors first then depth
+        uint32_t attachments[GRAPH_MAX_ATTACHMENTS];
+        // One per set of attachment views seen so far, e.g. one per swapchain image
+        uint32_t fb_ct;
+        uint32_t fb_cap;
+        struct GraphFramebuffer* fbs;
+};
+
+struct GraphResource {
+        const char* name;
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+
+        // Imported images belong to the caller, transient ones are created by `graph_compile` and
+        // share memory with other transients that are never alive at the same time
+        int imported;
+        struct Image* import;
+        struct Image own;
+
+        int output;
+        struct ImageState final;
+
+        // Filled in by `graph_compile`. `first` and `last` are positions in the execution order.
+        int used;
+        uint32_t first;
+        uint32_t last;
+        VkImageUsageFlags usage;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+};
+
+struct GraphStats {
+        uint32_t pass_ct;
+        uint32_t culled_ct;
+        uint32_t transient_ct;
+        // What the transients would take with memory of their own, and what they take aliased
+        VkDeviceSize transient_bytes;
+        VkDeviceSize aliased_bytes;
+};
+
+// A frame graph. Passes say which images they render to and read from; `graph_compile` drops the
+// passes nothing depends on, orders the rest, builds their render passes and places the transient
+// images in one block of memory, overlapping wherever their lifetimes don't. `graph_execute` then
+// records every pass with the barriers worked out from the images' tracked state.
+//
+// A resource is written by all of its writers, in the order they were added, before any pass reads
+// it. Only resources marked with `graph_output` (and whatever they depend on) keep passes alive.
+struct Graph {
+        struct MemAllocator* allocator;
+        VkDevice device;
+
+        uint32_t pass_ct;
+        uint32_t pass_cap;
+        struct GraphPass* passes;
+        uint32_t res_ct;
+        uint32_t res_cap;
+        struct GraphResource* resources;
+
+        int compiled;
+        uint32_t order_ct;
+        uint32_t* order;
+        struct MemAlloc transient_mem;
+
+        struct ImageBarriers barriers;
+        struct GraphStats stats;
+};
+
+void graph_create(struct MemAllocator* allocator, VkDevice device, struct Graph* graph) {
+        bzero(graph, sizeof(*graph));
+        graph->allocator = allocator;
+        graph->device = device;
+        image_barriers_init(&graph->barriers);
+}
+
+static void graph_release(struct Graph* graph) {
+        for (uint32_t i = 0; i < graph->pass_ct; i++) {
+                struct GraphPass* pass = &graph->passes[i];
+                for (uint32_t j = 0; j < pass->fb_ct; j++) {
+                        vkDestroyFramebuffer(graph->device, pass->fbs[j].handle, NULL);
+                }
+                free(pass->fbs);
+                pass->fbs = NULL;
+                pass->fb_ct = 0;
+                pass->fb_cap = 0;
+                if (pass->rpass != VK_NULL_HANDLE) {
+                        vkDestroyRenderPass(graph->device, pass->rpass, NULL);
+                }
+                pass->rpass = VK_NULL_HANDLE;
+                pass->width = 0;
+                pass->height = 0;
+                pass->attachment_ct = 0;
+        }
+
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                struct GraphResource* res = &graph->resources[i];
+                if (res->imported || res->own.handle == VK_NULL_HANDLE) continue;
+                vkDestroyImageView(graph->device, res->own.view, NULL);
+                vkDestroyImage(graph->device, res->own.handle, NULL);
+                bzero(&res->own, sizeof(res->own));
+        }
+        if (graph->transient_mem.block != NULL) mem_free(&graph->transient_mem);
+
+        free(graph->order);
+        graph->order = NULL;
+        graph->order_ct = 0;
+        graph->compiled = 0;
+}
+
+// The GPU must be done with everything the graph recorded.
+void graph_destroy(struct Graph* graph) {
+        graph_release(graph);
+        free(graph->passes);
+        free(graph->resources);
+        image_barriers_destroy(&graph->barriers);
+}
+
+static uint32_t graph_resource_add(struct Graph* graph, const char* name, VkFormat format,
+                                   uint32_t width, uint32_t height)
+{
+        graph->compiled = 0;
+        if (graph->res_ct == graph->res_cap) {
+                graph->res_cap = graph->res_cap == 0 ? 16 : graph->res_cap * 2;
+                graph->resources = realloc(graph->resources,
+                                           graph->res_cap * sizeof(graph->resources[0]));
+        }
+
+        struct GraphResource* res = &graph->resources[graph->res_ct];
+        bzero(res, sizeof(*res));
+        res->name = name;
+        res->format = format;
+        res->width = width;
+        res->height = height;
+        return graph->res_ct++;
+}
+
+// An image the graph creates and owns. Its contents don't survive from one frame to the next.
+uint32_t graph_transient(struct Graph* graph, const char* name, VkFormat format,
+                         uint32_t width, uint32_t height)
+{
+        return graph_resource_add(graph, name, format, width, height);
+}
+
+// An image that lives outside the graph, like a swapchain image (see `image_wrap`) or a texture
+// that later frames read. `image` can be pointed at a different image between executions as long
+// as the format and size stay the same.
+uint32_t graph_import(struct Graph* graph, const char* name, struct Image* image, VkFormat format,
+                      uint32_t width, uint32_t height)
+{
+        uint32_t idx = graph_resource_add(graph, name, format, width, height);
+        graph->resources[idx].imported = 1;
+        graph->resources[idx].import = image;
+        return idx;
+}
+
+// Marks `res` as a result of the graph. It's left in `layout`, ready for `access` in `stage`
+// (e.g. VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT).
+void graph_output(struct Graph* graph, uint32_t res, VkImageLayout layout, VkAccessFlags access,
+                  VkPipelineStageFlags stage)
+{
+        assert(res < graph->res_ct);
+        graph->compiled = 0;
+        graph->resources[res].output = 1;
+        graph->resources[res].final = (struct ImageState){layout, access, stage};
+}
+
+uint32_t graph_pass(struct Graph* graph, const char* name, GraphPassFn fn, void* data) {
+        graph->compiled = 0;
+        if (graph->pass_ct == graph->pass_cap) {
+                graph->pass_cap = graph->pass_cap == 0 ? 16 : graph->pass_cap * 2;
+                graph->passes = realloc(graph->passes, graph->pass_cap * sizeof(graph->passes[0]));
+        }
+
+        struct GraphPass* pass = &graph->passes[graph->pass_ct];
+        bzero(pass, sizeof(*pass));
+        pass->name = name;
+        pass->fn = fn;
+        pass->data = data;
+        return graph->pass_ct++;
+}
+
+static void graph_use_add(struct Graph* graph, uint32_t pass_idx, uint32_t res, int kind,
+                          const VkClearValue* clear, VkPipelineStageFlags stage)
+{
+        assert(pass_idx < graph->pass_ct && res < graph->res_ct);
+        graph->compiled = 0;
+        struct GraphPass* pass = &graph->passes[pass_idx];
+        assert(pass->use_ct < GRAPH_MAX_PASS_USES);
+
+        struct GraphUse* use = &pass->uses[pass->use_ct++];
+        bzero(use, sizeof(*use));
+        use->res = res;
+        use->kind = kind;
+        use->stage = stage;
+        if (clear != NULL) {
+                use->clear = 1;
+                use->clear_value = *clear;
+        }
+}
+
+// Renders to `res` as a color attachment. With a NULL `clear` the previous contents are kept
+// (or left undefined if nothing wrote them yet).
+void graph_pass_color(struct Graph* graph, uint32_t pass, uint32_t res, const VkClearValue* clear) {
+        graph_use_add(graph, pass, res, GRAPH_USE_COLOR, clear, 0);
+}
+
+void graph_pass_depth(struct Graph* graph, uint32_t pass, uint32_t res, const VkClearValue* clear) {
+        graph_use_add(graph, pass, res, GRAPH_USE_DEPTH, clear, 0);
+}
+
+// Samples `res` in `stage`, usually VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT.
+void graph_pass_read(struct Graph* graph, uint32_t pass, uint32_t res, VkPipelineStageFlags stage) {
+        graph_use_add(graph, pass, res, GRAPH_USE_SAMPLED, NULL, stage);
+}
+
+// Reads and writes `res` as a storage image in `stage`.
+void graph_pass_storage(struct Graph* graph, uint32_t pass, uint32_t res,
+                        VkPipelineStageFlags stage)
+{
+        graph_use_add(graph, pass, res, GRAPH_USE_STORAGE, NULL, stage);
+}
+
+struct Image* graph_image(struct Graph* graph, uint32_t res) {
+        assert(res < graph->res_ct);
+        struct GraphResource* r = &graph->resources[res];
+        return r->imported ? r->import : &r->own;
+}
+
+static VkImageAspectFlags graph_format_aspect(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+        case VK_FORMAT_D32_SFLOAT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        case VK_FORMAT_S8_UINT:
+                return VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+                return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+}
+
+static int graph_use_writes(const struct GraphUse* use) {
+        return use->kind != GRAPH_USE_SAMPLED;
+}
+
+// Layout, access and stage for a use
+static struct ImageState graph_use_state(const struct GraphUse* use) {
+        switch (use->kind) {
+        case GRAPH_USE_COLOR:
+                return (struct ImageState){
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+                                | (use->clear ? 0 : VK_ACCESS_COLOR_ATTACHMENT_READ_BIT),
+                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        case GRAPH_USE_DEPTH:
+                return (struct ImageState){
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                                | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                                | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT};
+        case GRAPH_USE_SAMPLED:
+                return (struct ImageState){VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                           VK_ACCESS_SHADER_READ_BIT, use->stage};
+        default:
+                return (struct ImageState){VK_IMAGE_LAYOUT_GENERAL,
+                                           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                                           use->stage};
+        }
+}
+
+static int graph_pass_uses(const struct GraphPass* pass, uint32_t res, int want_write) {
+        for (uint32_t i = 0; i < pass->use_ct; i++) {
+                if (pass->uses[i].res != res) continue;
+                if (graph_use_writes(&pass->uses[i]) == want_write) return 1;
+        }
+        return 0;
+}
+
+// A pass is needed if it writes something needed. Whatever a needed pass reads is needed too, and
+// so is anything it loads instead of clearing.
+static void graph_cull(struct Graph* graph) {
+        int* needed = calloc(graph->res_ct > 0 ? graph->res_ct : 1, sizeof(needed[0]));
+        for (uint32_t i = 0; i < graph->res_ct; i++) needed[i] = graph->resources[i].output;
+        for (uint32_t i = 0; i < graph->pass_ct; i++) graph->passes[i].culled = 1;
+
+        int changed = 1;
+        while (changed) {
+                changed = 0;
+                for (uint32_t i = 0; i < graph->pass_ct; i++) {
+                        struct GraphPass* pass = &graph->passes[i];
+                        if (!pass->culled) continue;
+
+                        for (uint32_t j = 0; j < pass->use_ct && pass->culled; j++) {
+                                const struct GraphUse* use = &pass->uses[j];
+                                if (graph_use_writes(use) && needed[use->res]) pass->culled = 0;
+                        }
+                        if (pass->culled) continue;
+
+                        changed = 1;
+                        for (uint32_t j = 0; j < pass->use_ct; j++) {
+                                const struct GraphUse* use = &pass->uses[j];
+                                if (!graph_use_writes(use) || !use->clear) needed[use->res] = 1;
+                        }
+                }
+        }
+
+        free(needed);
+}
+
+// Topological sort of the passes that survived culling. Among passes that are ready, the one added
+// first goes first, so independent passes keep the order they were added in.
+static void graph_sort(struct Graph* graph) {
+        uint32_t pass_ct = graph->pass_ct;
+        uint32_t* dep_ct = calloc(pass_ct > 0 ? pass_ct : 1, sizeof(dep_ct[0]));
+        // dep[a * pass_ct + b] is set if b has to wait for a
+        char* dep = calloc(pass_ct > 0 ? pass_ct * pass_ct : 1, 1);
+
+        for (uint32_t a = 0; a < pass_ct; a++) {
+                if (graph->passes[a].culled) continue;
+                for (uint32_t b = 0; b < pass_ct; b++) {
+                        if (a == b || graph->passes[b].culled) continue;
+                        const struct GraphPass* pa = &graph->passes[a];
+                        const struct GraphPass* pb = &graph->passes[b];
+
+                        int before = 0;
+                        for (uint32_t i = 0; i < pa->use_ct && !before; i++) {
+                                const struct GraphUse* use = &pa->uses[i];
+                                if (!graph_use_writes(use)) continue;
+                                // Readers after every writer, writers in the order they were added
+                                if (graph_pass_uses(pb, use->res, 0)
+                                    && !graph_pass_uses(pb, use->res, 1)) before = 1;
+                                if (a < b && graph_pass_uses(pb, use->res, 1)) before = 1;
+                        }
+                        if (before && !dep[a * pass_ct + b]) {
+                                dep[a * pass_ct + b] = 1;
+                                dep_ct[b]++;
+                        }
+                }
+        }
+
+        graph->order = malloc((pass_ct > 0 ? pass_ct : 1) * sizeof(graph->order[0]));
+        graph->order_ct = 0;
+        char* placed = calloc(pass_ct > 0 ? pass_ct : 1, 1);
+        for (;;) {
+                uint32_t next = UINT32_MAX;
+                for (uint32_t i = 0; i < pass_ct && next == UINT32_MAX; i++) {
+                        if (!graph->passes[i].culled && !placed[i] && dep_ct[i] == 0) next = i;
+                }
+                if (next == UINT32_MAX) break;
+
+                placed[next] = 1;
+                graph->order[graph->order_ct++] = next;
+                for (uint32_t i = 0; i < pass_ct; i++) {
+                        if (dep[next * pass_ct + i]) dep_ct[i]--;
+                }
+        }
+
+        for (uint32_t i = 0; i < pass_ct; i++) {
+                if (!graph->passes[i].culled && !placed[i]) {
+                        fprintf(stderr, "Render graph has a cycle through pass %s\n",
+                                graph->passes[i].name);
+                        exit(1);
+                }
+        }
+
+        free(placed);
+        free(dep);
+        free(dep_ct);
+}
+
+static void graph_lifetimes(struct Graph* graph) {
+        for (uint32_t i = 0; i < graph->order_ct; i++) {
+                const struct GraphPass* pass = &graph->passes[graph->order[i]];
+                for (uint32_t j = 0; j < pass->use_ct; j++) {
+                        const struct GraphUse* use = &pass->uses[j];
+                        struct GraphResource* res = &graph->resources[use->res];
+                        if (!res->used) res->first = i;
+                        res->used = 1;
+                        res->last = i;
+
+                        if (use->kind == GRAPH_USE_COLOR) {
+                                res->usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+                        } else if (use->kind == GRAPH_USE_DEPTH) {
+                                res->usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+                        } else if (use->kind == GRAPH_USE_SAMPLED) {
+                                res->usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+                        } else {
+                                res->usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+                        }
+                }
+        }
+
+        // Outputs have to make it to the end of the frame
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                struct GraphResource* res = &graph->resources[i];
+                if (res->output && res->used) res->last = graph->order_ct;
+        }
+}
+
+static int graph_lifetimes_overlap(const struct GraphResource* a, const struct GraphResource* b) {
+        return a->first <= b->last && b->first <= a->last;
+}
+
+static int graph_memory_overlaps(const struct GraphResource* a, const struct GraphResource* b) {
+        return a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+// Creates the transient images and packs them into one allocation. Biggest first, each one goes
+// at the lowest offset that doesn't collide with anything placed already whose lifetime overlaps.
+static void graph_place_transients(struct Graph* graph) {
+        uint32_t cap = graph->res_ct > 0 ? graph->res_ct : 1;
+        uint32_t* placed = malloc(cap * sizeof(placed[0]));
+        uint32_t placed_ct = 0;
+        VkDeviceSize* alignments = malloc(cap * sizeof(alignments[0]));
+
+        VkMemoryRequirements total = {0};
+        total.alignment = 1;
+        total.memoryTypeBits = UINT32_MAX;
+
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                struct GraphResource* res = &graph->resources[i];
+                if (res->imported || !res->used) continue;
+
+                VkImageCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+                info.imageType = VK_IMAGE_TYPE_2D;
+                info.extent = (VkExtent3D){res->width, res->height, 1};
+                info.mipLevels = 1;
+                info.arrayLayers = 1;
+                info.format = res->format;
+                info.tiling = VK_IMAGE_TILING_OPTIMAL;
+                info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                info.usage = res->usage;
+                info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+                info.samples = VK_SAMPLE_COUNT_1_BIT;
+
+                VkResult vk_res = vkCreateImage(graph->device, &info, NULL, &res->own.handle);
+                assert(vk_res == VK_SUCCESS);
+
+                VkMemoryRequirements reqs;
+                vkGetImageMemoryRequirements(graph->device, res->own.handle, &reqs);
+                res->size = reqs.size;
+                alignments[i] = reqs.alignment;
+                if (reqs.alignment > total.alignment) total.alignment = reqs.alignment;
+                total.memoryTypeBits &= reqs.memoryTypeBits;
+
+                graph->stats.transient_ct++;
+                graph->stats.transient_bytes += reqs.size;
+                placed[placed_ct++] = i;
+        }
+
+        // Sort by size, biggest first
+        for (uint32_t i = 1; i < placed_ct; i++) {
+                uint32_t idx = placed[i];
+                uint32_t j = i;
+                while (j > 0 && graph->resources[placed[j - 1]].size < graph->resources[idx].size) {
+                        placed[j] = placed[j - 1];
+                        j--;
+                }
+                placed[j] = idx;
+        }
+
+        for (uint32_t i = 0; i < placed_ct; i++) {
+                struct GraphResource* res = &graph->resources[placed[i]];
+                VkDeviceSize align = alignments[placed[i]];
+
+                // Candidates are 0 and the end of every conflicting resource
+                VkDeviceSize best = UINT64_MAX;
+                for (uint32_t c = 0; c <= i; c++) {
+                        VkDeviceSize candidate = 0;
+                        if (c < i) {
+                                const struct GraphResource* other = &graph->resources[placed[c]];
+                                if (!graph_lifetimes_overlap(res, other)) continue;
+                                candidate = (other->offset + other->size + align - 1) / align
+                                            * align;
+                        }
+                        if (candidate >= best) continue;
+
+                        res->offset = candidate;
+                        int fits = 1;
+                        for (uint32_t o = 0; o < i && fits; o++) {
+                                const struct GraphResource* other = &graph->resources[placed[o]];
+                                if (graph_lifetimes_overlap(res, other)
+                                    && graph_memory_overlaps(res, other)) {
+                                        fits = 0;
+                                }
+                        }
+                        if (fits) best = candidate;
+                }
+                res->offset = best;
+                if (res->offset + res->size > total.size) total.size = res->offset + res->size;
+        }
+        graph->stats.aliased_bytes = total.size;
+
+        if (placed_ct > 0) {
+                assert(total.memoryTypeBits != 0);
+                mem_suballoc(graph->allocator, &total, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+                             &graph->transient_mem);
+        }
+
+        for (uint32_t i = 0; i < placed_ct; i++) {
+                struct GraphResource* res = &graph->resources[placed[i]];
+                VkResult vk_res = vkBindImageMemory(graph->device, res->own.handle,
+                                                    graph->transient_mem.mem,
+                                                    graph->transient_mem.offset + res->offset);
+                assert(vk_res == VK_SUCCESS);
+
+                res->own.aspect = graph_format_aspect(res->format);
+                res->own.mip_levels = 1;
+                res->own.states[0].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                image_view_create(graph->device, res->own.handle, res->format, VK_IMAGE_TYPE_2D,
+                                  res->own.aspect, 1, &res->own.view);
+        }
+
+        free(alignments);
+        free(placed);
+}
+
+static void graph_rpass_create(struct Graph* graph, uint32_t pos) {
+        struct GraphPass* pass = &graph->passes[graph->order[pos]];
+
+        VkAttachmentDescription descs[GRAPH_MAX_ATTACHMENTS] = {0};
+        VkAttachmentReference color_refs[GRAPH_MAX_ATTACHMENTS] = {0};
+        VkAttachmentReference depth_ref = {0};
+        uint32_t color_ct = 0;
+        int has_depth = 0;
+
+        // Colors first, then depth
+        for (int want_depth = 0; want_depth < 2; want_depth++) {
+                for (uint32_t i = 0; i < pass->use_ct; i++) {
+                        const struct GraphUse* use = &pass->uses[i];
+                        if (use->kind != (want_depth ? GRAPH_USE_DEPTH : GRAPH_USE_COLOR)) continue;
+                        assert(!(want_depth && has_depth) && "Only one depth attachment per pass");
+
+                        const struct GraphResource* res = &graph->resources[use->res];
+                        if (pass->attachment_ct == 0) {
+                                pass->width = res->width;
+                                pass->height = res->height;
+                        }
+                        assert(res->width == pass->width && res->height == pass->height);
+
+                        uint32_t idx = pass->attachment_ct++;
+                        pass->attachments[idx] = i;
+                        VkImageLayout layout = graph_use_state(use).layout;
+
+                        VkAttachmentDescription* desc = &descs[idx];
+                        desc->format = res->format;
+                        desc->samples = VK_SAMPLE_COUNT_1_BIT;
+                        if (use->clear) {
+                                desc->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                        } else if (!res->imported && res->first == pos) {
+                                desc->loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                        } else {
+                                desc->loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                        }
+                        // Nobody would see it
+                        int kept = res->imported || res->output || res->last > pos;
+                        desc->storeOp = kept ? VK_ATTACHMENT_STORE_OP_STORE
+                                             : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                        desc->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                        desc->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                        if (graph_format_aspect(res->format) & VK_IMAGE_ASPECT_STENCIL_BIT) {
+                                desc->stencilLoadOp = desc->loadOp;
+                                desc->stencilStoreOp = desc->storeOp;
+                        }
+                        // The graph's barriers take care of transitions
+                        desc->initialLayout = layout;
+                        desc->finalLayout = layout;
+
+                        if (want_depth) {
+                                depth_ref.attachment = idx;
+                                depth_ref.layout = layout;
+                                has_depth = 1;
+                        } else {
+                                color_refs[color_ct].attachment = idx;
+                                color_refs[color_ct].layout = layout;
+                                color_ct++;
+                        }
+                }
+        }
+        if (pass->attachment_ct == 0) return;
+
+        VkSubpassDescription subpass = {0};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = color_ct;
+        subpass.pColorAttachments = color_refs;
+        subpass.pDepthStencilAttachment = has_depth ? &depth_ref : NULL;
+
+        VkRenderPassCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        info.attachmentCount = pass->attachment_ct;
+        info.pAttachments = descs;
+        info.subpassCount = 1;
+        info.pSubpasses = &subpass;
+
+        VkResult res = vkCreateRenderPass(graph->device, &info, NULL, &pass->rpass);
+        assert(res == VK_SUCCESS);
+}
+
+// Call once all the passes and resources are in. Adding more afterwards means compiling again
+// before the next `graph_execute`, which rebuilds everything, so wait for the GPU to finish with
+// the graph first.
+void graph_compile(struct Graph* graph) {
+        graph_release(graph);
+        bzero(&graph->stats, sizeof(graph->stats));
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                struct GraphResource* res = &graph->resources[i];
+                res->used = 0;
+                res->usage = 0;
+                res->offset = 0;
+                res->size = 0;
+        }
+
+        graph_cull(graph);
+        graph_sort(graph);
+        graph_lifetimes(graph);
+        graph_place_transients(graph);
+        for (uint32_t i = 0; i < graph->order_ct; i++) graph_rpass_create(graph, i);
+
+        graph->stats.pass_ct = graph->pass_ct;
+        graph->stats.culled_ct = graph->pass_ct - graph->order_ct;
+        graph->compiled = 1;
+}
+
+static VkFramebuffer graph_framebuffer_get(struct Graph* graph, struct GraphPass* pass) {
+        VkImageView views[GRAPH_MAX_ATTACHMENTS] = {0};
+        for (uint32_t i = 0; i < pass->attachment_ct; i++) {
+                views[i] = graph_image(graph, pass->uses[pass->attachments[i]].res)->view;
+        }
+
+        for (uint32_t i = 0; i < pass->fb_ct; i++) {
+                if (memcmp(pass->fbs[i].views, views, sizeof(views)) == 0) {
+                        return pass->fbs[i].handle;
+                }
+        }
+
+        if (pass->fb_ct == pass->fb_cap) {
+                pass->fb_cap = pass->fb_cap == 0 ? 4 : pass->fb_cap * 2;
+                pass->fbs = realloc(pass->fbs, pass->fb_cap * sizeof(pass->fbs[0]));
+        }
+        struct GraphFramebuffer* fb = &pass->fbs[pass->fb_ct++];
+        memcpy(fb->views, views, sizeof(views));
+        framebuffer_create(graph->device, pass->rpass, pass->width, pass->height,
+                           pass->attachment_ct, views, &fb->handle);
+        return fb->handle;
+}
+
+// A transient's contents are thrown away when it comes into use, but whatever used its memory last
+// (itself last frame, or another transient aliasing it) still has to be waited for.
+static void graph_transient_begin(struct Graph* graph, struct GraphResource* res) {
+        struct ImageState state = {VK_IMAGE_LAYOUT_UNDEFINED, 0, 0};
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                const struct GraphResource* other = &graph->resources[i];
+                if (other->imported || !other->used || !graph_memory_overlaps(res, other)) continue;
+                state.access |= other->own.states[0].access;
+                state.stage |= other->own.states[0].stage;
+        }
+        res->own.states[0] = state;
+}
+
+// Records every pass into `cbuf`, which must be outside a render pass.
+void graph_execute(struct Graph* graph, VkCommandBuffer cbuf) {
+        assert(graph->compiled);
+
+        for (uint32_t pos = 0; pos < graph->order_ct; pos++) {
+                struct GraphPass* pass = &graph->passes[graph->order[pos]];
+
+                for (uint32_t i = 0; i < pass->use_ct; i++) {
+                        const struct GraphUse* use = &pass->uses[i];
+                        struct GraphResource* res = &graph->resources[use->res];
+                        if (!res->imported && res->first == pos) graph_transient_begin(graph, res);
+
+                        struct ImageState want = graph_use_state(use);
+                        image_barriers_add(&graph->barriers, graph_image(graph, use->res), 0, 1,
+                                           want.layout, want.access, want.stage);
+                }
+                image_barriers_flush(&graph->barriers, cbuf);
+
+                if (pass->rpass == VK_NULL_HANDLE) {
+                        pass->fn(cbuf, pass->data);
+                        continue;
+                }
+
+                VkClearValue clears[GRAPH_MAX_ATTACHMENTS] = {0};
+                for (uint32_t i = 0; i < pass->attachment_ct; i++) {
+                        clears[i] = pass->uses[pass->attachments[i]].clear_value;
+                }
+
+                VkRenderPassBeginInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+                info.renderPass = pass->rpass;
+                info.framebuffer = graph_framebuffer_get(graph, pass);
+                info.renderArea.extent = (VkExtent2D){pass->width, pass->height};
+                info.clearValueCount = pass->attachment_ct;
+                info.pClearValues = clears;
+
+                vkCmdBeginRenderPass(cbuf, &info, VK_SUBPASS_CONTENTS_INLINE);
+                pass->fn(cbuf, pass->data);
+                vkCmdEndRenderPass(cbuf);
+        }
+
+        for (uint32_t i = 0; i < graph->res_ct; i++) {
+                const struct GraphResource* res = &graph->resources[i];
+                if (!res->output || !res->used) continue;
+                image_barriers_add(&graph->barriers, graph_image(graph, i), 0, 1, res->final.layout,
+                                   res->final.access, res->final.stage);
+        }
+        image_barriers_flush(&graph->barriers, cbuf);
+}
+
+void graph_stats_print(const struct Graph* graph) {
+        const struct GraphStats* s = &graph->stats;
+        printf("Render graph: %u passes (%u culled), %u transient images in %.2f MB instead of "
+               "%.2f MB\n", s->pass_ct, s->culled_ct, s->transient_ct, s->aliased_bytes / 1e6,
+               s->transient_bytes / 1e6);
+        for (uint32_t i = 0; i < graph->order_ct; i++) {
+                printf("  %u: %s\n", i, graph->passes[graph->order[i]].name);
+        }
+        image_barriers_stats_print(&graph->barriers);
+}
+
+#endif // LL_GRAPH_H
@@ -0,0 +1,152 @@
+#ifndef LL_HASH_H
+#define LL_HASH_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+const uint64_t HASH_FNV_PRIME = 0x100000001b3ULL;
+
+// 64-bit FNV-1a. Pass HASH_SEED to start, or a previous result to chain several pieces of data.
+uint64_t hash_bytes(uint64_t hash, size_t size, const void* data) {
+        const unsigned char* bytes = data;
+        for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= HASH_FNV_PRIME;
+        }
+        return hash;
+}
+
+// Same idea as `hash_bytes`, but mixes in 8 bytes at a time. Not the same result as FNV-1a; it's
+// for hashing whole files where byte-at-a-time is too slow.
+uint64_t hash_bytes_wide(uint64_t hash, size_t size, const void* data) {
+        const unsigned char* bytes = data;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                memcpy(&word, &bytes[i], 8);
+                hash ^= word;
+                hash *= HASH_FNV_PRIME;
+                hash ^= hash >> 32;
+        }
+        return hash_bytes(hash, size - i, &bytes[i]);
+}
+
+uint64_t hash_u64(uint64_t hash, uint64_t value) {
+        return hash_bytes(hash, sizeof(value), &value);
+}
+
+// Key bytes built up one piece at a time, for a HashTable. Reuse one with `hash_key_reset` to avoid
+// allocating for every lookup.
+struct HashKey {
+        size_t size;
+        size_t cap;
+        unsigned char* data;
+};
+
+void hash_key_reset(struct HashKey* key) {
+        key->size = 0;
+}
+
+void hash_key_add(struct HashKey* key, size_t size, const void* data) {
+        if (key->size + size > key->cap) {
+                while (key->size + size > key->cap) key->cap = key->cap == 0 ? 256 : key->cap * 2;
+                key->data = realloc(key->data, key->cap);
+        }
+        if (size > 0) memcpy(&key->data[key->size], data, size);
+        key->size += size;
+}
+
+void hash_key_destroy(struct HashKey* key) {
+        free(key->data);
+}
+
+struct HashEntry {
+        // 0 means the slot is empty
+        uint64_t hash;
+        size_t key_size;
+        unsigned char* key;
+        uint32_t value;
+};
+
+// Open addressing with linear probing, from key bytes to a uint32_t (usually an index into an
+// array the caller keeps). Keys are copied in and compared on a hit, so two keys with the same
+// hash are still two entries.
+struct HashTable {
+        uint32_t cap;
+        uint32_t ct;
+        struct HashEntry* entries;
+};
+
+void hash_table_init(struct HashTable* table) {
+        table->cap = 64;
+        table->ct = 0;
+        table->entries = calloc(table->cap, sizeof(table->entries[0]));
+}
+
+void hash_table_destroy(struct HashTable* table) {
+        for (uint32_t i = 0; i < table->cap; i++) free(table->entries[i].key);
+        free(table->entries);
+}
+
+static uint64_t hash_table_hash(const struct HashKey* key) {
+        uint64_t hash = hash_bytes(HASH_SEED, key->size, key->data);
+        // 0 marks empty slots
+        return hash == 0 ? 1 : hash;
+}
+
+// The entry for `key`, or the empty slot it would go in
+static struct HashEntry* hash_table_slot(struct HashTable* table, uint64_t hash, size_t key_size,
+                                         const void* key)
+{
+        uint32_t idx = (uint32_t) (hash ^ (hash >> 32)) & (table->cap - 1);
+        for (;;) {
+                struct HashEntry* entry = &table->entries[idx];
+                if (entry->hash == 0) return entry;
+                if (entry->hash == hash && entry->key_size == key_size
+                    && (key_size == 0 || memcmp(entry->key, key, key_size) == 0)) {
+                        return entry;
+                }
+                idx = (idx + 1) & (table->cap - 1);
+        }
+}
+
+// NULL if `key` isn't in the table.
+struct HashEntry* hash_table_find(struct HashTable* table, const struct HashKey* key) {
+        struct HashEntry* entry = hash_table_slot(table, hash_table_hash(key), key->size, key->data);
+        return entry->hash != 0 ? entry : NULL;
+}
+
+// `key` must not be in the table yet.
+struct HashEntry* hash_table_insert(struct HashTable* table, const struct HashKey* key,
+                                    uint32_t value)
+{
+        // Keep it under 3/4 full
+        if ((table->ct + 1) * 4 > table->cap * 3) {
+                uint32_t old_cap = table->cap;
+                struct HashEntry* old = table->entries;
+                table->cap *= 2;
+                table->entries = calloc(table->cap, sizeof(table->entries[0]));
+                for (uint32_t i = 0; i < old_cap; i++) {
+                        if (old[i].hash == 0) continue;
+                        *hash_table_slot(table, old[i].hash, old[i].key_size, old[i].key) = old[i];
+                }
+                free(old);
+        }
+
+        uint64_t hash = hash_table_hash(key);
+        struct HashEntry* entry = hash_table_slot(table, hash, key->size, key->data);
+        assert(entry->hash == 0);
+        entry->hash = hash;
+        entry->key_size = key->size;
+        entry->key = malloc(key->size > 0 ? key->size : 1);
+        if (key->size > 0) memcpy(entry->key, key->data, key->size);
+        entry->value = value;
+        table->ct++;
+        return entry;
+}
+
+#endif // LL_HASH_H
@@ -9,11 +9,39 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_MAX_MIP_LEVELS 16
+
+// Accesses that have to be made available before anything else touches the image
+const VkAccessFlags IMAGE_WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT
+        | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+// How a mip level was last used: its layout and the accesses (and their stages) since the last
+// barrier. Several reads in the same layout pile up here without needing barriers in between.
+struct ImageState {
+        VkImageLayout layout;
+        VkAccessFlags access;
+        VkPipelineStageFlags stage;
+};
+
+// What the last barrier made a mip level's contents visible to. A read in the same layout only gets
+// away without a barrier if it's covered by this.
+struct ImageVisible {
+        VkAccessFlags access;
+        VkPipelineStageFlags stage;
+};
 
 struct Image {
         VkImage handle;
         VkImageView view;
-        VkDeviceMemory mem;
+        struct MemAlloc alloc;
+        VkImageAspectFlags aspect;
+        uint32_t mip_levels;
+        // Per mip level, kept up to date by the image barrier functions below
+        struct ImageState states[IMAGE_MAX_MIP_LEVELS];
+        struct ImageVisible visible[IMAGE_MAX_MIP_LEVELS];
 };
 
 // Optional settings
@@ -67,7 +95,7 @@ int image_check_format_supported(VkPhysicalDevice phys_dev, VkFormat format,
 	else return 0;
 }
 
-void image_create(VkPhysicalDevice phys_dev, VkDevice device, VkFormat format,
+void image_create(struct MemAllocator* allocator, VkDevice device, VkFormat format,
 		  VkImageType type,
 		  uint32_t width, uint32_t height, uint32_t depth,
                   VkImageTiling tiling, VkImageAspectFlags aspect,
@@ -75,8 +103,10 @@ void image_create(VkPhysicalDevice phys_dev, VkDevice device, VkFormat format,
                   VkFormatFeatureFlags features, uint32_t mip_levels, VkSampleCountFlagBits samples,
                   struct Image* image)
 {
+        assert(mip_levels <= IMAGE_MAX_MIP_LEVELS);
+
         #ifndef NDEBUG
-        if (!image_check_format_supported(phys_dev, format, tiling, features)) {
+        if (!image_check_format_supported(allocator->phys_dev, format, tiling, features)) {
                 fprintf(stderr, "Unsupported format with tiling %u: %u\n", tiling, format);
                 exit(1);
         }
@@ -104,66 +134,355 @@ void image_create(VkPhysicalDevice phys_dev, VkDevice device, VkFormat format,
 	// Memory
 	VkMemoryRequirements mem_reqs;
 	vkGetImageMemoryRequirements(device, image->handle, &mem_reqs);
-	const uint32_t mem_idx = mem_type_idx_find(phys_dev, mem_reqs.memoryTypeBits, props);
-	mem_alloc(device, mem_idx, mem_reqs.size, &image->mem);
+	mem_suballoc(allocator, &mem_reqs, props, tiling == VK_IMAGE_TILING_LINEAR, &image->alloc);
 
-	vkBindImageMemory(device, image->handle, image->mem, 0);
+	vkBindImageMemory(device, image->handle, image->alloc.mem, image->alloc.offset);
 
 	// View
 	image_view_create(device, image->handle, format, type, aspect, mip_levels, &image->view);
+
+	image->aspect = aspect;
+	image->mip_levels = mip_levels;
+	bzero(image->states, sizeof(image->states));
+	bzero(image->visible, sizeof(image->visible));
+	for (uint32_t i = 0; i < mip_levels; i++) image->states[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
 }
 
 void image_destroy(VkDevice device, struct Image* image) {
 	vkDestroyImage(device, image->handle, NULL);
-	vkFreeMemory(device, image->mem, NULL);
+	mem_free(&image->alloc);
 	vkDestroyImageView(device, image->view, NULL);
 }
 
-void image_trans(VkDevice device, VkQueue queue, VkCommandPool cpool, VkImage image, VkImageAspectFlags aspect,
-                 VkImageLayout old_lt, VkImageLayout new_lt, VkAccessFlags src_access, VkAccessFlags dst_access,
-                 VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage, uint32_t mip_levels)
+// Wraps an image created elsewhere, like a swapchain image, so its layout can be tracked. It starts
+// out undefined and `image_destroy` must not be called on it.
+void image_wrap(VkImage handle, VkImageView view, VkImageAspectFlags aspect, uint32_t mip_levels,
+		struct Image* image)
+{
+	assert(mip_levels <= IMAGE_MAX_MIP_LEVELS);
+	bzero(image, sizeof(*image));
+	image->handle = handle;
+	image->view = view;
+	image->aspect = aspect;
+	image->mip_levels = mip_levels;
+	for (uint32_t i = 0; i < mip_levels; i++) image->states[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+// For when something other than an ImageBarriers changed the layout, like an Upload, a render
+// pass's final layout or a separate submission that has already been waited on. Nothing is
+// considered pending and the contents count as visible everywhere, so the next barrier only changes
+// the layout.
+void image_state_set(struct Image* image, uint32_t base_mip, uint32_t mip_ct, VkImageLayout layout) {
+	assert(base_mip + mip_ct <= image->mip_levels);
+	for (uint32_t i = base_mip; i < base_mip + mip_ct; i++) {
+		image->states[i] = (struct ImageState){layout, 0, 0};
+		image->visible[i] = (struct ImageVisible){~0u, ~0u};
+	}
+}
+
+// Records that mip levels were used in their current layout without a barrier, e.g. sampled or
+// written by a draw. Needed so the next barrier waits for it.
+void image_state_use(struct Image* image, uint32_t base_mip, uint32_t mip_ct,
+		     VkAccessFlags access, VkPipelineStageFlags stage)
+{
+	assert(base_mip + mip_ct <= image->mip_levels);
+	for (uint32_t i = base_mip; i < base_mip + mip_ct; i++) {
+		image->states[i].access |= access;
+		image->states[i].stage |= stage;
+	}
+}
+
+struct ImageBarrier {
+	struct Image* image;
+	uint32_t mip;
+	struct ImageState old;
+	struct ImageVisible old_visible;
+	struct ImageState new;
+};
+
+struct ImageBarrierStats {
+	// Mip levels asked to change state
+	uint64_t requested_ct;
+	// ... that needed nothing (read after read in the same layout, already visible to the new
+	// reader) or cancelled out
+	uint64_t dropped_ct;
+	// ... that were folded into an earlier transition of the same level in the same batch
+	uint64_t collapsed_ct;
+	// VkImageMemoryBarriers recorded, after merging neighbouring levels
+	uint64_t barrier_ct;
+	// vkCmdPipelineBarrier calls
+	uint64_t flush_ct;
+};
+
+// Collects image transitions and records them with one vkCmdPipelineBarrier. The old layout, the
+// accesses to wait for and the source stages all come from the images' tracked state, so callers
+// only say what they want next. Flush before recording anything that uses the images.
+struct ImageBarriers {
+	uint32_t ct;
+	uint32_t cap;
+	struct ImageBarrier* pending;
+	uint32_t out_cap;
+	VkImageMemoryBarrier* out;
+	struct ImageBarrierStats stats;
+};
+
+void image_barriers_init(struct ImageBarriers* barriers) {
+	bzero(barriers, sizeof(*barriers));
+}
+
+void image_barriers_destroy(struct ImageBarriers* barriers) {
+	free(barriers->pending);
+	free(barriers->out);
+}
+
+// Same layout, nothing written on either side, and the last barrier already made the contents
+// visible to the new access in its stages, so no barrier is needed at all. A read in a stage the
+// last barrier didn't cover still needs one (without a source access, the writes were already made
+// available) or it could run before the write it's reading.
+static int image_state_compatible(const struct ImageState* old, const struct ImageVisible* visible,
+				  const struct ImageState* new)
 {
-	VkImageMemoryBarrier barrier = {0};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = old_lt;
-	barrier.newLayout = new_lt;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = aspect;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = mip_levels;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.srcAccessMask = src_access;
-	barrier.dstAccessMask = dst_access;
-
-	VkCommandBuffer cbuf;
-	cbuf_alloc(device, cpool, &cbuf);
-	cbuf_begin_onetime(cbuf);
-	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
-	cbuf_submit_wait(queue, cbuf);
-	vkFreeCommandBuffers(device, cpool, 1, &cbuf);
-}
-
-// Assumes image is already VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-void image_copy_from_buffer(VkDevice device, VkQueue queue, VkCommandPool cpool,
-			    VkImageAspectFlags aspect,
-                            VkBuffer src, VkImage dst, uint32_t width, uint32_t height, uint32_t depth)
+	return old->layout == new->layout
+		&& (old->access & IMAGE_WRITE_ACCESS) == 0 && (new->access & IMAGE_WRITE_ACCESS) == 0
+		&& (new->access & ~visible->access) == 0 && (new->stage & ~visible->stage) == 0;
+}
+
+static int image_state_read_only(const struct ImageState* state) {
+	return (state->access & IMAGE_WRITE_ACCESS) == 0;
+}
+
+// The level's state once `b` is recorded. A barrier between two reads in the same layout only adds
+// to what came before, so the reads before it are still waited for by the next write.
+static void image_barrier_apply(const struct ImageBarrier* b) {
+	struct ImageState* state = &b->image->states[b->mip];
+	struct ImageVisible* visible = &b->image->visible[b->mip];
+	*state = b->new;
+	*visible = (struct ImageVisible){b->new.access, b->new.stage};
+	if (b->old.layout == b->new.layout && image_state_read_only(&b->old)
+	    && image_state_read_only(&b->new)) {
+		state->access |= b->old.access;
+		state->stage |= b->old.stage;
+		visible->access |= b->old_visible.access;
+		visible->stage |= b->old_visible.stage;
+	}
+}
+
+// Asks for mip levels [base_mip, base_mip + mip_ct) to be in `layout`, ready for `access` in
+// `stage`. VK_IMAGE_LAYOUT_UNDEFINED as the tracked layout discards the contents, as usual.
+void image_barriers_add(struct ImageBarriers* barriers, struct Image* image, uint32_t base_mip,
+			uint32_t mip_ct, VkImageLayout layout, VkAccessFlags access,
+			VkPipelineStageFlags stage)
+{
+	assert(base_mip + mip_ct <= image->mip_levels);
+	struct ImageState want = {layout, access, stage};
+
+	for (uint32_t mip = base_mip; mip < base_mip + mip_ct; mip++) {
+		struct ImageState* state = &image->states[mip];
+		barriers->stats.requested_ct++;
+
+		struct ImageBarrier* pending = NULL;
+		for (uint32_t i = 0; i < barriers->ct && pending == NULL; i++) {
+			struct ImageBarrier* b = &barriers->pending[i];
+			if (b->image == image && b->mip == mip) pending = b;
+		}
+
+		if (image_state_compatible(state, &image->visible[mip], &want)) {
+			// The next write still has to wait for it
+			state->access |= access;
+			state->stage |= stage;
+			barriers->stats.dropped_ct++;
+			continue;
+		}
+
+		// Nothing used the level since, so go straight from the old state to the new one. Two
+		// reads in the same layout both have to be covered.
+		if (pending != NULL) {
+			if (pending->new.layout == want.layout && image_state_read_only(&pending->new)
+			    && image_state_read_only(&want)) {
+				pending->new.access |= want.access;
+				pending->new.stage |= want.stage;
+			} else {
+				pending->new = want;
+			}
+			image_barrier_apply(pending);
+			barriers->stats.collapsed_ct++;
+			continue;
+		}
+
+		if (barriers->ct == barriers->cap) {
+			barriers->cap = barriers->cap == 0 ? 16 : barriers->cap * 2;
+			barriers->pending = realloc(barriers->pending,
+						    barriers->cap * sizeof(barriers->pending[0]));
+		}
+		barriers->pending[barriers->ct] =
+			(struct ImageBarrier){image, mip, *state, image->visible[mip], want};
+		image_barrier_apply(&barriers->pending[barriers->ct++]);
+	}
+}
+
+// Records everything collected so far. Does nothing if there's nothing to wait for.
+void image_barriers_flush(struct ImageBarriers* barriers, VkCommandBuffer cbuf) {
+	if (barriers->out_cap < barriers->ct) {
+		barriers->out_cap = barriers->cap;
+		barriers->out = realloc(barriers->out, barriers->out_cap * sizeof(barriers->out[0]));
+	}
+
+	uint32_t out_ct = 0;
+	VkPipelineStageFlags src_stage = 0, dst_stage = 0;
+	for (uint32_t i = 0; i < barriers->ct; i++) {
+		const struct ImageBarrier* b = &barriers->pending[i];
+		// A -> B -> A in one batch
+		if (image_state_compatible(&b->old, &b->old_visible, &b->new)) {
+			barriers->stats.dropped_ct++;
+			continue;
+		}
+
+		// Reads only need the execution dependency, not a memory one
+		VkAccessFlags src_access = b->old.access & IMAGE_WRITE_ACCESS;
+		src_stage |= b->old.stage;
+		dst_stage |= b->new.stage;
+
+		VkImageMemoryBarrier* prev = out_ct > 0 ? &barriers->out[out_ct - 1] : NULL;
+		if (prev != NULL && prev->image == b->image->handle
+		    && prev->subresourceRange.baseMipLevel + prev->subresourceRange.levelCount == b->mip
+		    && prev->oldLayout == b->old.layout && prev->newLayout == b->new.layout
+		    && prev->srcAccessMask == src_access && prev->dstAccessMask == b->new.access) {
+			prev->subresourceRange.levelCount++;
+			continue;
+		}
+
+		VkImageMemoryBarrier* barrier = &barriers->out[out_ct++];
+		bzero(barrier, sizeof(*barrier));
+		barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier->oldLayout = b->old.layout;
+		barrier->newLayout = b->new.layout;
+		barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier->image = b->image->handle;
+		barrier->subresourceRange.aspectMask = b->image->aspect;
+		barrier->subresourceRange.baseMipLevel = b->mip;
+		barrier->subresourceRange.levelCount = 1;
+		barrier->subresourceRange.baseArrayLayer = 0;
+		barrier->subresourceRange.layerCount = 1;
+		barrier->srcAccessMask = src_access;
+		barrier->dstAccessMask = b->new.access;
+	}
+	barriers->ct = 0;
+	if (out_ct == 0) return;
+
+	if (src_stage == 0) src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	if (dst_stage == 0) dst_stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	vkCmdPipelineBarrier(cbuf, src_stage, dst_stage, 0, 0, NULL, 0, NULL, out_ct, barriers->out);
+
+	barriers->stats.barrier_ct += out_ct;
+	barriers->stats.flush_ct++;
+}
+
+void image_barriers_stats_print(const struct ImageBarriers* barriers) {
+	const struct ImageBarrierStats* s = &barriers->stats;
+	printf("Image barriers: %lu level transitions asked for, %lu dropped, %lu collapsed, "
+	       "%lu barriers in %lu calls\n", (unsigned long) s->requested_ct,
+	       (unsigned long) s->dropped_ct, (unsigned long) s->collapsed_ct,
+	       (unsigned long) s->barrier_ct, (unsigned long) s->flush_ct);
+}
+
+// Moves every level of `image` to `layout` in a one-shot submission. Doesn't submit anything if
+// the image is already there.
+void image_trans(struct CbufPool* cbufs, struct Image* image, VkImageLayout layout,
+		 VkAccessFlags access, VkPipelineStageFlags stage)
+{
+	struct ImageBarriers barriers;
+	image_barriers_init(&barriers);
+	image_barriers_add(&barriers, image, 0, image->mip_levels, layout, access, stage);
+
+	if (barriers.ct > 0) {
+		VkCommandBuffer cbuf = cbuf_pool_begin(cbufs);
+		image_barriers_flush(&barriers, cbuf);
+		cbuf_pool_submit_wait(cbufs, cbuf);
+		// Waited on, so nothing is pending anymore
+		image_state_set(image, 0, image->mip_levels, layout);
+	}
+
+	image_barriers_destroy(&barriers);
+}
+
+// Copies into mip level 0, moving it to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL first if it isn't
+// already. It stays in that layout.
+void image_copy_from_buffer(struct CbufPool* cbufs, VkBuffer src, struct Image* dst,
+			    uint32_t width, uint32_t height, uint32_t depth)
 {
 	VkBufferImageCopy region = {0};
-	region.imageSubresource.aspectMask = aspect;
+	region.imageSubresource.aspectMask = dst->aspect;
 	region.imageSubresource.mipLevel = 0;
 	region.imageSubresource.baseArrayLayer = 0;
 	region.imageSubresource.layerCount = 1;
 	region.imageExtent = (VkExtent3D){width, height, depth};
 
-	VkCommandBuffer cbuf;
-	cbuf_alloc(device, cpool, &cbuf);
-	cbuf_begin_onetime(cbuf);
-	vkCmdCopyBufferToImage(cbuf, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-	cbuf_submit_wait(queue, cbuf);
-	vkFreeCommandBuffers(device, cpool, 1, &cbuf);
+	struct ImageBarriers barriers;
+	image_barriers_init(&barriers);
+	image_barriers_add(&barriers, dst, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			   VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkCommandBuffer cbuf = cbuf_pool_begin(cbufs);
+	image_barriers_flush(&barriers, cbuf);
+	vkCmdCopyBufferToImage(cbuf, src, dst->handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	cbuf_pool_submit_wait(cbufs, cbuf);
+	image_state_set(dst, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	image_barriers_destroy(&barriers);
+}
+
+// Number of levels in a full mip chain, down to 1x1
+uint32_t image_mip_levels(uint32_t width, uint32_t height) {
+	uint32_t largest = width > height ? width : height;
+	uint32_t levels = 1;
+	while (largest > 1) {
+		largest /= 2;
+		levels++;
+	}
+	return levels;
+}
+
+// Fills mip levels 1 and up of `image` by blitting each level into the next one. Every level must
+// be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL and level 0 must hold the data. Afterwards every level
+// but the last is in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL and the last is still in
+// VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, so one or two barriers finish the job.
+//
+// Needs a graphics queue, and a format that supports linear blits.
+void image_gen_mips(VkCommandBuffer cbuf, VkImage image, uint32_t width, uint32_t height,
+		    uint32_t mip_levels)
+{
+	int32_t src_width = width;
+	int32_t src_height = height;
+	for (uint32_t i = 1; i < mip_levels; i++) {
+		int32_t dst_width = src_width > 1 ? src_width / 2 : 1;
+		int32_t dst_height = src_height > 1 ? src_height / 2 : 1;
+
+		// Wait for the previous level to be written (by the copy or the last blit)
+		cbuf_barrier_image(cbuf, image, VK_IMAGE_ASPECT_COLOR_BIT, 1, i - 1,
+				   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				   VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+				   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		VkImageBlit blit = {0};
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.srcOffsets[1] = (VkOffset3D){src_width, src_height, 1};
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		blit.dstOffsets[1] = (VkOffset3D){dst_width, dst_height, 1};
+
+		vkCmdBlitImage(cbuf, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			       image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		src_width = dst_width;
+		src_height = dst_height;
+	}
 }
 
 void framebuffer_create(VkDevice device, VkRenderPass rpass, uint32_t width, uint32_t height,
@@ -183,27 +502,47 @@ void framebuffer_create(VkDevice device, VkRenderPass rpass, uint32_t width, uin
         assert(res == VK_SUCCESS);
 }
 
-void image_create_depth(VkPhysicalDevice phys_dev, VkDevice device,
+void image_create_depth(struct MemAllocator* allocator, VkDevice device,
                         VkFormat format, uint32_t width, uint32_t height, VkSampleCountFlagBits samples,
                         struct Image* image)
 {
-	image_create(phys_dev, device, format, VK_IMAGE_TYPE_2D, width, height, 1,
+	image_create(allocator, device, format, VK_IMAGE_TYPE_2D, width, height, 1,
 	             VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT,
 		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 	             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
 	             VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT, 1, samples, image);
 }
 
-void image_create_color(VkPhysicalDevice phys_dev, VkDevice device,
+void image_create_color(struct MemAllocator* allocator, VkDevice device,
                         VkFormat format, uint32_t width, uint32_t height, VkSampleCountFlagBits samples,
                         struct Image* image)
 {
-	image_create(phys_dev, device, format, VK_IMAGE_TYPE_2D, width, height, 1,
+	image_create(allocator, device, format, VK_IMAGE_TYPE_2D, width, height, 1,
 	             VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT,
 		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 	             VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
 	             0, 1, samples, image);
 }
 
+// A sampled 2D texture. If `mip_levels` > 1 it can also be the source and destination of blits, for
+// `image_gen_mips`.
+void image_create_texture(struct MemAllocator* allocator, VkDevice device,
+                          VkFormat format, uint32_t width, uint32_t height, uint32_t mip_levels,
+                          struct Image* image)
+{
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	VkFormatFeatureFlags features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+	if (mip_levels > 1) {
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		features |= VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+			| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	}
+
+	image_create(allocator, device, format, VK_IMAGE_TYPE_2D, width, height, 1,
+	             VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT,
+		     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, usage, features,
+	             mip_levels, VK_SAMPLE_COUNT_1_BIT, image);
+}
+
 #endif // LL_IMAGE_H
 
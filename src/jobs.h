@@ -0,0 +1,200 @@
+#ifndef LL_JOBS_H
+#define LL_JOBS_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// `worker` is the index of the thread running the job, from 0 to thread_ct - 1. Handy for indexing
+// per-thread resources.
+typedef void (*JobFn)(void* data, uint32_t worker);
+
+struct Job {
+        JobFn fn;
+        void* data;
+};
+
+// One per worker. The owner takes jobs from the back, thieves from the front.
+struct JobsQueue {
+        pthread_mutex_t lock;
+        struct Job* jobs;
+        uint32_t head;
+        uint32_t ct;
+        uint32_t cap;
+};
+
+// A fixed set of worker threads with one queue each. Pushed jobs are spread over the queues, and a
+// worker that runs out steals from the others, so uneven jobs still keep every thread busy.
+struct Jobs {
+        uint32_t thread_ct;
+        pthread_t* threads;
+        struct JobsQueue* queues;
+        // Queue the next push goes to
+        uint32_t next_queue;
+
+        pthread_mutex_t lock;
+        // Signaled when a job is pushed (or on shutdown)
+        pthread_cond_t wake;
+        // Signaled when `pending` drops to 0
+        pthread_cond_t idle;
+
+        // Everything below is protected by `lock`. `queued` can briefly go negative when a job is
+        // taken before its push is counted.
+        int32_t queued;
+        // Queued plus running
+        uint32_t pending;
+        int quit;
+};
+
+struct JobsWorker {
+        struct Jobs* jobs;
+        uint32_t idx;
+};
+
+static void jobs_queue_push(struct JobsQueue* queue, struct Job job) {
+        pthread_mutex_lock(&queue->lock);
+
+        if (queue->ct == queue->cap) {
+                // Unroll the ring into a bigger array
+                uint32_t cap = queue->cap == 0 ? 64 : queue->cap * 2;
+                struct Job* jobs = malloc(cap * sizeof(jobs[0]));
+                for (uint32_t i = 0; i < queue->ct; i++) {
+                        jobs[i] = queue->jobs[(queue->head + i) % queue->cap];
+                }
+                free(queue->jobs);
+                queue->jobs = jobs;
+                queue->head = 0;
+                queue->cap = cap;
+        }
+
+        queue->jobs[(queue->head + queue->ct) % queue->cap] = job;
+        queue->ct++;
+
+        pthread_mutex_unlock(&queue->lock);
+}
+
+static int jobs_queue_pop(struct JobsQueue* queue, int steal, struct Job* job) {
+        pthread_mutex_lock(&queue->lock);
+
+        int found = queue->ct > 0;
+        if (found && steal) {
+                *job = queue->jobs[queue->head];
+                queue->head = (queue->head + 1) % queue->cap;
+                queue->ct--;
+        } else if (found) {
+                queue->ct--;
+                *job = queue->jobs[(queue->head + queue->ct) % queue->cap];
+        }
+
+        pthread_mutex_unlock(&queue->lock);
+        return found;
+}
+
+static int jobs_take(struct Jobs* jobs, uint32_t worker, struct Job* job) {
+        if (jobs_queue_pop(&jobs->queues[worker], 0, job)) return 1;
+        for (uint32_t i = 1; i < jobs->thread_ct; i++) {
+                if (jobs_queue_pop(&jobs->queues[(worker + i) % jobs->thread_ct], 1, job)) return 1;
+        }
+        return 0;
+}
+
+static void* jobs_worker_main(void* arg) {
+        struct JobsWorker worker = *(struct JobsWorker*) arg;
+        free(arg);
+        struct Jobs* jobs = worker.jobs;
+
+        for (;;) {
+                struct Job job;
+                if (jobs_take(jobs, worker.idx, &job)) {
+                        pthread_mutex_lock(&jobs->lock);
+                        jobs->queued--;
+                        pthread_mutex_unlock(&jobs->lock);
+
+                        job.fn(job.data, worker.idx);
+
+                        pthread_mutex_lock(&jobs->lock);
+                        jobs->pending--;
+                        if (jobs->pending == 0) pthread_cond_broadcast(&jobs->idle);
+                        pthread_mutex_unlock(&jobs->lock);
+                        continue;
+                }
+
+                pthread_mutex_lock(&jobs->lock);
+                while (jobs->queued <= 0 && !jobs->quit) pthread_cond_wait(&jobs->wake, &jobs->lock);
+                int done = jobs->queued <= 0 && jobs->quit;
+                pthread_mutex_unlock(&jobs->lock);
+                if (done) break;
+        }
+
+        return NULL;
+}
+
+void jobs_create(uint32_t thread_ct, struct Jobs* jobs) {
+        assert(thread_ct > 0);
+        bzero(jobs, sizeof(*jobs));
+        jobs->thread_ct = thread_ct;
+
+        pthread_mutex_init(&jobs->lock, NULL);
+        pthread_cond_init(&jobs->wake, NULL);
+        pthread_cond_init(&jobs->idle, NULL);
+
+        jobs->queues = calloc(thread_ct, sizeof(jobs->queues[0]));
+        for (uint32_t i = 0; i < thread_ct; i++) pthread_mutex_init(&jobs->queues[i].lock, NULL);
+
+        jobs->threads = malloc(thread_ct * sizeof(jobs->threads[0]));
+        for (uint32_t i = 0; i < thread_ct; i++) {
+                struct JobsWorker* worker = malloc(sizeof(*worker));
+                worker->jobs = jobs;
+                worker->idx = i;
+                int res = pthread_create(&jobs->threads[i], NULL, jobs_worker_main, worker);
+                assert(res == 0);
+        }
+}
+
+void jobs_push(struct Jobs* jobs, JobFn fn, void* data) {
+        pthread_mutex_lock(&jobs->lock);
+        uint32_t queue = jobs->next_queue;
+        jobs->next_queue = (jobs->next_queue + 1) % jobs->thread_ct;
+        jobs->pending++;
+        pthread_mutex_unlock(&jobs->lock);
+
+        jobs_queue_push(&jobs->queues[queue], (struct Job){fn, data});
+
+        // Only counted once it can actually be taken, so sleeping workers never miss it
+        pthread_mutex_lock(&jobs->lock);
+        jobs->queued++;
+        pthread_cond_signal(&jobs->wake);
+        pthread_mutex_unlock(&jobs->lock);
+}
+
+// Blocks until every job pushed so far has finished.
+void jobs_wait(struct Jobs* jobs) {
+        pthread_mutex_lock(&jobs->lock);
+        while (jobs->pending > 0) pthread_cond_wait(&jobs->idle, &jobs->lock);
+        pthread_mutex_unlock(&jobs->lock);
+}
+
+// Finishes whatever is still queued, then joins the threads.
+void jobs_destroy(struct Jobs* jobs) {
+        pthread_mutex_lock(&jobs->lock);
+        jobs->quit = 1;
+        pthread_cond_broadcast(&jobs->wake);
+        pthread_mutex_unlock(&jobs->lock);
+
+        for (uint32_t i = 0; i < jobs->thread_ct; i++) pthread_join(jobs->threads[i], NULL);
+
+        for (uint32_t i = 0; i < jobs->thread_ct; i++) {
+                pthread_mutex_destroy(&jobs->queues[i].lock);
+                free(jobs->queues[i].jobs);
+        }
+        free(jobs->queues);
+
+        pthread_mutex_destroy(&jobs->lock);
+        pthread_cond_destroy(&jobs->wake);
+        pthread_cond_destroy(&jobs->idle);
+        free(jobs->threads);
+}
+
+#endif // LL_JOBS_H
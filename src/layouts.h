@@ -0,0 +1,172 @@
+#ifndef LL_LAYOUTS_H
+#define LL_LAYOUTS_H
+
+#include <vulkan/vulkan.h>
+
+#include "hash.h"
+#include "pipeline.h"
+#include "set.h"
+#include "shader.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// maxBoundDescriptorSets is only guaranteed to be 4, but 8 is common
+#define LAYOUT_CACHE_MAX_SETS 8
+
+struct LayoutCacheStats {
+        uint64_t set_request_ct;
+        uint64_t set_hit_ct;
+        uint64_t pipeline_request_ct;
+        uint64_t pipeline_hit_ct;
+};
+
+// Hands out one VkDescriptorSetLayout per distinct SetInfo (types, stages, counts and flags) and one
+// VkPipelineLayout per distinct list of set layouts plus push constant ranges. Since equal set
+// layouts are the same handle, pipelines built from the same SetInfos get the same pipeline layout,
+// so switching between them keeps the bound sets (and push constants) valid.
+//
+// The cache owns every layout it makes; don't destroy them yourself.
+struct LayoutCache {
+        VkDevice device;
+        // Values are indices into `set_layouts` and `pipeline_layouts`
+        struct HashTable sets;
+        struct HashTable pipelines;
+        struct HashKey key;
+        uint32_t set_layout_cap;
+        VkDescriptorSetLayout* set_layouts;
+        uint32_t pipeline_layout_cap;
+        VkPipelineLayout* pipeline_layouts;
+        struct LayoutCacheStats stats;
+};
+
+void layout_cache_create(VkDevice device, struct LayoutCache* cache) {
+        bzero(cache, sizeof(*cache));
+        cache->device = device;
+        hash_table_init(&cache->sets);
+        hash_table_init(&cache->pipelines);
+}
+
+void layout_cache_destroy(struct LayoutCache* cache) {
+        for (uint32_t i = 0; i < cache->pipelines.ct; i++) {
+                vkDestroyPipelineLayout(cache->device, cache->pipeline_layouts[i], NULL);
+        }
+        for (uint32_t i = 0; i < cache->sets.ct; i++) {
+                vkDestroyDescriptorSetLayout(cache->device, cache->set_layouts[i], NULL);
+        }
+        hash_table_destroy(&cache->pipelines);
+        hash_table_destroy(&cache->sets);
+        hash_key_destroy(&cache->key);
+        free(cache->pipeline_layouts);
+        free(cache->set_layouts);
+}
+
+// `flags` as in set_layout_create_flags.
+VkDescriptorSetLayout layout_cache_set(struct LayoutCache* cache, const struct SetInfo* set_info,
+                                       VkDescriptorSetLayoutCreateFlags flags)
+{
+        struct HashKey* key = &cache->key;
+        hash_key_reset(key);
+        hash_key_add(key, sizeof(flags), &flags);
+        hash_key_add(key, sizeof(set_info->desc_ct), &set_info->desc_ct);
+        for (int i = 0; i < set_info->desc_ct; i++) {
+                const struct DescriptorInfo* desc = &set_info->descs[i];
+                uint32_t count = desc_count(desc);
+                hash_key_add(key, sizeof(desc->type), &desc->type);
+                hash_key_add(key, sizeof(desc->stage), &desc->stage);
+                hash_key_add(key, sizeof(count), &count);
+        }
+
+        cache->stats.set_request_ct++;
+        struct HashEntry* entry = hash_table_find(&cache->sets, key);
+        if (entry != NULL) {
+                cache->stats.set_hit_ct++;
+                return cache->set_layouts[entry->value];
+        }
+
+        uint32_t idx = cache->sets.ct;
+        if (idx == cache->set_layout_cap) {
+                cache->set_layout_cap = cache->set_layout_cap == 0 ? 16 : cache->set_layout_cap * 2;
+                cache->set_layouts = realloc(cache->set_layouts,
+                                             cache->set_layout_cap * sizeof(cache->set_layouts[0]));
+        }
+        set_layout_create_flags(cache->device, set_info, flags, &cache->set_layouts[idx]);
+        hash_table_insert(&cache->sets, key, idx);
+        return cache->set_layouts[idx];
+}
+
+VkPipelineLayout layout_cache_pipeline(struct LayoutCache* cache, uint32_t set_layout_ct,
+                                       const VkDescriptorSetLayout* set_layouts,
+                                       uint32_t push_range_ct, const VkPushConstantRange* push_ranges)
+{
+        struct HashKey* key = &cache->key;
+        hash_key_reset(key);
+        hash_key_add(key, sizeof(set_layout_ct), &set_layout_ct);
+        hash_key_add(key, set_layout_ct * sizeof(set_layouts[0]), set_layouts);
+        hash_key_add(key, sizeof(push_range_ct), &push_range_ct);
+        for (uint32_t i = 0; i < push_range_ct; i++) {
+                hash_key_add(key, sizeof(push_ranges[i].stageFlags), &push_ranges[i].stageFlags);
+                hash_key_add(key, sizeof(push_ranges[i].offset), &push_ranges[i].offset);
+                hash_key_add(key, sizeof(push_ranges[i].size), &push_ranges[i].size);
+        }
+
+        cache->stats.pipeline_request_ct++;
+        struct HashEntry* entry = hash_table_find(&cache->pipelines, key);
+        if (entry != NULL) {
+                cache->stats.pipeline_hit_ct++;
+                return cache->pipeline_layouts[entry->value];
+        }
+
+        uint32_t idx = cache->pipelines.ct;
+        if (idx == cache->pipeline_layout_cap) {
+                cache->pipeline_layout_cap =
+                        cache->pipeline_layout_cap == 0 ? 16 : cache->pipeline_layout_cap * 2;
+                cache->pipeline_layouts = realloc(cache->pipeline_layouts, cache->pipeline_layout_cap
+                                                  * sizeof(cache->pipeline_layouts[0]));
+        }
+        pipeline_layout_create(cache->device, set_layout_ct, set_layouts, push_range_ct, push_ranges,
+                               &cache->pipeline_layouts[idx]);
+        hash_table_insert(&cache->pipelines, key, idx);
+        return cache->pipeline_layouts[idx];
+}
+
+// The pipeline layout the shaders ask for, from their reflection. Fills in `set_layouts` too if it
+// isn't NULL (LAYOUT_CACHE_MAX_SETS of them), and returns how many sets there are in `set_ct`.
+VkPipelineLayout layout_cache_shaders(struct LayoutCache* cache, const struct Shader* const* shaders,
+                                      uint32_t shader_ct, VkDescriptorSetLayout* set_layouts,
+                                      uint32_t* set_ct)
+{
+        uint32_t ct = shader_set_ct(shaders, shader_ct);
+        if (ct > LAYOUT_CACHE_MAX_SETS) {
+                fprintf(stderr, "Shaders use %u sets, at most %u are supported\n", ct,
+                        LAYOUT_CACHE_MAX_SETS);
+                exit(1);
+        }
+
+        VkDescriptorSetLayout layouts[LAYOUT_CACHE_MAX_SETS];
+        for (uint32_t i = 0; i < ct; i++) {
+                struct SetInfo set_info;
+                shader_set_info(shaders, shader_ct, i, &set_info);
+                layouts[i] = layout_cache_set(cache, &set_info, 0);
+                free(set_info.descs);
+        }
+
+        VkPushConstantRange range;
+        int has_push = shader_push_range(shaders, shader_ct, &range);
+
+        if (set_layouts != NULL) memcpy(set_layouts, layouts, ct * sizeof(layouts[0]));
+        if (set_ct != NULL) *set_ct = ct;
+        return layout_cache_pipeline(cache, ct, layouts, has_push ? 1 : 0, &range);
+}
+
+void layout_cache_stats_print(const struct LayoutCache* cache) {
+        const struct LayoutCacheStats* s = &cache->stats;
+        printf("Layout cache: %u set layouts for %lu requests, %u pipeline layouts for %lu requests\n",
+               cache->sets.ct, (unsigned long) s->set_request_ct, cache->pipelines.ct,
+               (unsigned long) s->pipeline_request_ct);
+}
+
+#endif // LL_LAYOUTS_H
@@ -0,0 +1,366 @@
+#ifndef LL_LOADER_H
+#define LL_LOADER_H
+
+#include <vulkan/vulkan.h>
+
+#include "buffer.h"
+#include "image.h"
+#include "jobs.h"
+#include "mem.h"
+#include "upload.h"
+
+// Define STB_IMAGE_IMPLEMENTATION before including this in exactly one file
+#include "../external/stb_image/stb_image.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct LoaderRequest {
+        struct Loader* loader;
+        char* path;
+        struct Image* image;
+
+        // Filled in by the worker
+        int failed;
+        uint32_t width;
+        uint32_t height;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+
+        uint64_t ticket;
+        struct LoaderRequest* next;
+};
+
+struct LoaderStats {
+        uint32_t texture_ct;
+        // Couldn't be read, decoded or staged
+        uint32_t failed_ct;
+        uint64_t file_bytes;
+        uint64_t decoded_bytes;
+        // Summed over all workers
+        double decode_s;
+        // Time during which at least one texture was outstanding
+        double wall_s;
+};
+
+// Decodes images with stb_image on a pool of worker threads and uploads them as textures through
+// an Upload. Each worker decodes straight into its own slice of one big persistently mapped staging
+// buffer, and the main thread records the copy (and mip chain) from there, so decoding, copying and
+// GPU transfers all overlap.
+//
+// Everything except the decoding happens on the thread calling `loader_poll`/`loader_wait`, so the
+// allocator and the Upload are never touched from the workers.
+struct Loader {
+        struct Upload* up;
+        struct Jobs jobs;
+        VkFormat format;
+        int want_mips;
+
+        struct Buffer staging;
+
+        pthread_mutex_t lock;
+        // Signaled when staging memory is given back
+        pthread_cond_t space;
+        // Signaled when a request is added to `done`
+        pthread_cond_t ready;
+        // Everything below is protected by `lock`
+        struct MemRanges ranges;
+        struct LoaderRequest* done;
+        struct LoaderStats stats;
+
+        // Uploads waiting for their ticket so their staging memory can be reused. Main thread only.
+        uint32_t in_flight_ct;
+        uint32_t in_flight_cap;
+        struct LoaderRequest** in_flight;
+
+        // Added but not retired yet
+        uint32_t outstanding;
+        struct timespec busy_since;
+};
+
+static double loader_seconds_since(const struct timespec* start) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// `up` must be on a graphics queue if `want_mips` is set. `staging_size` bounds how much decoded
+// data can be waiting for the GPU at once; workers block when it runs out, and a single image bigger
+// than it fails to load.
+void loader_create(struct Upload* up, uint32_t thread_ct, VkDeviceSize staging_size,
+                   VkFormat format, int want_mips, struct Loader* loader)
+{
+        bzero(loader, sizeof(*loader));
+        loader->up = up;
+        loader->format = format;
+        loader->want_mips = want_mips;
+
+        buffer_create(up->allocator, up->device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      staging_size, &loader->staging);
+        mem_ranges_init(staging_size, &loader->ranges);
+
+        pthread_mutex_init(&loader->lock, NULL);
+        pthread_cond_init(&loader->space, NULL);
+        pthread_cond_init(&loader->ready, NULL);
+
+        jobs_create(thread_ct, &loader->jobs);
+}
+
+static void loader_finish(struct Loader* loader, struct LoaderRequest* req, double decode_s,
+                          uint64_t file_bytes)
+{
+        pthread_mutex_lock(&loader->lock);
+        if (req->failed) {
+                loader->stats.failed_ct++;
+        } else {
+                loader->stats.texture_ct++;
+                loader->stats.file_bytes += file_bytes;
+                loader->stats.decoded_bytes += req->size;
+                loader->stats.decode_s += decode_s;
+        }
+        req->next = loader->done;
+        loader->done = req;
+        pthread_cond_signal(&loader->ready);
+        pthread_mutex_unlock(&loader->lock);
+}
+
+static void loader_job(void* data, uint32_t worker) {
+        (void)(worker);
+        struct LoaderRequest* req = data;
+        struct Loader* loader = req->loader;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        FILE* fp = fopen(req->path, "rb");
+        if (fp == NULL) {
+                fprintf(stderr, "Couldn't open %s\n", req->path);
+                req->failed = 1;
+                loader_finish(loader, req, 0, 0);
+                return;
+        }
+
+        fseek(fp, 0L, SEEK_END);
+        const long byte_ct = ftell(fp);
+        rewind(fp);
+
+        unsigned char* buf = malloc(byte_ct);
+        const long read_bytes = fread(buf, 1, byte_ct, fp);
+        fclose(fp);
+
+        int width, height, channels;
+        if (read_bytes != byte_ct || !stbi_info_from_memory(buf, byte_ct, &width, &height, &channels)) {
+                fprintf(stderr, "Couldn't read %s\n", req->path);
+                free(buf);
+                req->failed = 1;
+                loader_finish(loader, req, 0, 0);
+                return;
+        }
+
+        // Always RGBA, 3-channel formats are barely supported for sampling
+        req->width = width;
+        req->height = height;
+        req->size = (VkDeviceSize) width * height * 4;
+
+        // Reserve staging memory before decoding, so we block before using a bunch of RAM
+        pthread_mutex_lock(&loader->lock);
+        if (req->size > loader->staging.size) {
+                pthread_mutex_unlock(&loader->lock);
+                fprintf(stderr, "%s is too big for the loader's staging buffer\n", req->path);
+                free(buf);
+                req->failed = 1;
+                loader_finish(loader, req, 0, 0);
+                return;
+        }
+        while (!mem_ranges_take(&loader->ranges, req->size, UPLOAD_IMAGE_ALIGNMENT, &req->offset)) {
+                pthread_cond_wait(&loader->space, &loader->lock);
+        }
+        pthread_mutex_unlock(&loader->lock);
+
+        // stb_image always hands back its own allocation, so this is the one copy we can't avoid.
+        // It happens here on the worker, straight into mapped memory.
+        unsigned char* pixels = stbi_load_from_memory(buf, byte_ct, &width, &height, &channels, 4);
+        free(buf);
+        if (pixels == NULL) {
+                fprintf(stderr, "Couldn't decode %s: %s\n", req->path, stbi_failure_reason());
+                pthread_mutex_lock(&loader->lock);
+                mem_ranges_give_back(&loader->ranges, req->offset, req->size);
+                pthread_cond_broadcast(&loader->space);
+                pthread_mutex_unlock(&loader->lock);
+                req->failed = 1;
+                loader_finish(loader, req, 0, 0);
+                return;
+        }
+
+        memcpy((char*) loader->staging.alloc.mapped + req->offset, pixels, req->size);
+        stbi_image_free(pixels);
+
+        loader_finish(loader, req, loader_seconds_since(&start), byte_ct);
+}
+
+// Queues `path` for loading. `image` is filled in (by `loader_poll` or `loader_wait`) once the
+// image has been decoded, and can be sampled once `loader_wait` returns or `loader_done` says so.
+// If it can't be loaded, `image` is zeroed instead, so its handle is VK_NULL_HANDLE.
+void loader_add(struct Loader* loader, const char* path, struct Image* image) {
+        struct LoaderRequest* req = malloc(sizeof(*req));
+        bzero(req, sizeof(*req));
+        req->loader = loader;
+        req->path = strdup(path);
+        req->image = image;
+
+        if (loader->outstanding == 0) clock_gettime(CLOCK_MONOTONIC, &loader->busy_since);
+        loader->outstanding++;
+
+        jobs_push(&loader->jobs, loader_job, req);
+}
+
+static void loader_retire(struct Loader* loader, struct LoaderRequest* req) {
+        if (!req->failed) {
+                pthread_mutex_lock(&loader->lock);
+                mem_ranges_give_back(&loader->ranges, req->offset, req->size);
+                pthread_cond_broadcast(&loader->space);
+                pthread_mutex_unlock(&loader->lock);
+        }
+
+        free(req->path);
+        free(req);
+
+        loader->outstanding--;
+        if (loader->outstanding == 0) {
+                loader->stats.wall_s += loader_seconds_since(&loader->busy_since);
+        }
+}
+
+// With `block` unset, images that can't be recorded without waiting for an upload batch are left
+// for the next call.
+static void loader_process(struct Loader* loader, int block) {
+        struct Upload* up = loader->up;
+
+        pthread_mutex_lock(&loader->lock);
+        struct LoaderRequest* req = loader->done;
+        loader->done = NULL;
+        pthread_mutex_unlock(&loader->lock);
+
+        int recorded = 0;
+        while (req != NULL) {
+                struct LoaderRequest* next = req->next;
+
+                if (!req->failed && !block && !upload_ready(up)) {
+                        // Put the rest back
+                        struct LoaderRequest* last = req;
+                        while (last->next != NULL) last = last->next;
+                        pthread_mutex_lock(&loader->lock);
+                        last->next = loader->done;
+                        loader->done = req;
+                        pthread_mutex_unlock(&loader->lock);
+                        break;
+                }
+
+                if (req->failed) {
+                        bzero(req->image, sizeof(*req->image));
+                        loader_retire(loader, req);
+                } else {
+                        uint32_t mip_levels =
+                                loader->want_mips ? image_mip_levels(req->width, req->height) : 1;
+                        image_create_texture(up->allocator, up->device, loader->format,
+                                             req->width, req->height, mip_levels, req->image);
+                        req->ticket = upload_texture_from(up, loader->staging.handle, req->offset,
+                                                          req->image->handle,
+                                                          req->width, req->height, mip_levels,
+                                                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                        image_state_set(req->image, 0, mip_levels,
+                                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                        recorded = 1;
+
+                        if (loader->in_flight_ct == loader->in_flight_cap) {
+                                loader->in_flight_cap =
+                                        loader->in_flight_cap == 0 ? 16 : loader->in_flight_cap * 2;
+                                loader->in_flight =
+                                        realloc(loader->in_flight,
+                                                loader->in_flight_cap * sizeof(loader->in_flight[0]));
+                        }
+                        loader->in_flight[loader->in_flight_ct++] = req;
+                }
+
+                req = next;
+        }
+
+        if (recorded) upload_flush(up);
+
+        // Tickets finish in order, so stop at the first one that isn't done
+        uint32_t retired = 0;
+        while (retired < loader->in_flight_ct
+               && upload_done(up, loader->in_flight[retired]->ticket)) {
+                loader_retire(loader, loader->in_flight[retired]);
+                retired++;
+        }
+        if (retired > 0) {
+                memmove(loader->in_flight, &loader->in_flight[retired],
+                        (loader->in_flight_ct - retired) * sizeof(loader->in_flight[0]));
+                loader->in_flight_ct -= retired;
+        }
+}
+
+// Creates images for everything that has been decoded, records their uploads and submits them.
+// Also recycles staging memory from finished uploads. Never blocks on the GPU: if every upload
+// batch is still in flight, the remaining images wait for a later call. So it's fine to call once
+// a frame while loading in the background.
+void loader_poll(struct Loader* loader) {
+        loader_process(loader, 0);
+}
+
+// Returns 1 once everything added so far is uploaded and ready to sample.
+int loader_done(struct Loader* loader) {
+        loader_poll(loader);
+        return loader->outstanding == 0;
+}
+
+// Blocks until everything added so far is uploaded and ready to sample.
+void loader_wait(struct Loader* loader) {
+        loader_process(loader, 1);
+        while (loader->outstanding > 0) {
+                if (loader->in_flight_ct > 0) {
+                        // Workers might be waiting for this staging memory
+                        upload_wait(loader->up, loader->in_flight[0]->ticket);
+                } else {
+                        pthread_mutex_lock(&loader->lock);
+                        while (loader->done == NULL) {
+                                pthread_cond_wait(&loader->ready, &loader->lock);
+                        }
+                        pthread_mutex_unlock(&loader->lock);
+                }
+                loader_process(loader, 1);
+        }
+}
+
+void loader_stats_print(const struct Loader* loader) {
+        const struct LoaderStats* stats = &loader->stats;
+        double wall_s = stats->wall_s > 0 ? stats->wall_s : 1e-9;
+        printf("Loaded %u textures (%.1f MB compressed, %.1f MB decoded) on %u threads in %.3f s, "
+               "%u failed\n", stats->texture_ct, stats->file_bytes / 1e6, stats->decoded_bytes / 1e6,
+               loader->jobs.thread_ct, stats->wall_s, stats->failed_ct);
+        printf("  %.1f textures/s, %.1f MB/s decoded, %.2f ms decode per texture\n",
+               stats->texture_ct / wall_s, stats->decoded_bytes / 1e6 / wall_s,
+               stats->texture_ct > 0 ? stats->decode_s * 1e3 / stats->texture_ct : 0.0);
+}
+
+// Waits for everything outstanding, so it's safe to call mid-load.
+void loader_destroy(struct Loader* loader) {
+        loader_wait(loader);
+        jobs_destroy(&loader->jobs);
+
+        buffer_destroy(loader->up->device, &loader->staging);
+        mem_ranges_destroy(&loader->ranges);
+
+        pthread_mutex_destroy(&loader->lock);
+        pthread_cond_destroy(&loader->space);
+        pthread_cond_destroy(&loader->ready);
+        free(loader->in_flight);
+}
+
+#endif // LL_LOADER_H
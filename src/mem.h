@@ -4,8 +4,172 @@
 #include <vulkan/vulkan.h>
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Size of the VkDeviceMemory blocks that `mem_suballoc` carves up. Anything bigger than half a
+// block gets a dedicated allocation instead.
+const VkDeviceSize MEM_BLOCK_SIZE = 64 * 1024 * 1024;
+
+struct MemRange {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+};
+
+// Free list for carving up one linear range of something (device memory, a staging buffer...).
+// Sorted by offset, and neighbours are always merged.
+struct MemRanges {
+        uint32_t free_ct;
+        uint32_t free_cap;
+        struct MemRange* free;
+
+        uint32_t alloc_ct;
+};
+
+struct MemBlock {
+        struct MemAllocator* owner;
+        struct MemBlock* next;
+
+        VkDeviceMemory handle;
+        VkDeviceSize size;
+        uint32_t mem_type_idx;
+        // Blocks only ever hold linear resources (buffers, linear images) or only optimal ones,
+        // so neighbouring sub-allocations can never violate bufferImageGranularity.
+        int linear;
+        int dedicated;
+        int coherent;
+        // Non-NULL for host-visible memory, which stays mapped for the lifetime of the block
+        void* mapped;
+
+        struct MemRanges ranges;
+};
+
+// Not thread-safe.
+struct MemAllocator {
+        VkPhysicalDevice phys_dev;
+        VkDevice device;
+        VkPhysicalDeviceMemoryProperties mem_props;
+        VkDeviceSize granularity;
+        VkDeviceSize non_coherent_atom;
+
+        struct MemBlock* blocks;
+        // Number of live vkAllocateMemory calls
+        uint32_t block_ct;
+};
+
+// A piece of a MemBlock. `mem` and `offset` are what you pass to vkBind*Memory.
+struct MemAlloc {
+        struct MemBlock* block;
+        VkDeviceMemory mem;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        // NULL unless the memory is host-visible
+        void* mapped;
+};
+
+void mem_ranges_init(VkDeviceSize size, struct MemRanges* ranges) {
+        ranges->free_cap = 16;
+        ranges->free = malloc(ranges->free_cap * sizeof(ranges->free[0]));
+        ranges->free[0].offset = 0;
+        ranges->free[0].size = size;
+        ranges->free_ct = 1;
+        ranges->alloc_ct = 0;
+}
+
+void mem_ranges_destroy(struct MemRanges* ranges) {
+        free(ranges->free);
+}
+
+// Best fit. Returns 0 if nothing fits.
+int mem_ranges_take(struct MemRanges* ranges, VkDeviceSize size, VkDeviceSize alignment,
+                    VkDeviceSize* offset)
+{
+        uint32_t best = UINT32_MAX;
+        VkDeviceSize best_waste = 0;
+        for (uint32_t i = 0; i < ranges->free_ct; i++) {
+                struct MemRange* range = &ranges->free[i];
+                VkDeviceSize start = (range->offset + alignment - 1) / alignment * alignment;
+                VkDeviceSize end = range->offset + range->size;
+                if (start + size > end) continue;
+
+                // Whatever is left behind the block, not counting the alignment padding
+                VkDeviceSize waste = end - (start + size);
+                if (best == UINT32_MAX || waste < best_waste) {
+                        best = i;
+                        best_waste = waste;
+                }
+        }
+        if (best == UINT32_MAX) return 0;
+
+        struct MemRange range = ranges->free[best];
+        VkDeviceSize start = (range.offset + alignment - 1) / alignment * alignment;
+        VkDeviceSize end = range.offset + range.size;
+
+        // The alignment padding stays in the free list as its own range
+        int keep_front = start > range.offset;
+        int keep_back = start + size < end;
+        int new_ct = keep_front + keep_back;
+
+        if (new_ct == 2 && ranges->free_ct == ranges->free_cap) {
+                ranges->free_cap *= 2;
+                ranges->free = realloc(ranges->free, ranges->free_cap * sizeof(ranges->free[0]));
+        }
+        // Shift the tail to make room for (or close the gap after) the replacement ranges
+        memmove(&ranges->free[best + new_ct], &ranges->free[best + 1],
+                (ranges->free_ct - best - 1) * sizeof(ranges->free[0]));
+        ranges->free_ct = ranges->free_ct - 1 + new_ct;
+
+        uint32_t idx = best;
+        if (keep_front) {
+                ranges->free[idx].offset = range.offset;
+                ranges->free[idx].size = start - range.offset;
+                idx++;
+        }
+        if (keep_back) {
+                ranges->free[idx].offset = start + size;
+                ranges->free[idx].size = end - (start + size);
+        }
+
+        ranges->alloc_ct++;
+        *offset = start;
+        return 1;
+}
+
+void mem_ranges_give_back(struct MemRanges* ranges, VkDeviceSize offset, VkDeviceSize size) {
+        // First free range after the one we're returning
+        uint32_t idx = 0;
+        while (idx < ranges->free_ct && ranges->free[idx].offset < offset) idx++;
+
+        int merge_prev = idx > 0
+                && ranges->free[idx - 1].offset + ranges->free[idx - 1].size == offset;
+        int merge_next = idx < ranges->free_ct && offset + size == ranges->free[idx].offset;
+
+        if (merge_prev && merge_next) {
+                ranges->free[idx - 1].size += size + ranges->free[idx].size;
+                memmove(&ranges->free[idx], &ranges->free[idx + 1],
+                        (ranges->free_ct - idx - 1) * sizeof(ranges->free[0]));
+                ranges->free_ct--;
+        } else if (merge_prev) {
+                ranges->free[idx - 1].size += size;
+        } else if (merge_next) {
+                ranges->free[idx].offset = offset;
+                ranges->free[idx].size += size;
+        } else {
+                if (ranges->free_ct == ranges->free_cap) {
+                        ranges->free_cap *= 2;
+                        ranges->free = realloc(ranges->free, ranges->free_cap * sizeof(ranges->free[0]));
+                }
+                memmove(&ranges->free[idx + 1], &ranges->free[idx],
+                        (ranges->free_ct - idx) * sizeof(ranges->free[0]));
+                ranges->free[idx].offset = offset;
+                ranges->free[idx].size = size;
+                ranges->free_ct++;
+        }
+
+        assert(ranges->alloc_ct > 0);
+        ranges->alloc_ct--;
+}
+
 void mem_alloc(VkDevice device, uint32_t mem_type_idx, VkDeviceSize size, VkDeviceMemory* mem) {
         VkMemoryAllocateInfo info = {0};
         info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
@@ -31,12 +195,145 @@ uint32_t mem_type_idx_find(VkPhysicalDevice phys_dev, uint32_t idx_mask, VkMemor
         return chosen;
 }
 
-void mem_write(VkDevice device, VkDeviceMemory mem, VkDeviceSize size, const void* data) {
-        void *mapped;
-        vkMapMemory(device, mem, 0, size, 0, &mapped);
-	memcpy(mapped, data, size);
-        vkUnmapMemory(device, mem);
+void mem_allocator_create(VkPhysicalDevice phys_dev, VkDevice device, struct MemAllocator* allocator) {
+        bzero(allocator, sizeof(*allocator));
+        allocator->phys_dev = phys_dev;
+        allocator->device = device;
+        vkGetPhysicalDeviceMemoryProperties(phys_dev, &allocator->mem_props);
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(phys_dev, &props);
+        allocator->granularity = props.limits.bufferImageGranularity;
+        allocator->non_coherent_atom = props.limits.nonCoherentAtomSize;
 }
 
-#endif // LL_MEM_H
+static void mem_block_destroy(VkDevice device, struct MemBlock* block) {
+        if (block->mapped != NULL) vkUnmapMemory(device, block->handle);
+        vkFreeMemory(device, block->handle, NULL);
+        mem_ranges_destroy(&block->ranges);
+        free(block);
+}
+
+// Everything allocated from `allocator` must have been freed (or at least must not be used
+// anymore).
+void mem_allocator_destroy(struct MemAllocator* allocator) {
+        struct MemBlock* block = allocator->blocks;
+        while (block != NULL) {
+                struct MemBlock* next = block->next;
+                mem_block_destroy(allocator->device, block);
+                block = next;
+        }
+        allocator->blocks = NULL;
+        allocator->block_ct = 0;
+}
+
+static struct MemBlock* mem_block_create(struct MemAllocator* allocator, uint32_t mem_type_idx,
+                                         VkDeviceSize size, int linear, int dedicated)
+{
+        struct MemBlock* block = malloc(sizeof(*block));
+        bzero(block, sizeof(*block));
+        block->owner = allocator;
+        block->size = size;
+        block->mem_type_idx = mem_type_idx;
+        block->linear = linear;
+        block->dedicated = dedicated;
+
+        mem_alloc(allocator->device, mem_type_idx, size, &block->handle);
+
+        VkMemoryPropertyFlags flags = allocator->mem_props.memoryTypes[mem_type_idx].propertyFlags;
+        block->coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+        if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+                VkResult res = vkMapMemory(allocator->device, block->handle, 0, VK_WHOLE_SIZE, 0,
+                                           &block->mapped);
+                assert(res == VK_SUCCESS);
+        }
+
+        mem_ranges_init(size, &block->ranges);
+
+        block->next = allocator->blocks;
+        allocator->blocks = block;
+        allocator->block_ct++;
+
+        return block;
+}
+
+// `linear` should be 1 for buffers and VK_IMAGE_TILING_LINEAR images, 0 for optimal-tiling images.
+void mem_suballoc(struct MemAllocator* allocator, const VkMemoryRequirements* reqs,
+                  VkMemoryPropertyFlags props, int linear, struct MemAlloc* alloc)
+{
+        uint32_t mem_type_idx = UINT32_MAX;
+        for (uint32_t i = 0; i < allocator->mem_props.memoryTypeCount && mem_type_idx == UINT32_MAX; ++i) {
+                int type_ok = reqs->memoryTypeBits & (1 << i);
+                VkMemoryPropertyFlags flags = allocator->mem_props.memoryTypes[i].propertyFlags;
+                int props_ok = (props & flags) == props;
+                if (type_ok && props_ok) mem_type_idx = i;
+        }
+        assert(mem_type_idx != UINT32_MAX);
 
+        // If the device doesn't care about granularity there's no reason to keep the two kinds of
+        // resources apart
+        if (allocator->granularity <= 1) linear = 0;
+
+        struct MemBlock* block = NULL;
+        VkDeviceSize offset = 0;
+        if (reqs->size > MEM_BLOCK_SIZE / 2) {
+                block = mem_block_create(allocator, mem_type_idx, reqs->size, linear, 1);
+                int ok = mem_ranges_take(&block->ranges, reqs->size, 1, &offset);
+                assert(ok);
+        } else {
+                for (struct MemBlock* b = allocator->blocks; b != NULL && block == NULL; b = b->next) {
+                        if (b->dedicated || b->mem_type_idx != mem_type_idx || b->linear != linear)
+                                continue;
+                        if (mem_ranges_take(&b->ranges, reqs->size, reqs->alignment, &offset)) block = b;
+                }
+
+                if (block == NULL) {
+                        block = mem_block_create(allocator, mem_type_idx, MEM_BLOCK_SIZE, linear, 0);
+                        int ok = mem_ranges_take(&block->ranges, reqs->size, reqs->alignment, &offset);
+                        assert(ok);
+                }
+        }
+
+        alloc->block = block;
+        alloc->mem = block->handle;
+        alloc->offset = offset;
+        alloc->size = reqs->size;
+        alloc->mapped = block->mapped == NULL ? NULL : (char*) block->mapped + offset;
+}
+
+void mem_free(struct MemAlloc* alloc) {
+        struct MemBlock* block = alloc->block;
+        struct MemAllocator* allocator = block->owner;
+        mem_ranges_give_back(&block->ranges, alloc->offset, alloc->size);
+
+        // Dedicated blocks are never reused, so give them back to the driver straight away. Regular
+        // blocks are kept around for the next allocation.
+        if (block->dedicated && block->ranges.alloc_ct == 0) {
+                struct MemBlock** link = &allocator->blocks;
+                while (*link != block) link = &(*link)->next;
+                *link = block->next;
+                allocator->block_ct--;
+                mem_block_destroy(allocator->device, block);
+        }
+
+        bzero(alloc, sizeof(*alloc));
+}
+
+// `alloc` must be host-visible. Flushes if the memory isn't coherent.
+void mem_write(VkDevice device, const struct MemAlloc* alloc, VkDeviceSize size, const void* data) {
+        assert(alloc->mapped != NULL);
+        assert(size <= alloc->size);
+	memcpy(alloc->mapped, data, size);
+
+        if (!alloc->block->coherent) {
+                VkDeviceSize atom = alloc->block->owner->non_coherent_atom;
+                VkMappedMemoryRange range = {0};
+                range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+                range.memory = alloc->mem;
+                range.offset = alloc->offset / atom * atom;
+                range.size = VK_WHOLE_SIZE;
+                vkFlushMappedMemoryRanges(device, 1, &range);
+        }
+}
+
+#endif // LL_MEM_H
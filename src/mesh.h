@@ -0,0 +1,546 @@
+#ifndef LL_MESH_H
+#define LL_MESH_H
+
+#include <vulkan/vulkan.h>
+
+#include "buffer.h"
+#include "file.h"
+#include "hash.h"
+#include "mem.h"
+#include "meshopt.h"
+
+// Define FAST_OBJ_IMPLEMENTATION before including this in exactly one file
+#include "../external/fast_obj/fast_obj.h"
+
+#include <assert.h>
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Mesh cache files are laid out exactly like they're used: a header, then the submeshes, vertices
+// and indices, each 16-byte aligned. Loading one is just an mmap.
+const uint32_t MESH_MAGIC = 0x48534d4c; // "LMSH"
+const uint32_t MESH_VERSION = 2;
+
+struct MeshVertex {
+        float pos[3];
+        float normal[3];
+        float uv[2];
+};
+
+const VkVertexInputBindingDescription MESH_VERTEX_BINDING = {
+        .binding = 0,
+        .stride = sizeof(struct MeshVertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+};
+
+const VkVertexInputAttributeDescription MESH_VERTEX_ATTRIBUTES[] = {
+        {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT,
+         .offset = offsetof(struct MeshVertex, pos)},
+        {.location = 1, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT,
+         .offset = offsetof(struct MeshVertex, normal)},
+        {.location = 2, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT,
+         .offset = offsetof(struct MeshVertex, uv)},
+};
+
+// Drop-in value for PipelineSettings.vertex. See quant.h for smaller formats.
+const VkPipelineVertexInputStateCreateInfo MESH_VERTEX_INPUT = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &MESH_VERTEX_BINDING,
+        .vertexAttributeDescriptionCount = sizeof(MESH_VERTEX_ATTRIBUTES)
+        / sizeof(MESH_VERTEX_ATTRIBUTES[0]),
+        .pVertexAttributeDescriptions = MESH_VERTEX_ATTRIBUTES,
+};
+
+struct MeshSubmesh {
+        uint32_t index_offset;
+        uint32_t index_ct;
+        uint32_t material;
+        float min[3];
+        float max[3];
+};
+
+struct MeshHeader {
+        uint32_t magic;
+        uint32_t version;
+
+        // What the cache was built from. If the size and mtime still match we trust the cache,
+        // otherwise the contents get hashed and compared.
+        uint64_t source_hash;
+        uint64_t source_size;
+        int64_t source_mtime;
+
+        uint32_t vertex_ct;
+        uint32_t index_ct;
+        // 2 or 4
+        uint32_t index_size;
+        uint32_t submesh_ct;
+
+        float min[3];
+        float max[3];
+
+        // From the start of the file
+        uint64_t submesh_offset;
+        uint64_t vertex_offset;
+        uint64_t index_offset;
+        uint64_t file_size;
+};
+
+// An imported mesh before it's written out. Indices are always 32-bit here.
+struct MeshData {
+        uint32_t vertex_ct;
+        struct MeshVertex* vertices;
+        uint32_t index_ct;
+        uint32_t* indices;
+        uint32_t submesh_ct;
+        struct MeshSubmesh* submeshes;
+};
+
+struct Mesh {
+        const struct MeshHeader* header;
+        const struct MeshSubmesh* submeshes;
+        const struct MeshVertex* vertices;
+        // uint16_t or uint32_t depending on header->index_size
+        const void* indices;
+
+        // Either an mmap of the cache file or a malloc'd copy of it
+        void* blob;
+        size_t blob_size;
+        int mapped;
+};
+
+static uint64_t mesh_align(uint64_t x) {
+        return (x + 15) & ~(uint64_t) 15;
+}
+
+// Triangulates faces as fans, merges identical position/uv/normal combinations and sorts triangles
+// by material so every material ends up as one submesh.
+void mesh_data_from_obj(const fastObjMesh* obj, struct MeshData* data) {
+        bzero(data, sizeof(*data));
+
+        uint32_t bucket_ct = obj->material_count > 0 ? obj->material_count : 1;
+        uint32_t* bucket_tri_cts = calloc(bucket_ct, sizeof(bucket_tri_cts[0]));
+
+        uint32_t corner_ct = 0;
+        uint32_t tri_ct = 0;
+        for (uint32_t i = 0; i < obj->face_count; i++) {
+                uint32_t n = obj->face_vertices[i];
+                corner_ct += n;
+                if (n < 3) continue;
+                uint32_t mat = obj->face_materials[i] < bucket_ct ? obj->face_materials[i] : 0;
+                bucket_tri_cts[mat] += n - 2;
+                tri_ct += n - 2;
+        }
+
+        // Where each material's triangles start
+        uint32_t* cursors = malloc(bucket_ct * sizeof(cursors[0]));
+        data->submeshes = malloc(bucket_ct * sizeof(data->submeshes[0]));
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < bucket_ct; i++) {
+                cursors[i] = offset;
+                if (bucket_tri_cts[i] > 0) {
+                        struct MeshSubmesh* sub = &data->submeshes[data->submesh_ct++];
+                        bzero(sub, sizeof(*sub));
+                        sub->index_offset = offset;
+                        sub->index_ct = bucket_tri_cts[i] * 3;
+                        sub->material = i;
+                }
+                offset += bucket_tri_cts[i] * 3;
+        }
+
+        data->index_ct = tri_ct * 3;
+        data->indices = malloc(data->index_ct * sizeof(data->indices[0]));
+        // Can't have more unique vertices than corners
+        data->vertices = malloc(corner_ct * sizeof(data->vertices[0]));
+        fastObjIndex* keys = malloc(corner_ct * sizeof(keys[0]));
+
+        // Open addressing, maps a fastObjIndex to a vertex index
+        uint32_t table_cap = 16;
+        while (table_cap < corner_ct * 2) table_cap *= 2;
+        uint32_t* table = malloc(table_cap * sizeof(table[0]));
+        memset(table, 0xff, table_cap * sizeof(table[0]));
+
+        uint32_t corner = 0;
+        uint32_t face_verts[3];
+        for (uint32_t i = 0; i < obj->face_count; i++) {
+                uint32_t n = obj->face_vertices[i];
+                if (n < 3) {
+                        corner += n;
+                        continue;
+                }
+                uint32_t mat = obj->face_materials[i] < bucket_ct ? obj->face_materials[i] : 0;
+
+                for (uint32_t j = 0; j < n; j++) {
+                        fastObjIndex key = obj->indices[corner + j];
+
+                        uint32_t slot = hash_bytes(HASH_SEED, sizeof(key), &key) & (table_cap - 1);
+                        while (table[slot] != UINT32_MAX) {
+                                fastObjIndex other = keys[table[slot]];
+                                if (other.p == key.p && other.t == key.t && other.n == key.n) break;
+                                slot = (slot + 1) & (table_cap - 1);
+                        }
+
+                        if (table[slot] == UINT32_MAX) {
+                                uint32_t idx = data->vertex_ct++;
+                                table[slot] = idx;
+                                keys[idx] = key;
+
+                                struct MeshVertex* v = &data->vertices[idx];
+                                memcpy(v->pos, &obj->positions[3 * key.p], sizeof(v->pos));
+                                memcpy(v->normal, &obj->normals[3 * key.n], sizeof(v->normal));
+                                memcpy(v->uv, &obj->texcoords[2 * key.t], sizeof(v->uv));
+                        }
+
+                        // Fan: (0, 1, 2), (0, 2, 3), ...
+                        uint32_t idx = table[slot];
+                        if (j < 2) {
+                                face_verts[j] = idx;
+                        } else {
+                                face_verts[2] = idx;
+                                memcpy(&data->indices[cursors[mat]], face_verts, sizeof(face_verts));
+                                cursors[mat] += 3;
+                                face_verts[1] = idx;
+                        }
+                }
+
+                corner += n;
+        }
+
+        // Doesn't matter much if this fails, we'd just keep the slack
+        struct MeshVertex* shrunk =
+                realloc(data->vertices, (data->vertex_ct > 0 ? data->vertex_ct : 1) * sizeof(shrunk[0]));
+        if (shrunk != NULL) data->vertices = shrunk;
+
+        free(table);
+        free(keys);
+        free(cursors);
+        free(bucket_tri_cts);
+}
+
+// Reorders each submesh's triangles for the post-transform cache and then for overdraw, and the
+// vertices for fetch locality. Runs entirely on the CPU. `before` and `after` can be NULL.
+void mesh_data_optimize(struct MeshData* data, struct MeshoptCacheStats* before,
+                        struct MeshoptCacheStats* after)
+{
+        if (before != NULL) {
+                meshopt_cache_stats(data->indices, data->index_ct, data->vertex_ct,
+                                    MESHOPT_CACHE_SIZE, before);
+        }
+
+        // Each submesh is optimized with its own vertices numbered from 0, so the passes only
+        // allocate and scan what the submesh uses instead of every vertex in the mesh. `local_of`
+        // is only valid for vertices whose `local_sub` is the current submesh + 1.
+        uint32_t index_cap = data->index_ct > 0 ? data->index_ct : 1;
+        uint32_t vertex_cap = data->vertex_ct > 0 ? data->vertex_ct : 1;
+        uint32_t* scratch = malloc(index_cap * sizeof(scratch[0]));
+        uint32_t* local_indices = malloc(index_cap * sizeof(local_indices[0]));
+        uint32_t* global_of = malloc(index_cap * sizeof(global_of[0]));
+        float* local_pos = malloc(index_cap * 3 * sizeof(local_pos[0]));
+        uint32_t* local_of = malloc(vertex_cap * sizeof(local_of[0]));
+        uint32_t* local_sub = calloc(vertex_cap, sizeof(local_sub[0]));
+        for (uint32_t i = 0; i < data->submesh_ct; i++) {
+                const struct MeshSubmesh* sub = &data->submeshes[i];
+                uint32_t* indices = &data->indices[sub->index_offset];
+
+                uint32_t local_ct = 0;
+                for (uint32_t j = 0; j < sub->index_ct; j++) {
+                        uint32_t v = indices[j];
+                        if (local_sub[v] != i + 1) {
+                                local_sub[v] = i + 1;
+                                local_of[v] = local_ct;
+                                global_of[local_ct] = v;
+                                memcpy(&local_pos[local_ct * 3], data->vertices[v].pos,
+                                       3 * sizeof(local_pos[0]));
+                                local_ct++;
+                        }
+                        local_indices[j] = local_of[v];
+                }
+
+                meshopt_optimize_vcache(scratch, local_indices, sub->index_ct, local_ct,
+                                        MESHOPT_CACHE_SIZE);
+                meshopt_optimize_overdraw(local_indices, scratch, sub->index_ct, local_pos,
+                                          local_ct, 3 * sizeof(local_pos[0]), MESHOPT_CACHE_SIZE,
+                                          MESHOPT_OVERDRAW_THRESHOLD);
+
+                for (uint32_t j = 0; j < sub->index_ct; j++) {
+                        indices[j] = global_of[local_indices[j]];
+                }
+        }
+        free(local_sub);
+        free(local_of);
+        free(local_pos);
+        free(global_of);
+        free(local_indices);
+        free(scratch);
+
+        struct MeshVertex* vertices = malloc((data->vertex_ct > 0 ? data->vertex_ct : 1)
+                                             * sizeof(vertices[0]));
+        data->vertex_ct = meshopt_optimize_vfetch(vertices, data->indices, data->index_ct,
+                                                  data->vertices, data->vertex_ct,
+                                                  sizeof(struct MeshVertex));
+        free(data->vertices);
+        data->vertices = vertices;
+
+        if (after != NULL) {
+                meshopt_cache_stats(data->indices, data->index_ct, data->vertex_ct,
+                                    MESHOPT_CACHE_SIZE, after);
+        }
+}
+
+void mesh_data_destroy(struct MeshData* data) {
+        free(data->vertices);
+        free(data->indices);
+        free(data->submeshes);
+}
+
+static void mesh_bounds_add(float* min, float* max, const float* pos) {
+        for (int k = 0; k < 3; k++) {
+                if (pos[k] < min[k]) min[k] = pos[k];
+                if (pos[k] > max[k]) max[k] = pos[k];
+        }
+}
+
+// Fills in submesh bounds and lays everything out the way it'll be stored on disk. The result is
+// malloc'd.
+void mesh_data_serialize(struct MeshData* data, uint64_t source_hash, uint64_t source_size,
+                         int64_t source_mtime, size_t* size_out, void** blob_out)
+{
+        struct MeshHeader header = {0};
+        header.magic = MESH_MAGIC;
+        header.version = MESH_VERSION;
+        header.source_hash = source_hash;
+        header.source_size = source_size;
+        header.source_mtime = source_mtime;
+        header.vertex_ct = data->vertex_ct;
+        header.index_ct = data->index_ct;
+        header.index_size = data->vertex_ct <= 65536 ? 2 : 4;
+        header.submesh_ct = data->submesh_ct;
+
+        for (int k = 0; k < 3; k++) {
+                header.min[k] = FLT_MAX;
+                header.max[k] = -FLT_MAX;
+        }
+        for (uint32_t i = 0; i < data->submesh_ct; i++) {
+                struct MeshSubmesh* sub = &data->submeshes[i];
+                for (int k = 0; k < 3; k++) {
+                        sub->min[k] = FLT_MAX;
+                        sub->max[k] = -FLT_MAX;
+                }
+                for (uint32_t j = 0; j < sub->index_ct; j++) {
+                        const float* pos = data->vertices[data->indices[sub->index_offset + j]].pos;
+                        mesh_bounds_add(sub->min, sub->max, pos);
+                }
+                mesh_bounds_add(header.min, header.max, sub->min);
+                mesh_bounds_add(header.min, header.max, sub->max);
+        }
+
+        header.submesh_offset = mesh_align(sizeof(header));
+        header.vertex_offset =
+                mesh_align(header.submesh_offset + data->submesh_ct * sizeof(struct MeshSubmesh));
+        header.index_offset =
+                mesh_align(header.vertex_offset + data->vertex_ct * sizeof(struct MeshVertex));
+        header.file_size = mesh_align(header.index_offset + (uint64_t) data->index_ct * header.index_size);
+
+        char* blob = calloc(1, header.file_size);
+        memcpy(blob, &header, sizeof(header));
+        memcpy(blob + header.submesh_offset, data->submeshes,
+               data->submesh_ct * sizeof(struct MeshSubmesh));
+        memcpy(blob + header.vertex_offset, data->vertices,
+               data->vertex_ct * sizeof(struct MeshVertex));
+        if (header.index_size == 4) {
+                memcpy(blob + header.index_offset, data->indices, data->index_ct * sizeof(uint32_t));
+        } else {
+                uint16_t* dst = (uint16_t*) (blob + header.index_offset);
+                for (uint32_t i = 0; i < data->index_ct; i++) dst[i] = data->indices[i];
+        }
+
+        *size_out = header.file_size;
+        *blob_out = blob;
+}
+
+static int mesh_from_blob(void* blob, size_t size, int mapped, struct Mesh* mesh) {
+        bzero(mesh, sizeof(*mesh));
+        mesh->blob = blob;
+        mesh->blob_size = size;
+        mesh->mapped = mapped;
+
+        const struct MeshHeader* h = blob;
+        if (size < sizeof(*h) || h->magic != MESH_MAGIC || h->version != MESH_VERSION
+            || h->file_size != size
+            || (h->index_size != 2 && h->index_size != 4)
+            || h->submesh_offset + h->submesh_ct * sizeof(struct MeshSubmesh) > size
+            || h->vertex_offset + (uint64_t) h->vertex_ct * sizeof(struct MeshVertex) > size
+            || h->index_offset + (uint64_t) h->index_ct * h->index_size > size) {
+                return 0;
+        }
+
+        mesh->header = h;
+        mesh->submeshes = (const struct MeshSubmesh*) ((const char*) blob + h->submesh_offset);
+        mesh->vertices = (const struct MeshVertex*) ((const char*) blob + h->vertex_offset);
+        mesh->indices = (const char*) blob + h->index_offset;
+
+        // A corrupt cache shouldn't turn into out of bounds vertex fetches on the GPU
+        for (uint32_t i = 0; i < h->submesh_ct; i++) {
+                const struct MeshSubmesh* sub = &mesh->submeshes[i];
+                if ((uint64_t) sub->index_offset + sub->index_ct > h->index_ct) return 0;
+        }
+        for (uint32_t i = 0; i < h->index_ct; i++) {
+                uint32_t idx = h->index_size == 2 ? ((const uint16_t*) mesh->indices)[i]
+                                                  : ((const uint32_t*) mesh->indices)[i];
+                if (idx >= h->vertex_ct) return 0;
+        }
+
+        return 1;
+}
+
+void mesh_close(struct Mesh* mesh) {
+        if (mesh->blob == NULL) return;
+        if (mesh->mapped) file_unmap(mesh->blob_size, mesh->blob);
+        else free(mesh->blob);
+        bzero(mesh, sizeof(*mesh));
+}
+
+// Maps a cache file. Returns 0 if it doesn't exist or isn't a valid cache.
+int mesh_open(const char* path, struct Mesh* mesh) {
+        bzero(mesh, sizeof(*mesh));
+
+        size_t size;
+        void* blob;
+        if (!file_map(path, &size, &blob)) return 0;
+
+        if (!mesh_from_blob(blob, size, 1, mesh)) {
+                file_unmap(size, blob);
+                bzero(mesh, sizeof(*mesh));
+                return 0;
+        }
+
+        return 1;
+}
+
+// Hashes a whole file through an mmap. Returns 0 if it can't be read.
+int mesh_hash_file(const char* path, uint64_t* hash) {
+        size_t size;
+        void* data;
+        if (!file_map(path, &size, &data)) return 0;
+
+        *hash = hash_bytes_wide(HASH_SEED, size, data);
+        file_unmap(size, data);
+
+        return 1;
+}
+
+// Opens the cache at `cache_path` if it was built from the current version of `obj_path`.
+// Otherwise parses the OBJ, writes a new cache and returns that. Returns 1 on a cache hit.
+int mesh_load(const char* obj_path, const char* cache_path, struct Mesh* mesh) {
+        struct stat st;
+        if (stat(obj_path, &st) != 0) {
+                fprintf(stderr, "Couldn't stat %s\n", obj_path);
+                exit(1);
+        }
+
+        int have_hash = 0;
+        uint64_t source_hash = 0;
+
+        if (mesh_open(cache_path, mesh)) {
+                const struct MeshHeader* h = mesh->header;
+                if (h->source_size == (uint64_t) st.st_size && h->source_mtime == st.st_mtime) {
+                        return 1;
+                }
+
+                // Touched but maybe not changed
+                have_hash = mesh_hash_file(obj_path, &source_hash);
+                if (have_hash && h->source_hash == source_hash) return 1;
+
+                mesh_close(mesh);
+        }
+
+        if (!have_hash && !mesh_hash_file(obj_path, &source_hash)) {
+                fprintf(stderr, "Couldn't read %s\n", obj_path);
+                exit(1);
+        }
+
+        fastObjMesh* obj = fast_obj_read(obj_path);
+        if (obj == NULL) {
+                fprintf(stderr, "Couldn't load %s\n", obj_path);
+                exit(1);
+        }
+
+        struct MeshData data;
+        mesh_data_from_obj(obj, &data);
+        fast_obj_destroy(obj);
+        mesh_data_optimize(&data, NULL, NULL);
+
+        size_t size;
+        void* blob;
+        mesh_data_serialize(&data, source_hash, st.st_size, st.st_mtime, &size, &blob);
+        mesh_data_destroy(&data);
+
+        if (!file_write_atomic(cache_path, size, blob)) {
+                fprintf(stderr, "Couldn't write mesh cache %s\n", cache_path);
+        }
+
+        int ok = mesh_from_blob(blob, size, 0, mesh);
+        assert(ok);
+
+        return 0;
+}
+
+// Imports `obj_path` and prints the cache stats before and after `mesh_data_optimize`, plus how long
+// it took. Doesn't touch any caches.
+void mesh_optimize_report(const char* obj_path) {
+        fastObjMesh* obj = fast_obj_read(obj_path);
+        if (obj == NULL) {
+                fprintf(stderr, "Couldn't load %s\n", obj_path);
+                exit(1);
+        }
+
+        struct MeshData data;
+        mesh_data_from_obj(obj, &data);
+        fast_obj_destroy(obj);
+
+        struct MeshoptCacheStats before, after;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        mesh_data_optimize(&data, &before, &after);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+        printf("%s: %u vertices, %u triangles, %u submeshes\n", obj_path, data.vertex_ct,
+               data.index_ct / 3, data.submesh_ct);
+        printf("  ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (cache size %u), took %.1f ms\n",
+               before.acmr, after.acmr, before.atvr, after.atvr, MESHOPT_CACHE_SIZE, ms);
+
+        mesh_data_destroy(&data);
+}
+
+VkIndexType mesh_index_type(const struct Mesh* mesh) {
+        return mesh->header->index_size == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+// Device-local vertex and index buffers. The data is copied straight out of the mapping. The mesh
+// can't be empty, since Vulkan buffers can't be.
+void mesh_upload(struct MemAllocator* allocator, VkDevice device, struct CbufPool* cbufs,
+                 const struct Mesh* mesh, struct Buffer* vertex_buf, struct Buffer* index_buf)
+{
+        const struct MeshHeader* h = mesh->header;
+        if (h->vertex_ct == 0 || h->index_ct == 0) {
+                fprintf(stderr, "Can't upload an empty mesh\n");
+                exit(1);
+        }
+        buffer_create_staged(allocator, device, cbufs,
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             h->vertex_ct * sizeof(struct MeshVertex), mesh->vertices,
+                             vertex_buf, NULL);
+        buffer_create_staged(allocator, device, cbufs,
+                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             (VkDeviceSize) h->index_ct * h->index_size, mesh->indices,
+                             index_buf, NULL);
+}
+
+#endif // LL_MESH_H
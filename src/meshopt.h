@@ -0,0 +1,392 @@
+#ifndef LL_MESHOPT_H
+#define LL_MESHOPT_H
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CPU-only index and vertex reordering for triangle lists. Everything works on 32-bit indices.
+
+// Roughly what current GPUs behave like. The exact value barely matters for the reordering.
+const uint32_t MESHOPT_CACHE_SIZE = 16;
+// How much worse than the vertex cache order a cluster's ACMR may get when splitting it up for
+// overdraw sorting. Higher means more, smaller clusters.
+const float MESHOPT_OVERDRAW_THRESHOLD = 1.05f;
+
+struct MeshoptCacheStats {
+        // Average cache miss ratio: vertex shader invocations per triangle. 0.5 is the best
+        // possible, 3 the worst.
+        float acmr;
+        // Average transformed vertex ratio: invocations per unique vertex. 1 is the best possible.
+        float atvr;
+};
+
+// Simulates a FIFO post-transform cache of `cache_size` entries.
+void meshopt_cache_stats(const uint32_t* indices, uint32_t index_ct, uint32_t vertex_ct,
+                         uint32_t cache_size, struct MeshoptCacheStats* stats)
+{
+        // A vertex is in the cache if it was added less than `cache_size` misses ago
+        uint32_t* added_at = malloc(vertex_ct * sizeof(added_at[0]));
+        memset(added_at, 0xff, vertex_ct * sizeof(added_at[0]));
+
+        uint32_t misses = 0;
+        uint8_t* used = calloc(vertex_ct, 1);
+        uint32_t unique = 0;
+        for (uint32_t i = 0; i < index_ct; i++) {
+                uint32_t v = indices[i];
+                if (added_at[v] == UINT32_MAX || misses - added_at[v] >= cache_size) {
+                        added_at[v] = misses++;
+                }
+                if (!used[v]) {
+                        used[v] = 1;
+                        unique++;
+                }
+        }
+
+        stats->acmr = index_ct > 0 ? (float) misses / (index_ct / 3) : 0;
+        stats->atvr = unique > 0 ? (float) misses / unique : 0;
+
+        free(used);
+        free(added_at);
+}
+
+// Triangles using each vertex, as one flat array
+struct MeshoptAdjacency {
+        uint32_t* offsets;
+        uint32_t* counts;
+        uint32_t* tris;
+};
+
+static void meshopt_adjacency_build(const uint32_t* indices, uint32_t index_ct, uint32_t vertex_ct,
+                                    struct MeshoptAdjacency* adj)
+{
+        adj->offsets = malloc(vertex_ct * sizeof(adj->offsets[0]));
+        adj->counts = calloc(vertex_ct, sizeof(adj->counts[0]));
+        adj->tris = malloc(index_ct * sizeof(adj->tris[0]));
+
+        for (uint32_t i = 0; i < index_ct; i++) adj->counts[indices[i]]++;
+
+        uint32_t offset = 0;
+        for (uint32_t v = 0; v < vertex_ct; v++) {
+                adj->offsets[v] = offset;
+                offset += adj->counts[v];
+        }
+
+        // Use counts as a cursor, then put them back
+        for (uint32_t v = 0; v < vertex_ct; v++) adj->counts[v] = 0;
+        for (uint32_t i = 0; i < index_ct; i++) {
+                uint32_t v = indices[i];
+                adj->tris[adj->offsets[v] + adj->counts[v]++] = i / 3;
+        }
+}
+
+static void meshopt_adjacency_destroy(struct MeshoptAdjacency* adj) {
+        free(adj->offsets);
+        free(adj->counts);
+        free(adj->tris);
+}
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"). Fans out around one vertex at a time, moving on to whichever recently used vertex will
+// still be in the cache once its remaining triangles are emitted. `dst` can't alias `indices`.
+void meshopt_optimize_vcache(uint32_t* dst, const uint32_t* indices, uint32_t index_ct,
+                             uint32_t vertex_ct, uint32_t cache_size)
+{
+        assert(dst != indices);
+        if (index_ct == 0) return;
+
+        uint32_t tri_ct = index_ct / 3;
+        struct MeshoptAdjacency adj;
+        meshopt_adjacency_build(indices, index_ct, vertex_ct, &adj);
+
+        // Triangles not emitted yet, per vertex
+        uint32_t* live = malloc(vertex_ct * sizeof(live[0]));
+        memcpy(live, adj.counts, vertex_ct * sizeof(live[0]));
+
+        uint32_t* cache_time = calloc(vertex_ct, sizeof(cache_time[0]));
+        uint8_t* emitted = calloc(tri_ct, 1);
+
+        uint32_t* dead_ends = malloc(index_ct * sizeof(dead_ends[0]));
+        uint32_t dead_end_ct = 0;
+
+        uint32_t* candidates = malloc(index_ct * sizeof(candidates[0]));
+
+        uint32_t time = cache_size + 1;
+        uint32_t cursor = 0;
+        uint32_t out_ct = 0;
+
+        uint32_t fan = indices[0];
+        for (;;) {
+                uint32_t candidate_ct = 0;
+
+                for (uint32_t i = 0; i < adj.counts[fan]; i++) {
+                        uint32_t tri = adj.tris[adj.offsets[fan] + i];
+                        if (emitted[tri]) continue;
+                        emitted[tri] = 1;
+
+                        for (int k = 0; k < 3; k++) {
+                                uint32_t v = indices[tri * 3 + k];
+                                dst[out_ct++] = v;
+
+                                dead_ends[dead_end_ct++] = v;
+                                candidates[candidate_ct++] = v;
+                                live[v]--;
+
+                                if (time - cache_time[v] > cache_size) cache_time[v] = time++;
+                        }
+                }
+
+                // Prefer the candidate that's been in the cache longest, as long as it'll still be
+                // there after emitting its remaining triangles
+                uint32_t best = UINT32_MAX;
+                int64_t best_priority = -1;
+                for (uint32_t i = 0; i < candidate_ct; i++) {
+                        uint32_t v = candidates[i];
+                        if (live[v] == 0) continue;
+
+                        int64_t priority = 0;
+                        if (time - cache_time[v] + 2 * live[v] <= cache_size) {
+                                priority = time - cache_time[v];
+                        }
+                        if (priority > best_priority) {
+                                best_priority = priority;
+                                best = v;
+                        }
+                }
+
+                if (best == UINT32_MAX) {
+                        // Dead end: go back to something recently used, or failing that, just the next
+                        // vertex with triangles left
+                        while (dead_end_ct > 0 && best == UINT32_MAX) {
+                                uint32_t v = dead_ends[--dead_end_ct];
+                                if (live[v] > 0) best = v;
+                        }
+                        while (best == UINT32_MAX && cursor < vertex_ct) {
+                                if (live[cursor] > 0) best = cursor;
+                                cursor++;
+                        }
+                        if (best == UINT32_MAX) break;
+                }
+
+                fan = best;
+        }
+        assert(out_ct == index_ct);
+
+        free(candidates);
+        free(dead_ends);
+        free(emitted);
+        free(cache_time);
+        free(live);
+        meshopt_adjacency_destroy(&adj);
+}
+
+struct MeshoptCluster {
+        uint32_t first_tri;
+        uint32_t tri_ct;
+        float sort_key;
+};
+
+static int meshopt_cluster_cmp(const void* a, const void* b) {
+        float ka = ((const struct MeshoptCluster*) a)->sort_key;
+        float kb = ((const struct MeshoptCluster*) b)->sort_key;
+        return ka < kb ? 1 : (ka > kb ? -1 : 0);
+}
+
+// Runs one triangle through the FIFO cache simulation, returns how many of its vertices missed. A
+// vertex is in the cache if it was added less than `cache_size` misses ago, so adding `cache_size`
+// to `misses` empties the cache without touching every vertex.
+static uint32_t meshopt_tri_misses(const uint32_t* tri, uint32_t* added_at, uint32_t* misses,
+                                   uint32_t cache_size)
+{
+        uint32_t tri_misses = 0;
+        for (int k = 0; k < 3; k++) {
+                uint32_t v = tri[k];
+                if (*misses - added_at[v] >= cache_size) {
+                        added_at[v] = (*misses)++;
+                        tri_misses++;
+                }
+        }
+        return tri_misses;
+}
+
+// Splits vertex cache ordered triangles into clusters and sorts them so the ones facing outwards
+// from the middle of the mesh come first, since they're the most likely to occlude everything
+// else. Clusters start wherever the cache order had to start over (all 3 vertices missed), and are
+// split further as long as that doesn't push their ACMR above `threshold` times the original.
+//
+// `positions` points to the first vertex's position, `stride` is the distance between vertices in
+// bytes. `dst` can't alias `indices`.
+void meshopt_optimize_overdraw(uint32_t* dst, const uint32_t* indices, uint32_t index_ct,
+                               const float* positions, uint32_t vertex_ct, size_t stride,
+                               uint32_t cache_size, float threshold)
+{
+        assert(dst != indices);
+        if (index_ct == 0) return;
+
+        uint32_t tri_ct = index_ct / 3;
+        // Starting `misses` at `cache_size` makes every vertex a miss the first time
+        uint32_t* added_at = calloc(vertex_ct, sizeof(added_at[0]));
+        uint32_t misses = cache_size;
+
+        // Hard boundaries
+        uint32_t* hard = malloc((tri_ct + 1) * sizeof(hard[0]));
+        uint32_t hard_ct = 0;
+        for (uint32_t t = 0; t < tri_ct; t++) {
+                if (meshopt_tri_misses(&indices[t * 3], added_at, &misses, cache_size) == 3) {
+                        hard[hard_ct++] = t;
+                }
+        }
+        if (hard_ct == 0 || hard[0] != 0) {
+                memmove(&hard[1], hard, hard_ct * sizeof(hard[0]));
+                hard[0] = 0;
+                hard_ct++;
+        }
+        hard[hard_ct] = tri_ct;
+
+        // Soft boundaries inside each hard cluster
+        struct MeshoptCluster* clusters = malloc(tri_ct * sizeof(clusters[0]));
+        uint32_t cluster_ct = 0;
+        for (uint32_t h = 0; h < hard_ct; h++) {
+                uint32_t start = hard[h], end = hard[h + 1];
+
+                misses += cache_size;
+                uint32_t base = misses;
+                for (uint32_t t = start; t < end; t++) {
+                        meshopt_tri_misses(&indices[t * 3], added_at, &misses, cache_size);
+                }
+                float limit = threshold * (misses - base) / (end - start);
+
+                misses += cache_size;
+                base = misses;
+                uint32_t cluster_start = start;
+                for (uint32_t t = start; t < end; t++) {
+                        meshopt_tri_misses(&indices[t * 3], added_at, &misses, cache_size);
+
+                        // Reset the cache at every split, like the GPU would effectively see it
+                        if (t + 1 < end
+                            && (float) (misses - base) / (t + 1 - cluster_start) <= limit) {
+                                uint32_t ct = t + 1 - cluster_start;
+                                clusters[cluster_ct++] = (struct MeshoptCluster){cluster_start, ct, 0};
+                                cluster_start = t + 1;
+                                misses += cache_size;
+                                base = misses;
+                        }
+                }
+                clusters[cluster_ct++] =
+                        (struct MeshoptCluster){cluster_start, end - cluster_start, 0};
+        }
+
+        // Area-weighted centroid of the whole mesh
+        float mesh_center[3] = {0};
+        float mesh_area = 0;
+        for (uint32_t t = 0; t < tri_ct; t++) {
+                const float* p[3];
+                for (int k = 0; k < 3; k++) {
+                        p[k] = (const float*) ((const char*) positions + indices[t * 3 + k] * stride);
+                }
+                float e1[3], e2[3];
+                for (int k = 0; k < 3; k++) {
+                        e1[k] = p[1][k] - p[0][k];
+                        e2[k] = p[2][k] - p[0][k];
+                }
+                float nx = e1[1] * e2[2] - e1[2] * e2[1];
+                float ny = e1[2] * e2[0] - e1[0] * e2[2];
+                float nz = e1[0] * e2[1] - e1[1] * e2[0];
+                float area = sqrtf(nx * nx + ny * ny + nz * nz);
+                for (int k = 0; k < 3; k++) {
+                        mesh_center[k] += area * (p[0][k] + p[1][k] + p[2][k]) / 3;
+                }
+                mesh_area += area;
+        }
+        if (mesh_area > 0) {
+                for (int k = 0; k < 3; k++) mesh_center[k] /= mesh_area;
+        }
+
+        for (uint32_t c = 0; c < cluster_ct; c++) {
+                struct MeshoptCluster* cluster = &clusters[c];
+
+                float center[3] = {0};
+                float normal[3] = {0};
+                float area_sum = 0;
+                for (uint32_t t = cluster->first_tri; t < cluster->first_tri + cluster->tri_ct; t++) {
+                        const float* p[3];
+                        for (int k = 0; k < 3; k++) {
+                                p[k] = (const float*) ((const char*) positions
+                                                       + indices[t * 3 + k] * stride);
+                        }
+                        float e1[3], e2[3];
+                        for (int k = 0; k < 3; k++) {
+                                e1[k] = p[1][k] - p[0][k];
+                                e2[k] = p[2][k] - p[0][k];
+                        }
+                        // Not normalized, so bigger triangles count more
+                        float n[3] = {
+                                e1[1] * e2[2] - e1[2] * e2[1],
+                                e1[2] * e2[0] - e1[0] * e2[2],
+                                e1[0] * e2[1] - e1[1] * e2[0],
+                        };
+                        float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                        for (int k = 0; k < 3; k++) {
+                                normal[k] += n[k];
+                                center[k] += area * (p[0][k] + p[1][k] + p[2][k]) / 3;
+                        }
+                        area_sum += area;
+                }
+
+                float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1]
+                                  + normal[2] * normal[2]);
+                cluster->sort_key = 0;
+                if (area_sum > 0 && len > 0) {
+                        for (int k = 0; k < 3; k++) {
+                                cluster->sort_key += (center[k] / area_sum - mesh_center[k])
+                                                     * (normal[k] / len);
+                        }
+                }
+        }
+
+        qsort(clusters, cluster_ct, sizeof(clusters[0]), meshopt_cluster_cmp);
+
+        uint32_t out_ct = 0;
+        for (uint32_t c = 0; c < cluster_ct; c++) {
+                uint32_t count = clusters[c].tri_ct * 3;
+                memcpy(&dst[out_ct], &indices[clusters[c].first_tri * 3], count * sizeof(dst[0]));
+                out_ct += count;
+        }
+        assert(out_ct == tri_ct * 3);
+
+        free(clusters);
+        free(hard);
+        free(added_at);
+}
+
+// Reorders vertices into the order the index buffer first uses them, so vertex fetches walk
+// through memory linearly. Rewrites `indices` in place and writes the reordered vertices to
+// `dst_vertices`. Unreferenced vertices are dropped; returns the new vertex count.
+uint32_t meshopt_optimize_vfetch(void* dst_vertices, uint32_t* indices, uint32_t index_ct,
+                                 const void* vertices, uint32_t vertex_ct, size_t stride)
+{
+        assert(dst_vertices != vertices);
+
+        uint32_t* remap = malloc(vertex_ct * sizeof(remap[0]));
+        memset(remap, 0xff, vertex_ct * sizeof(remap[0]));
+
+        uint32_t next = 0;
+        for (uint32_t i = 0; i < index_ct; i++) {
+                uint32_t v = indices[i];
+                if (remap[v] == UINT32_MAX) {
+                        remap[v] = next;
+                        memcpy((char*) dst_vertices + next * stride,
+                               (const char*) vertices + v * stride, stride);
+                        next++;
+                }
+                indices[i] = remap[v];
+        }
+
+        free(remap);
+        return next;
+}
+
+#endif // LL_MESHOPT_H
@@ -3,7 +3,14 @@
 
 #include <vulkan/vulkan.h>
 
+#include "file.h"
+
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 struct PipelineSettings {
         VkPipelineVertexInputStateCreateInfo vertex;
@@ -73,29 +80,202 @@ const struct PipelineSettings PIPELINE_SETTINGS_DEFAULT = {
         }
 };
 
-void pipeline_create(VkDevice device, const struct PipelineSettings* settings,
+// What VkPipelineCache data starts with (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+struct PipelineCacheHeader {
+        uint32_t header_size;
+        uint32_t header_version;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint8_t uuid[VK_UUID_SIZE];
+};
+
+// A VkPipelineCache backed by a file. It's seeded from the file if the file was written by the same
+// device and driver, and written back with `pipeline_cache_save`.
+struct PipelineCache {
+        VkDevice device;
+        VkPipelineCache handle;
+        const char* path;
+
+        // Whether the file was there and matched, so pipelines should mostly be cache hits
+        int warm;
+        size_t loaded_size;
+        // Time spent loading the file and creating the cache, and creating pipelines with it
+        double load_s;
+        uint32_t pipeline_ct;
+        double pipeline_s;
+};
+
+static double pipeline_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Drivers are supposed to reject data from another device or driver version themselves, but not
+// all of them are careful about it.
+static int pipeline_cache_matches(const VkPhysicalDeviceProperties* props, size_t size,
+                                  const void* data)
+{
+        struct PipelineCacheHeader header;
+        if (size < sizeof(header)) return 0;
+        memcpy(&header, data, sizeof(header));
+
+        return header.header_size >= sizeof(header) && header.header_size <= size
+                && header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+                && header.vendor_id == props->vendorID && header.device_id == props->deviceID
+                && memcmp(header.uuid, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// `path` doesn't have to exist yet and has to stay valid until `pipeline_cache_destroy`. A file
+// from another device or driver is ignored (and replaced on the next save).
+void pipeline_cache_create(VkPhysicalDevice phys_dev, VkDevice device, const char* path,
+                           struct PipelineCache* cache)
+{
+        bzero(cache, sizeof(*cache));
+        cache->device = device;
+        cache->path = path;
+        double start = pipeline_now();
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(phys_dev, &props);
+
+        size_t size = 0;
+        void* data = NULL;
+        int mapped = file_map(path, &size, &data);
+        if (mapped && pipeline_cache_matches(&props, size, data)) {
+                cache->warm = 1;
+                cache->loaded_size = size;
+        } else if (mapped) {
+                fprintf(stderr, "Pipeline cache %s is from another device or driver, ignoring it\n", path);
+        }
+
+        VkPipelineCacheCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        info.initialDataSize = cache->warm ? size : 0;
+        info.pInitialData = cache->warm ? data : NULL;
+
+        VkResult res = vkCreatePipelineCache(device, &info, NULL, &cache->handle);
+        if (res != VK_SUCCESS && cache->warm) {
+                // Corrupt in some way the header didn't catch, start from scratch
+                cache->warm = 0;
+                cache->loaded_size = 0;
+                info.initialDataSize = 0;
+                info.pInitialData = NULL;
+                res = vkCreatePipelineCache(device, &info, NULL, &cache->handle);
+        }
+        assert(res == VK_SUCCESS);
+
+        if (mapped) file_unmap(size, data);
+        cache->load_s = pipeline_now() - start;
+}
+
+// Writes the cache out atomically, so a crash halfway through never leaves a truncated file
+// behind. Returns 0 on failure.
+int pipeline_cache_save(const struct PipelineCache* cache) {
+        size_t size = 0;
+        VkResult res = vkGetPipelineCacheData(cache->device, cache->handle, &size, NULL);
+        if (res != VK_SUCCESS) return 0;
+
+        void* data = malloc(size > 0 ? size : 1);
+        res = vkGetPipelineCacheData(cache->device, cache->handle, &size, data);
+        int ok = res == VK_SUCCESS && file_write_atomic(cache->path, size, data);
+        free(data);
+
+        if (!ok) fprintf(stderr, "Couldn't write pipeline cache %s\n", cache->path);
+        return ok;
+}
+
+// Saves, then destroys. Pipelines created with the cache stay valid.
+void pipeline_cache_destroy(struct PipelineCache* cache) {
+        pipeline_cache_save(cache);
+        vkDestroyPipelineCache(cache->device, cache->handle, NULL);
+}
+
+// Run once with no file and once with it to compare cold and warm starts.
+void pipeline_cache_stats_print(const struct PipelineCache* cache) {
+        printf("Pipeline cache %s (%s, %zu bytes loaded in %.2f ms): %u pipelines in %.2f ms\n",
+               cache->path, cache->warm ? "warm" : "cold", cache->loaded_size, cache->load_s * 1e3,
+               cache->pipeline_ct, cache->pipeline_s * 1e3);
+}
+
+// Points `info` at `settings` and `stages`, which have to outlive it.
+void pipeline_info_fill(const struct PipelineSettings* settings, uint32_t stage_count,
+                        const VkPipelineShaderStageCreateInfo* stages, VkPipelineLayout layout,
+                        VkRenderPass render_pass, uint32_t subpass, VkGraphicsPipelineCreateInfo* info)
+{
+        bzero(info, sizeof(*info));
+        info->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        info->stageCount = stage_count;
+        info->pStages = stages;
+        info->pVertexInputState = &settings->vertex;
+        info->pInputAssemblyState = &settings->input_assembly;
+        info->pRasterizationState = &settings->rasterizer;
+        info->pViewportState = &settings->viewport;
+        info->pDepthStencilState = &settings->depth;
+        info->pMultisampleState = &settings->multisampling;
+        info->pColorBlendState = &settings->color_blend;
+        info->pDynamicState = &settings->dynamic_state;
+        info->layout = layout;
+        info->renderPass = render_pass;
+        info->subpass = subpass;
+}
+
+// `cache` can be NULL.
+void pipeline_create(VkDevice device, struct PipelineCache* cache, const struct PipelineSettings* settings,
                      uint32_t stage_count, const VkPipelineShaderStageCreateInfo* stages,
                      VkPipelineLayout layout, VkRenderPass render_pass, uint32_t subpass,
                      VkPipeline* pipeline)
 {
-        VkGraphicsPipelineCreateInfo info = {0};
-        info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        info.stageCount = stage_count;
-        info.pStages = stages;
-        info.pVertexInputState = &settings->vertex;
-        info.pInputAssemblyState = &settings->input_assembly;
-        info.pRasterizationState = &settings->rasterizer;
-        info.pViewportState = &settings->viewport;
-        info.pDepthStencilState = &settings->depth;
-        info.pMultisampleState = &settings->multisampling;
-        info.pColorBlendState = &settings->color_blend;
-        info.pDynamicState = &settings->dynamic_state;
+        VkGraphicsPipelineCreateInfo info;
+        pipeline_info_fill(settings, stage_count, stages, layout, render_pass, subpass, &info);
+
+        double start = pipeline_now();
+        VkResult res = vkCreateGraphicsPipelines(device, cache != NULL ? cache->handle : VK_NULL_HANDLE,
+                                                 1, &info, NULL, pipeline);
+        assert(res == VK_SUCCESS);
+
+        if (cache != NULL) {
+                cache->pipeline_ct++;
+                cache->pipeline_s += pipeline_now() - start;
+        }
+}
+
+void pipeline_layout_create(VkDevice device, uint32_t set_layout_ct, const VkDescriptorSetLayout* set_layouts,
+                            uint32_t push_range_ct, const VkPushConstantRange* push_ranges,
+                            VkPipelineLayout* layout)
+{
+        VkPipelineLayoutCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        info.setLayoutCount = set_layout_ct;
+        info.pSetLayouts = set_layouts;
+        info.pushConstantRangeCount = push_range_ct;
+        info.pPushConstantRanges = push_ranges;
+
+        VkResult res = vkCreatePipelineLayout(device, &info, NULL, layout);
+        assert(res == VK_SUCCESS);
+}
+
+// `stage` is a compute stage from load_shader or shader_stage_info. `cache` can be NULL.
+void compute_pipeline_create(VkDevice device, struct PipelineCache* cache,
+                             const VkPipelineShaderStageCreateInfo* stage, VkPipelineLayout layout,
+                             VkPipeline* pipeline)
+{
+        assert(stage->stage == VK_SHADER_STAGE_COMPUTE_BIT);
+
+        VkComputePipelineCreateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        info.stage = *stage;
         info.layout = layout;
-        info.renderPass = render_pass;
-        info.subpass = subpass;
 
-        VkResult res = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, NULL, pipeline);
+        double start = pipeline_now();
+        VkResult res = vkCreateComputePipelines(device, cache != NULL ? cache->handle : VK_NULL_HANDLE,
+                                                1, &info, NULL, pipeline);
         assert(res == VK_SUCCESS);
+
+        if (cache != NULL) {
+                cache->pipeline_ct++;
+                cache->pipeline_s += pipeline_now() - start;
+        }
 }
 
 #endif // LL_PIPELINE_H
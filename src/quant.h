@@ -0,0 +1,322 @@
+#ifndef LL_QUANT_H
+#define LL_QUANT_H
+
+#include <vulkan/vulkan.h>
+
+#include "mesh.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// 16 bytes per vertex instead of the 32 of a MeshVertex:
+//   pos:    R16G16B16A16_UNORM relative to the mesh bounds, or R16G16B16A16_SFLOAT as-is (w unused)
+//   normal: R16G16_SNORM, octahedral
+//   uv:     R16G16_UNORM relative to the mesh's UV range, since UVs often go outside 0..1
+//
+// The shader gets the real values back with `offset + scale * attribute`, using the QuantInfo. For
+// positions that can usually be folded into the model matrix.
+struct QuantVertex {
+        uint16_t pos[4];
+        int16_t normal[2];
+        uint16_t uv[2];
+};
+
+struct QuantInfo {
+        int half_positions;
+        float pos_offset[3];
+        float pos_scale[3];
+        float uv_offset[2];
+        float uv_scale[2];
+};
+
+struct QuantStats {
+        uint32_t vertex_ct;
+        uint64_t bytes_before;
+        uint64_t bytes_after;
+
+        // In model units
+        float pos_max_error;
+        float pos_avg_error;
+        // Max error as a fraction of the bounding box diagonal
+        float pos_rel_error;
+        // Degrees
+        float normal_max_error;
+        float uv_max_error;
+};
+
+const VkVertexInputBindingDescription QUANT_VERTEX_BINDING = {
+        .binding = 0,
+        .stride = sizeof(struct QuantVertex),
+        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+};
+
+const VkVertexInputAttributeDescription QUANT_VERTEX_ATTRIBUTES_UNORM16[] = {
+        {.location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_UNORM,
+         .offset = offsetof(struct QuantVertex, pos)},
+        {.location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM,
+         .offset = offsetof(struct QuantVertex, normal)},
+        {.location = 2, .binding = 0, .format = VK_FORMAT_R16G16_UNORM,
+         .offset = offsetof(struct QuantVertex, uv)},
+};
+
+const VkVertexInputAttributeDescription QUANT_VERTEX_ATTRIBUTES_HALF[] = {
+        {.location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+         .offset = offsetof(struct QuantVertex, pos)},
+        {.location = 1, .binding = 0, .format = VK_FORMAT_R16G16_SNORM,
+         .offset = offsetof(struct QuantVertex, normal)},
+        {.location = 2, .binding = 0, .format = VK_FORMAT_R16G16_UNORM,
+         .offset = offsetof(struct QuantVertex, uv)},
+};
+
+// Drop-in values for PipelineSettings.vertex
+const VkPipelineVertexInputStateCreateInfo QUANT_VERTEX_INPUT_UNORM16 = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &QUANT_VERTEX_BINDING,
+        .vertexAttributeDescriptionCount = sizeof(QUANT_VERTEX_ATTRIBUTES_UNORM16)
+        / sizeof(QUANT_VERTEX_ATTRIBUTES_UNORM16[0]),
+        .pVertexAttributeDescriptions = QUANT_VERTEX_ATTRIBUTES_UNORM16,
+};
+
+const VkPipelineVertexInputStateCreateInfo QUANT_VERTEX_INPUT_HALF = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &QUANT_VERTEX_BINDING,
+        .vertexAttributeDescriptionCount = sizeof(QUANT_VERTEX_ATTRIBUTES_HALF)
+        / sizeof(QUANT_VERTEX_ATTRIBUTES_HALF[0]),
+        .pVertexAttributeDescriptions = QUANT_VERTEX_ATTRIBUTES_HALF,
+};
+
+// Round to nearest even, overflows to infinity
+uint16_t quant_half(float f) {
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+
+        uint32_t sign = (bits >> 16) & 0x8000;
+        int32_t exp = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+        uint32_t mant = bits & 0x7fffff;
+
+        // NaN and infinity
+        if (((bits >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+        if (exp >= 31) return sign | 0x7c00;
+
+        if (exp <= 0) {
+                // Denormal or zero
+                if (exp < -10) return sign;
+                mant |= 0x800000;
+                uint32_t shift = 14 - exp;
+                uint32_t half = mant >> shift;
+                uint32_t rest = mant & ((1u << shift) - 1);
+                uint32_t mid = 1u << (shift - 1);
+                if (rest > mid || (rest == mid && (half & 1))) half++;
+                return sign | half;
+        }
+
+        uint32_t half = sign | (exp << 10) | (mant >> 13);
+        uint32_t rest = mant & 0x1fff;
+        // Carrying into the exponent is exactly right here
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+        return half;
+}
+
+float quant_half_to_float(uint16_t h) {
+        uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+        uint32_t exp = (h >> 10) & 0x1f;
+        uint32_t mant = h & 0x3ff;
+
+        float f;
+        if (exp == 0) {
+                f = ldexpf((float) mant, -24);
+        } else if (exp == 31) {
+                f = mant ? NAN : INFINITY;
+        } else {
+                f = ldexpf((float) (mant | 0x400), (int) exp - 25);
+        }
+
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        bits |= sign;
+        memcpy(&f, &bits, 4);
+        return f;
+}
+
+uint16_t quant_unorm16(float x) {
+        if (x < 0) x = 0;
+        if (x > 1) x = 1;
+        return (uint16_t) (x * 65535.0f + 0.5f);
+}
+
+int16_t quant_snorm16(float x) {
+        if (x < -1) x = -1;
+        if (x > 1) x = 1;
+        return (int16_t) roundf(x * 32767.0f);
+}
+
+// Maps a unit vector onto the octahedron and unfolds it into a square. Works for tangents too.
+void quant_oct_encode(const float* n, int16_t* out) {
+        float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+        if (l1 == 0) {
+                out[0] = out[1] = 0;
+                return;
+        }
+
+        float x = n[0] / l1, y = n[1] / l1;
+        if (n[2] < 0) {
+                float fx = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+                float fy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+                x = fx;
+                y = fy;
+        }
+
+        out[0] = quant_snorm16(x);
+        out[1] = quant_snorm16(y);
+}
+
+void quant_oct_decode(const int16_t* in, float* n) {
+        float x = fmaxf(in[0] / 32767.0f, -1), y = fmaxf(in[1] / 32767.0f, -1);
+        float z = 1 - fabsf(x) - fabsf(y);
+        if (z < 0) {
+                float fx = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+                float fy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+                x = fx;
+                y = fy;
+        }
+
+        float len = sqrtf(x * x + y * y + z * z);
+        n[0] = x / len;
+        n[1] = y / len;
+        n[2] = z / len;
+}
+
+// `out` needs room for `vertex_ct` vertices. `stats` can be NULL.
+void quant_vertices(const struct MeshVertex* vertices, uint32_t vertex_ct, int half_positions,
+                    struct QuantVertex* out, struct QuantInfo* info, struct QuantStats* stats)
+{
+        bzero(info, sizeof(*info));
+        info->half_positions = half_positions;
+
+        float pos_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, pos_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+        float uv_min[2] = {FLT_MAX, FLT_MAX}, uv_max[2] = {-FLT_MAX, -FLT_MAX};
+        for (uint32_t i = 0; i < vertex_ct; i++) {
+                for (int k = 0; k < 3; k++) {
+                        pos_min[k] = fminf(pos_min[k], vertices[i].pos[k]);
+                        pos_max[k] = fmaxf(pos_max[k], vertices[i].pos[k]);
+                }
+                for (int k = 0; k < 2; k++) {
+                        uv_min[k] = fminf(uv_min[k], vertices[i].uv[k]);
+                        uv_max[k] = fmaxf(uv_max[k], vertices[i].uv[k]);
+                }
+        }
+        if (vertex_ct == 0) {
+                memset(pos_min, 0, sizeof(pos_min));
+                memset(pos_max, 0, sizeof(pos_max));
+                memset(uv_min, 0, sizeof(uv_min));
+                memset(uv_max, 0, sizeof(uv_max));
+        }
+
+        for (int k = 0; k < 3; k++) {
+                info->pos_offset[k] = half_positions ? 0 : pos_min[k];
+                info->pos_scale[k] = half_positions ? 1 : pos_max[k] - pos_min[k];
+        }
+        for (int k = 0; k < 2; k++) {
+                info->uv_offset[k] = uv_min[k];
+                info->uv_scale[k] = uv_max[k] - uv_min[k];
+        }
+
+        if (stats != NULL) {
+                bzero(stats, sizeof(*stats));
+                stats->vertex_ct = vertex_ct;
+                stats->bytes_before = (uint64_t) vertex_ct * sizeof(struct MeshVertex);
+                stats->bytes_after = (uint64_t) vertex_ct * sizeof(struct QuantVertex);
+        }
+
+        double pos_error_sum = 0;
+        for (uint32_t i = 0; i < vertex_ct; i++) {
+                const struct MeshVertex* v = &vertices[i];
+                struct QuantVertex* q = &out[i];
+
+                for (int k = 0; k < 3; k++) {
+                        if (half_positions) {
+                                q->pos[k] = quant_half(v->pos[k]);
+                        } else {
+                                float s = info->pos_scale[k];
+                                q->pos[k] = quant_unorm16(s > 0 ? (v->pos[k] - pos_min[k]) / s : 0);
+                        }
+                }
+                q->pos[3] = half_positions ? quant_half(1.0f) : 65535;
+                quant_oct_encode(v->normal, q->normal);
+                for (int k = 0; k < 2; k++) {
+                        float s = info->uv_scale[k];
+                        q->uv[k] = quant_unorm16(s > 0 ? (v->uv[k] - uv_min[k]) / s : 0);
+                }
+
+                if (stats == NULL) continue;
+
+                float pos_sq = 0;
+                for (int k = 0; k < 3; k++) {
+                        float back = half_positions
+                                ? quant_half_to_float(q->pos[k])
+                                : info->pos_offset[k] + info->pos_scale[k] * (q->pos[k] / 65535.0f);
+                        pos_sq += (back - v->pos[k]) * (back - v->pos[k]);
+                }
+                float pos_error = sqrtf(pos_sq);
+                pos_error_sum += pos_error;
+                stats->pos_max_error = fmaxf(stats->pos_max_error, pos_error);
+
+                float n[3];
+                quant_oct_decode(q->normal, n);
+                float len = sqrtf(v->normal[0] * v->normal[0] + v->normal[1] * v->normal[1]
+                                  + v->normal[2] * v->normal[2]);
+                if (len > 0) {
+                        float d = (n[0] * v->normal[0] + n[1] * v->normal[1] + n[2] * v->normal[2])
+                                / len;
+                        float angle = acosf(fminf(fmaxf(d, -1), 1)) * 57.2957795f;
+                        stats->normal_max_error = fmaxf(stats->normal_max_error, angle);
+                }
+
+                for (int k = 0; k < 2; k++) {
+                        float back = info->uv_offset[k] + info->uv_scale[k] * (q->uv[k] / 65535.0f);
+                        stats->uv_max_error = fmaxf(stats->uv_max_error, fabsf(back - v->uv[k]));
+                }
+        }
+
+        if (stats != NULL && vertex_ct > 0) {
+                stats->pos_avg_error = pos_error_sum / vertex_ct;
+                float diag = sqrtf((pos_max[0] - pos_min[0]) * (pos_max[0] - pos_min[0])
+                                   + (pos_max[1] - pos_min[1]) * (pos_max[1] - pos_min[1])
+                                   + (pos_max[2] - pos_min[2]) * (pos_max[2] - pos_min[2]));
+                stats->pos_rel_error = diag > 0 ? stats->pos_max_error / diag : 0;
+        }
+}
+
+void quant_stats_print(const char* name, const struct QuantStats* stats) {
+        printf("%s: %u vertices, %.2f MB -> %.2f MB (%.0f%% saved)\n", name, stats->vertex_ct,
+               stats->bytes_before / 1e6, stats->bytes_after / 1e6,
+               stats->bytes_before > 0 ? 100.0 * (1.0 - (double) stats->bytes_after / stats->bytes_before) : 0.0);
+        printf("  position error max %g (%.5f%% of diagonal) avg %g, normal max %.3f deg, uv max %g\n",
+               stats->pos_max_error, stats->pos_rel_error * 100, stats->pos_avg_error,
+               stats->normal_max_error, stats->uv_max_error);
+}
+
+// Quantizes a mesh's vertices and uploads them to a device-local vertex buffer. Use
+// QUANT_VERTEX_INPUT_UNORM16 or QUANT_VERTEX_INPUT_HALF (matching `half_positions`) for the
+// pipeline, and the index buffer from `mesh_upload` as usual.
+void quant_mesh_upload(struct MemAllocator* allocator, VkDevice device, struct CbufPool* cbufs,
+                       const struct Mesh* mesh, int half_positions,
+                       struct Buffer* vertex_buf, struct QuantInfo* info, struct QuantStats* stats)
+{
+        uint32_t vertex_ct = mesh->header->vertex_ct;
+        struct QuantVertex* quantized = malloc((vertex_ct > 0 ? vertex_ct : 1) * sizeof(quantized[0]));
+        quant_vertices(mesh->vertices, vertex_ct, half_positions, quantized, info, stats);
+
+        buffer_create_staged(allocator, device, cbufs,
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             vertex_ct * sizeof(quantized[0]), quantized, vertex_buf, NULL);
+
+        free(quantized);
+}
+
+#endif // LL_QUANT_H
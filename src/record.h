@@ -0,0 +1,204 @@
+#ifndef LL_RECORD_H
+#define LL_RECORD_H
+
+#include <vulkan/vulkan.h>
+
+#include "cbuf.h"
+#include "jobs.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Records `ct` items starting at `first` into `cbuf`, which is already begun as a secondary inside
+// the render pass. Nothing is inherited from the primary except the render pass, so bind the
+// pipeline, sets and dynamic state (viewport, scissor) again.
+typedef void (*RecordFn)(VkCommandBuffer cbuf, uint32_t first, uint32_t ct, void* data);
+
+// A command pool for one worker and one frame, plus the secondaries allocated from it so far. They
+// get reused every time the frame comes around.
+struct RecorderPool {
+        VkCommandPool cpool;
+        uint32_t used;
+        uint32_t ct;
+        uint32_t cap;
+        VkCommandBuffer* cbufs;
+};
+
+struct RecorderChunk {
+        struct Recorder* recorder;
+        uint32_t first;
+        uint32_t ct;
+        VkCommandBuffer cbuf;
+};
+
+// Splits a draw list into chunks, records each chunk into a secondary command buffer on a Jobs
+// pool and executes them all from the primary in order. Every worker has its own command pool per
+// frame, so workers never share a pool and a frame's pools are reset in one go instead of freeing
+// buffers.
+struct Recorder {
+        VkDevice device;
+        struct Jobs* jobs;
+        uint32_t frame_ct;
+        uint32_t frame;
+
+        // frame_ct * jobs->thread_ct, indexed by [frame * thread_ct + worker]
+        struct RecorderPool* pools;
+
+        // State for the current `recorder_record` call
+        VkRenderPass rpass;
+        uint32_t subpass;
+        VkFramebuffer framebuffer;
+        RecordFn fn;
+        void* data;
+        uint32_t chunk_cap;
+        struct RecorderChunk* chunks;
+        // The chunks' secondaries in order, for vkCmdExecuteCommands. Same capacity as `chunks`.
+        VkCommandBuffer* cbufs;
+
+        pthread_mutex_t lock;
+        pthread_cond_t done;
+        uint32_t remaining;
+
+        // Wall time of the last `recorder_record`, from splitting to vkCmdExecuteCommands
+        double last_record_s;
+};
+
+void recorder_create(VkDevice device, uint32_t queue_fam, struct Jobs* jobs, uint32_t frame_ct,
+                     struct Recorder* rec)
+{
+        bzero(rec, sizeof(*rec));
+        rec->device = device;
+        rec->jobs = jobs;
+        rec->frame_ct = frame_ct;
+
+        uint32_t pool_ct = frame_ct * jobs->thread_ct;
+        rec->pools = calloc(pool_ct, sizeof(rec->pools[0]));
+        for (uint32_t i = 0; i < pool_ct; i++) {
+                // Only ever reset as a whole
+                VkCommandPoolCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                info.queueFamilyIndex = queue_fam;
+
+                VkResult res = vkCreateCommandPool(device, &info, NULL, &rec->pools[i].cpool);
+                assert(res == VK_SUCCESS);
+        }
+
+        pthread_mutex_init(&rec->lock, NULL);
+        pthread_cond_init(&rec->done, NULL);
+}
+
+void recorder_destroy(struct Recorder* rec) {
+        uint32_t pool_ct = rec->frame_ct * rec->jobs->thread_ct;
+        for (uint32_t i = 0; i < pool_ct; i++) {
+                vkDestroyCommandPool(rec->device, rec->pools[i].cpool, NULL);
+                free(rec->pools[i].cbufs);
+        }
+        free(rec->pools);
+        free(rec->chunks);
+        free(rec->cbufs);
+
+        pthread_mutex_destroy(&rec->lock);
+        pthread_cond_destroy(&rec->done);
+}
+
+// Moves to `frame` and resets its pools. The GPU must be done with everything recorded the last
+// time this frame came around, i.e. wait on that frame's fence first.
+void recorder_frame_begin(struct Recorder* rec, uint32_t frame) {
+        assert(frame < rec->frame_ct);
+        rec->frame = frame;
+
+        for (uint32_t i = 0; i < rec->jobs->thread_ct; i++) {
+                struct RecorderPool* pool = &rec->pools[frame * rec->jobs->thread_ct + i];
+                if (pool->used == 0) continue;
+
+                VkResult res = vkResetCommandPool(rec->device, pool->cpool, 0);
+                assert(res == VK_SUCCESS);
+                pool->used = 0;
+        }
+}
+
+static VkCommandBuffer recorder_pool_get(VkDevice device, struct RecorderPool* pool) {
+        if (pool->used == pool->ct) {
+                if (pool->ct == pool->cap) {
+                        pool->cap = pool->cap == 0 ? 8 : pool->cap * 2;
+                        pool->cbufs = realloc(pool->cbufs, pool->cap * sizeof(pool->cbufs[0]));
+                }
+                cbuf_alloc_secondary(device, pool->cpool, &pool->cbufs[pool->ct++]);
+        }
+        return pool->cbufs[pool->used++];
+}
+
+static void recorder_chunk_job(void* data, uint32_t worker) {
+        struct RecorderChunk* chunk = data;
+        struct Recorder* rec = chunk->recorder;
+
+        struct RecorderPool* pool = &rec->pools[rec->frame * rec->jobs->thread_ct + worker];
+        chunk->cbuf = recorder_pool_get(rec->device, pool);
+
+        cbuf_begin_secondary(chunk->cbuf, rec->rpass, rec->subpass, rec->framebuffer);
+        rec->fn(chunk->cbuf, chunk->first, chunk->ct, rec->data);
+        VkResult res = vkEndCommandBuffer(chunk->cbuf);
+        assert(res == VK_SUCCESS);
+
+        pthread_mutex_lock(&rec->lock);
+        rec->remaining--;
+        if (rec->remaining == 0) pthread_cond_signal(&rec->done);
+        pthread_mutex_unlock(&rec->lock);
+}
+
+// Records `item_ct` items with `fn`, split into `chunk_ct` secondaries, and executes them from
+// `primary`. The primary has to be inside `subpass` of `rpass`, begun with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. Draw order is the same as recording everything
+// in one go. A few chunks per worker balances better than one, since the items rarely cost the same.
+void recorder_record(struct Recorder* rec, VkCommandBuffer primary, VkRenderPass rpass,
+                     uint32_t subpass, VkFramebuffer framebuffer, uint32_t item_ct,
+                     uint32_t chunk_ct, RecordFn fn, void* data)
+{
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (chunk_ct > item_ct) chunk_ct = item_ct;
+        if (chunk_ct == 0) return;
+
+        rec->rpass = rpass;
+        rec->subpass = subpass;
+        rec->framebuffer = framebuffer;
+        rec->fn = fn;
+        rec->data = data;
+
+        if (chunk_ct > rec->chunk_cap) {
+                rec->chunk_cap = chunk_ct;
+                rec->chunks = realloc(rec->chunks, chunk_ct * sizeof(rec->chunks[0]));
+                rec->cbufs = realloc(rec->cbufs, chunk_ct * sizeof(rec->cbufs[0]));
+        }
+
+        rec->remaining = chunk_ct;
+        uint32_t per_chunk = item_ct / chunk_ct, extra = item_ct % chunk_ct;
+        uint32_t first = 0;
+        for (uint32_t i = 0; i < chunk_ct; i++) {
+                struct RecorderChunk* chunk = &rec->chunks[i];
+                chunk->recorder = rec;
+                chunk->first = first;
+                chunk->ct = per_chunk + (i < extra ? 1 : 0);
+                first += chunk->ct;
+                jobs_push(rec->jobs, recorder_chunk_job, chunk);
+        }
+
+        // Not jobs_wait, the pool might be busy with something else too
+        pthread_mutex_lock(&rec->lock);
+        while (rec->remaining > 0) pthread_cond_wait(&rec->done, &rec->lock);
+        pthread_mutex_unlock(&rec->lock);
+
+        for (uint32_t i = 0; i < chunk_ct; i++) rec->cbufs[i] = rec->chunks[i].cbuf;
+        vkCmdExecuteCommands(primary, chunk_ct, rec->cbufs);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        rec->last_record_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+#endif // LL_RECORD_H
@@ -0,0 +1,483 @@
+#ifndef LL_REFLECT_H
+#define LL_REFLECT_H
+
+#include <vulkan/vulkan.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Just enough of the SPIR-V spec to find out what a module binds. Numbers are from the SPIR-V
+// 1.x specification.
+#define SPV_MAGIC 0x07230203
+#define SPV_OP_ENTRY_POINT 15
+#define SPV_OP_EXECUTION_MODE 16
+#define SPV_OP_TYPE_INT 21
+#define SPV_OP_TYPE_FLOAT 22
+#define SPV_OP_TYPE_VECTOR 23
+#define SPV_OP_TYPE_MATRIX 24
+#define SPV_OP_TYPE_IMAGE 25
+#define SPV_OP_TYPE_SAMPLER 26
+#define SPV_OP_TYPE_SAMPLED_IMAGE 27
+#define SPV_OP_TYPE_ARRAY 28
+#define SPV_OP_TYPE_RUNTIME_ARRAY 29
+#define SPV_OP_TYPE_STRUCT 30
+#define SPV_OP_TYPE_POINTER 32
+#define SPV_OP_CONSTANT 43
+#define SPV_OP_SPEC_CONSTANT 50
+#define SPV_OP_VARIABLE 59
+#define SPV_OP_DECORATE 71
+#define SPV_OP_MEMBER_DECORATE 72
+
+#define SPV_DECORATION_BUFFER_BLOCK 3
+#define SPV_DECORATION_ARRAY_STRIDE 6
+#define SPV_DECORATION_MATRIX_STRIDE 7
+#define SPV_DECORATION_BUILTIN 11
+#define SPV_DECORATION_LOCATION 30
+#define SPV_DECORATION_BINDING 33
+#define SPV_DECORATION_DESCRIPTOR_SET 34
+#define SPV_DECORATION_OFFSET 35
+
+#define SPV_STORAGE_UNIFORM_CONSTANT 0
+#define SPV_STORAGE_INPUT 1
+#define SPV_STORAGE_UNIFORM 2
+#define SPV_STORAGE_PUSH_CONSTANT 9
+#define SPV_STORAGE_STORAGE_BUFFER 12
+
+#define SPV_EXECUTION_MODE_LOCAL_SIZE 17
+
+#define SPV_DIM_BUFFER 5
+#define SPV_DIM_SUBPASS_DATA 6
+
+#define REFLECT_NONE UINT32_MAX
+
+struct ReflectBinding {
+        uint32_t set;
+        uint32_t binding;
+        VkDescriptorType type;
+        // 0 for runtime-sized arrays. Arrays sized by a spec constant get its default value.
+        uint32_t count;
+};
+
+struct ReflectInput {
+        uint32_t location;
+        // VK_FORMAT_UNDEFINED for anything that isn't 32-bit scalars or vectors
+        VkFormat format;
+};
+
+// What one module's entry point binds. Bindings are sorted by set then binding, inputs by location.
+// Inputs are only filled in for vertex shaders.
+struct Reflection {
+        VkShaderStageFlagBits stage;
+        uint32_t binding_ct;
+        struct ReflectBinding* bindings;
+        // push_size is 0 if there are no push constants
+        uint32_t push_offset;
+        uint32_t push_size;
+        uint32_t input_ct;
+        struct ReflectInput* inputs;
+        // Compute only. All 0 if the size comes from specialization constants.
+        uint32_t local_size[3];
+};
+
+// Everything we need to know about one result id
+struct ReflectId {
+        // Instruction that defines the id, 0 if nothing does (yet)
+        uint32_t op;
+        uint32_t word;
+
+        uint32_t set;
+        uint32_t binding;
+        uint32_t location;
+        uint32_t array_stride;
+        uint8_t buffer_block;
+        uint8_t builtin;
+};
+
+struct ReflectMember {
+        uint32_t type;
+        uint32_t member;
+        uint32_t offset;
+        uint32_t matrix_stride;
+};
+
+struct ReflectParse {
+        const uint32_t* code;
+        uint32_t bound;
+        struct ReflectId* ids;
+        uint32_t member_ct;
+        uint32_t member_cap;
+        struct ReflectMember* members;
+};
+
+static void reflect_fail(const char* what) {
+        fprintf(stderr, "Can't reflect SPIR-V: %s\n", what);
+        exit(1);
+}
+
+static struct ReflectId* reflect_id(struct ReflectParse* p, uint32_t id) {
+        if (id >= p->bound) reflect_fail("id out of bounds");
+        return &p->ids[id];
+}
+
+static struct ReflectMember* reflect_member(struct ReflectParse* p, uint32_t type, uint32_t member) {
+        for (uint32_t i = 0; i < p->member_ct; i++) {
+                if (p->members[i].type == type && p->members[i].member == member) {
+                        return &p->members[i];
+                }
+        }
+
+        if (p->member_ct == p->member_cap) {
+                p->member_cap = p->member_cap == 0 ? 32 : p->member_cap * 2;
+                p->members = realloc(p->members, p->member_cap * sizeof(p->members[0]));
+        }
+        struct ReflectMember* m = &p->members[p->member_ct++];
+        m->type = type;
+        m->member = member;
+        m->offset = 0;
+        m->matrix_stride = 0;
+        return m;
+}
+
+// The operands of the instruction that defines `id`, after the opcode word
+static const uint32_t* reflect_def(struct ReflectParse* p, uint32_t id, uint32_t op) {
+        struct ReflectId* def = reflect_id(p, id);
+        if (def->op != op) reflect_fail("unexpected type");
+        return &p->code[def->word + 1];
+}
+
+// Spec constants give their default value, since we don't know what the pipeline will set
+static uint32_t reflect_constant(struct ReflectParse* p, uint32_t id) {
+        struct ReflectId* def = reflect_id(p, id);
+        if (def->op == SPV_OP_SPEC_CONSTANT) return p->code[def->word + 3];
+        return reflect_def(p, id, SPV_OP_CONSTANT)[2];
+}
+
+// Byte size of a type in a block, with explicit layout. Runtime arrays count as 0.
+static uint32_t reflect_type_size(struct ReflectParse* p, uint32_t type, uint32_t matrix_stride) {
+        struct ReflectId* def = reflect_id(p, type);
+        const uint32_t* ops = &p->code[def->word + 1];
+
+        switch (def->op) {
+        case SPV_OP_TYPE_INT:
+        case SPV_OP_TYPE_FLOAT:
+                return ops[1] / 8;
+        case SPV_OP_TYPE_VECTOR:
+                return ops[2] * reflect_type_size(p, ops[1], 0);
+        case SPV_OP_TYPE_MATRIX: {
+                uint32_t col = matrix_stride ? matrix_stride : reflect_type_size(p, ops[1], 0);
+                return ops[2] * col;
+        }
+        case SPV_OP_TYPE_ARRAY: {
+                uint32_t stride = def->array_stride;
+                if (stride == 0) stride = reflect_type_size(p, ops[1], matrix_stride);
+                return reflect_constant(p, ops[2]) * stride;
+        }
+        case SPV_OP_TYPE_RUNTIME_ARRAY:
+                return 0;
+        case SPV_OP_TYPE_STRUCT: {
+                uint32_t member_ct = (p->code[def->word] >> 16) - 2;
+                uint32_t size = 0;
+                for (uint32_t i = 0; i < member_ct; i++) {
+                        struct ReflectMember* m = reflect_member(p, type, i);
+                        uint32_t end = m->offset + reflect_type_size(p, ops[1 + i], m->matrix_stride);
+                        if (end > size) size = end;
+                }
+                return size;
+        }
+        default:
+                reflect_fail("unsupported type in a block");
+                return 0;
+        }
+}
+
+static VkDescriptorType reflect_descriptor_type(struct ReflectParse* p, uint32_t type,
+                                                uint32_t storage)
+{
+        struct ReflectId* def = reflect_id(p, type);
+        const uint32_t* ops = &p->code[def->word + 1];
+
+        switch (def->op) {
+        case SPV_OP_TYPE_SAMPLER:
+                return VK_DESCRIPTOR_TYPE_SAMPLER;
+        case SPV_OP_TYPE_SAMPLED_IMAGE:
+                return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case SPV_OP_TYPE_IMAGE: {
+                // ops[2] is Dim, ops[6] is Sampled: 1 means used with a sampler, 2 means storage
+                if (ops[2] == SPV_DIM_BUFFER) {
+                        return ops[6] == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                           : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+                }
+                if (ops[2] == SPV_DIM_SUBPASS_DATA) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+                return ops[6] == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                   : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        }
+        case SPV_OP_TYPE_STRUCT:
+                // Older SPIR-V marks storage buffers as Uniform + BufferBlock
+                if (storage == SPV_STORAGE_STORAGE_BUFFER || def->buffer_block) {
+                        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                }
+                return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        default:
+                reflect_fail("unsupported descriptor type");
+                return 0;
+        }
+}
+
+// 32-bit scalars and vectors only. Same trick as dpool_create: the R32 formats go UINT, SINT,
+// SFLOAT for each component count, so we can count our way there.
+static VkFormat reflect_input_format(struct ReflectParse* p, uint32_t type) {
+        struct ReflectId* def = reflect_id(p, type);
+        const uint32_t* ops = &p->code[def->word + 1];
+
+        uint32_t comp_ct = 1;
+        if (def->op == SPV_OP_TYPE_VECTOR) {
+                comp_ct = ops[2];
+                def = reflect_id(p, ops[1]);
+                ops = &p->code[def->word + 1];
+        }
+
+        if (def->op != SPV_OP_TYPE_FLOAT && def->op != SPV_OP_TYPE_INT) return VK_FORMAT_UNDEFINED;
+        if (comp_ct > 4 || ops[1] != 32) return VK_FORMAT_UNDEFINED;
+        uint32_t kind = def->op == SPV_OP_TYPE_FLOAT ? 2 : ops[2] ? 1 : 0;
+
+        return (VkFormat) (VK_FORMAT_R32_UINT + 3 * (comp_ct - 1) + kind);
+}
+
+static void reflect_add_input(struct Reflection* refl, uint32_t* cap, uint32_t location,
+                              VkFormat format)
+{
+        if (refl->input_ct == *cap) {
+                *cap = *cap == 0 ? 8 : *cap * 2;
+                refl->inputs = realloc(refl->inputs, *cap * sizeof(refl->inputs[0]));
+        }
+        refl->inputs[refl->input_ct].location = location;
+        refl->inputs[refl->input_ct].format = format;
+        refl->input_ct++;
+}
+
+static int reflect_binding_cmp(const void* a, const void* b) {
+        const struct ReflectBinding* x = a;
+        const struct ReflectBinding* y = b;
+        if (x->set != y->set) return x->set < y->set ? -1 : 1;
+        if (x->binding != y->binding) return x->binding < y->binding ? -1 : 1;
+        return 0;
+}
+
+static int reflect_input_cmp(const void* a, const void* b) {
+        const struct ReflectInput* x = a;
+        const struct ReflectInput* y = b;
+        return x->location < y->location ? -1 : x->location > y->location;
+}
+
+// Reflects the first entry point of a module. Everything declared counts as used, whether the
+// entry point touches it or not, which is what glslang gives you anyway.
+void reflect_spirv(size_t size, const uint32_t* code, struct Reflection* refl) {
+        bzero(refl, sizeof(*refl));
+        uint32_t word_ct = size / 4;
+        if (word_ct < 5 || code[0] != SPV_MAGIC) reflect_fail("not a SPIR-V module");
+
+        struct ReflectParse p = {0};
+        p.code = code;
+        p.bound = code[3];
+        p.ids = malloc(p.bound * sizeof(p.ids[0]));
+        for (uint32_t i = 0; i < p.bound; i++) {
+                p.ids[i] = (struct ReflectId) {0};
+                p.ids[i].set = REFLECT_NONE;
+                p.ids[i].binding = REFLECT_NONE;
+                p.ids[i].location = REFLECT_NONE;
+        }
+
+        // Execution model to stage, in SPIR-V order
+        const VkShaderStageFlagBits stages[] = {
+                VK_SHADER_STAGE_VERTEX_BIT,
+                VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT,
+                VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+                VK_SHADER_STAGE_GEOMETRY_BIT,
+                VK_SHADER_STAGE_FRAGMENT_BIT,
+                VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+
+        // One pass to note where every id is defined and how it's decorated. Decorations come
+        // before the types they decorate, so the actual reflection happens after.
+        uint32_t var_ct = 0;
+        for (uint32_t w = 5; w < word_ct;) {
+                uint32_t op = code[w] & 0xffff;
+                uint32_t len = code[w] >> 16;
+                if (len == 0 || w + len > word_ct) reflect_fail("truncated instruction");
+                const uint32_t* ops = &code[w + 1];
+
+                switch (op) {
+                case SPV_OP_ENTRY_POINT:
+                        if (refl->stage != 0) break;
+                        if (ops[0] >= sizeof(stages) / sizeof(stages[0])) {
+                                reflect_fail("unsupported execution model");
+                        }
+                        refl->stage = stages[ops[0]];
+                        break;
+                case SPV_OP_EXECUTION_MODE:
+                        if (len >= 6 && ops[1] == SPV_EXECUTION_MODE_LOCAL_SIZE) {
+                                memcpy(refl->local_size, &ops[2], sizeof(refl->local_size));
+                        }
+                        break;
+                case SPV_OP_DECORATE: {
+                        if (len < 3) break;
+                        struct ReflectId* id = reflect_id(&p, ops[0]);
+                        uint32_t value = len > 3 ? ops[2] : 0;
+                        if (ops[1] == SPV_DECORATION_DESCRIPTOR_SET) id->set = value;
+                        else if (ops[1] == SPV_DECORATION_BINDING) id->binding = value;
+                        else if (ops[1] == SPV_DECORATION_LOCATION) id->location = value;
+                        else if (ops[1] == SPV_DECORATION_ARRAY_STRIDE) id->array_stride = value;
+                        else if (ops[1] == SPV_DECORATION_BUFFER_BLOCK) id->buffer_block = 1;
+                        else if (ops[1] == SPV_DECORATION_BUILTIN) id->builtin = 1;
+                        break;
+                }
+                case SPV_OP_MEMBER_DECORATE:
+                        if (len < 5) break;
+                        if (ops[2] == SPV_DECORATION_OFFSET) {
+                                reflect_member(&p, ops[0], ops[1])->offset = ops[3];
+                        } else if (ops[2] == SPV_DECORATION_MATRIX_STRIDE) {
+                                reflect_member(&p, ops[0], ops[1])->matrix_stride = ops[3];
+                        }
+                        break;
+                case SPV_OP_TYPE_INT:
+                case SPV_OP_TYPE_FLOAT:
+                case SPV_OP_TYPE_VECTOR:
+                case SPV_OP_TYPE_MATRIX:
+                case SPV_OP_TYPE_IMAGE:
+                case SPV_OP_TYPE_SAMPLER:
+                case SPV_OP_TYPE_SAMPLED_IMAGE:
+                case SPV_OP_TYPE_ARRAY:
+                case SPV_OP_TYPE_RUNTIME_ARRAY:
+                case SPV_OP_TYPE_STRUCT:
+                case SPV_OP_TYPE_POINTER: {
+                        struct ReflectId* id = reflect_id(&p, ops[0]);
+                        id->op = op;
+                        id->word = w;
+                        break;
+                }
+                case SPV_OP_CONSTANT:
+                case SPV_OP_SPEC_CONSTANT:
+                case SPV_OP_VARIABLE: {
+                        // Result id comes after the result type for these
+                        struct ReflectId* id = reflect_id(&p, ops[1]);
+                        id->op = op;
+                        id->word = w;
+                        if (op == SPV_OP_VARIABLE) var_ct++;
+                        break;
+                }
+                }
+
+                w += len;
+        }
+        if (refl->stage == 0) reflect_fail("no entry point");
+
+        uint32_t binding_cap = 0, input_cap = 0;
+        for (uint32_t i = 0; i < p.bound && var_ct > 0; i++) {
+                struct ReflectId* var = &p.ids[i];
+                if (var->op != SPV_OP_VARIABLE) continue;
+                var_ct--;
+
+                const uint32_t* ops = &code[var->word + 1];
+                uint32_t storage = ops[2];
+                // OpTypePointer is the storage class, then the pointee
+                uint32_t type = reflect_def(&p, ops[0], SPV_OP_TYPE_POINTER)[2];
+
+                if (storage == SPV_STORAGE_PUSH_CONSTANT) {
+                        reflect_def(&p, type, SPV_OP_TYPE_STRUCT);
+                        uint32_t member_ct = (code[p.ids[type].word] >> 16) - 2;
+                        if (member_ct == 0) continue;
+
+                        uint32_t begin = UINT32_MAX;
+                        for (uint32_t j = 0; j < member_ct; j++) {
+                                uint32_t offset = reflect_member(&p, type, j)->offset;
+                                if (offset < begin) begin = offset;
+                        }
+                        refl->push_offset = begin;
+                        refl->push_size = reflect_type_size(&p, type, 0) - begin;
+                } else if (storage == SPV_STORAGE_INPUT) {
+                        if (refl->stage != VK_SHADER_STAGE_VERTEX_BIT) continue;
+                        if (var->builtin || var->location == REFLECT_NONE) continue;
+
+                        // Matrices take one location per column
+                        struct ReflectId* def = reflect_id(&p, type);
+                        if (def->op == SPV_OP_TYPE_MATRIX) {
+                                const uint32_t* mat = &code[def->word + 1];
+                                VkFormat format = reflect_input_format(&p, mat[1]);
+                                for (uint32_t j = 0; j < mat[2]; j++) {
+                                        reflect_add_input(refl, &input_cap, var->location + j,
+                                                          format);
+                                }
+                        } else {
+                                reflect_add_input(refl, &input_cap, var->location,
+                                                  reflect_input_format(&p, type));
+                        }
+                } else if (storage == SPV_STORAGE_UNIFORM_CONSTANT || storage == SPV_STORAGE_UNIFORM
+                           || storage == SPV_STORAGE_STORAGE_BUFFER) {
+                        if (var->set == REFLECT_NONE || var->binding == REFLECT_NONE) continue;
+
+                        uint32_t count = 1;
+                        struct ReflectId* def = reflect_id(&p, type);
+                        if (def->op == SPV_OP_TYPE_ARRAY) {
+                                count = reflect_constant(&p, code[def->word + 3]);
+                                type = code[def->word + 2];
+                        } else if (def->op == SPV_OP_TYPE_RUNTIME_ARRAY) {
+                                count = 0;
+                                type = code[def->word + 2];
+                        }
+
+                        if (refl->binding_ct == binding_cap) {
+                                binding_cap = binding_cap == 0 ? 8 : binding_cap * 2;
+                                refl->bindings = realloc(refl->bindings,
+                                                         binding_cap * sizeof(refl->bindings[0]));
+                        }
+                        struct ReflectBinding* b = &refl->bindings[refl->binding_ct++];
+                        b->set = var->set;
+                        b->binding = var->binding;
+                        b->type = reflect_descriptor_type(&p, type, storage);
+                        b->count = count;
+                }
+        }
+
+        if (refl->binding_ct > 0) {
+                qsort(refl->bindings, refl->binding_ct, sizeof(refl->bindings[0]),
+                      reflect_binding_cmp);
+        }
+        if (refl->input_ct > 0) {
+                qsort(refl->inputs, refl->input_ct, sizeof(refl->inputs[0]), reflect_input_cmp);
+        }
+
+        free(p.ids);
+        free(p.members);
+}
+
+void reflect_destroy(struct Reflection* refl) {
+        free(refl->bindings);
+        free(refl->inputs);
+}
+
+// Checks that every vertex shader input has an attribute. Prints the missing locations and
+// returns 0 if any are missing. Formats aren't compared, since R16G16_SNORM feeding a vec2 is fine.
+int reflect_vertex_input_check(const struct Reflection* refl,
+                               const VkPipelineVertexInputStateCreateInfo* info)
+{
+        int ok = 1;
+        for (uint32_t i = 0; i < refl->input_ct; i++) {
+                int found = 0;
+                for (uint32_t j = 0; j < info->vertexAttributeDescriptionCount; j++) {
+                        const VkVertexInputAttributeDescription* attr =
+                                &info->pVertexAttributeDescriptions[j];
+                        if (attr->location == refl->inputs[i].location) found = 1;
+                }
+                if (!found) {
+                        fprintf(stderr, "No vertex attribute for location %u\n",
+                                refl->inputs[i].location);
+                        ok = 0;
+                }
+        }
+        return ok;
+}
+
+#endif // LL_REFLECT_H
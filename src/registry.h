@@ -0,0 +1,376 @@
+#ifndef LL_REGISTRY_H
+#define LL_REGISTRY_H
+
+#include <vulkan/vulkan.h>
+
+#include "hash.h"
+#include "jobs.h"
+#include "pipeline.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Adds one field to the key
+#define REGISTRY_KEY(key, field) hash_key_add((key), sizeof(field), &(field))
+
+struct RegistryEntry {
+        // VK_NULL_HANDLE while it's still waiting in the batch
+        VkPipeline pipeline;
+        uint32_t pending;
+};
+
+struct RegistryOut {
+        uint32_t pending;
+        VkPipeline* out;
+};
+
+struct RegistryJob {
+        struct PipelineRegistry* reg;
+        uint32_t first;
+        uint32_t ct;
+};
+
+struct RegistryStats {
+        uint64_t request_ct;
+        // Requests answered by a pipeline that was already there or already in the batch
+        uint64_t hit_ct;
+        uint64_t compile_ct;
+        uint64_t batch_ct;
+        double compile_s;
+};
+
+// Deduplicates pipelines by keying them on everything that goes into them: every PipelineSettings
+// state (following the arrays they point to), the shader stages including specialization data, the
+// layout, the render pass and the subpass. The whole key is kept and compared, not just its hash.
+// New pipelines are compiled in batches, either split over a Jobs pool or as one multi-pipeline
+// vkCreateGraphicsPipelines call.
+//
+// pNext chains aren't followed, so they have to be NULL. Shader modules are keyed by handle, so
+// don't destroy a module and create another one while the registry is around.
+struct PipelineRegistry {
+        VkDevice device;
+        struct PipelineCache* cache;
+        struct Jobs* jobs;
+
+        // Values are indices into `entries`
+        struct HashTable table;
+        struct HashKey key;
+        uint32_t cap;
+        uint32_t ct;
+        struct RegistryEntry* entries;
+
+        // The current batch
+        uint32_t pending_ct;
+        uint32_t pending_cap;
+        VkGraphicsPipelineCreateInfo* pending_infos;
+        uint32_t* pending_entries;
+        VkPipeline* pending_pipelines;
+        uint32_t out_ct;
+        uint32_t out_cap;
+        struct RegistryOut* outs;
+
+        pthread_mutex_t lock;
+        pthread_cond_t done;
+        uint32_t remaining;
+
+        struct RegistryStats stats;
+};
+
+// `cache` and `jobs` can be NULL. Without `jobs`, each batch is a single vkCreateGraphicsPipelines
+// call, which some drivers parallelize on their own.
+void pipeline_registry_create(VkDevice device, struct PipelineCache* cache, struct Jobs* jobs,
+                              struct PipelineRegistry* reg)
+{
+        bzero(reg, sizeof(*reg));
+        reg->device = device;
+        reg->cache = cache;
+        reg->jobs = jobs;
+
+        hash_table_init(&reg->table);
+
+        pthread_mutex_init(&reg->lock, NULL);
+        pthread_cond_init(&reg->done, NULL);
+}
+
+// Destroys every pipeline the registry made.
+void pipeline_registry_destroy(struct PipelineRegistry* reg) {
+        assert(reg->pending_ct == 0);
+        for (uint32_t i = 0; i < reg->ct; i++) vkDestroyPipeline(reg->device, reg->entries[i].pipeline, NULL);
+        hash_table_destroy(&reg->table);
+        hash_key_destroy(&reg->key);
+        free(reg->entries);
+        free(reg->pending_infos);
+        free(reg->pending_entries);
+        free(reg->pending_pipelines);
+        free(reg->outs);
+
+        pthread_mutex_destroy(&reg->lock);
+        pthread_cond_destroy(&reg->done);
+}
+
+static void registry_key_settings(struct HashKey* key, const struct PipelineSettings* s) {
+        const VkPipelineVertexInputStateCreateInfo* vertex = &s->vertex;
+        assert(vertex->pNext == NULL);
+        REGISTRY_KEY(key, vertex->flags);
+        REGISTRY_KEY(key, vertex->vertexBindingDescriptionCount);
+        hash_key_add(key, vertex->vertexBindingDescriptionCount * sizeof(VkVertexInputBindingDescription),
+                     vertex->pVertexBindingDescriptions);
+        REGISTRY_KEY(key, vertex->vertexAttributeDescriptionCount);
+        hash_key_add(key, vertex->vertexAttributeDescriptionCount * sizeof(VkVertexInputAttributeDescription),
+                     vertex->pVertexAttributeDescriptions);
+
+        const VkPipelineInputAssemblyStateCreateInfo* ia = &s->input_assembly;
+        assert(ia->pNext == NULL);
+        REGISTRY_KEY(key, ia->flags);
+        REGISTRY_KEY(key, ia->topology);
+        REGISTRY_KEY(key, ia->primitiveRestartEnable);
+
+        const VkPipelineRasterizationStateCreateInfo* rast = &s->rasterizer;
+        assert(rast->pNext == NULL);
+        REGISTRY_KEY(key, rast->flags);
+        REGISTRY_KEY(key, rast->depthClampEnable);
+        REGISTRY_KEY(key, rast->rasterizerDiscardEnable);
+        REGISTRY_KEY(key, rast->polygonMode);
+        REGISTRY_KEY(key, rast->cullMode);
+        REGISTRY_KEY(key, rast->frontFace);
+        REGISTRY_KEY(key, rast->depthBiasEnable);
+        REGISTRY_KEY(key, rast->depthBiasConstantFactor);
+        REGISTRY_KEY(key, rast->depthBiasClamp);
+        REGISTRY_KEY(key, rast->depthBiasSlopeFactor);
+        REGISTRY_KEY(key, rast->lineWidth);
+
+        const VkPipelineViewportStateCreateInfo* vp = &s->viewport;
+        assert(vp->pNext == NULL);
+        REGISTRY_KEY(key, vp->flags);
+        REGISTRY_KEY(key, vp->viewportCount);
+        REGISTRY_KEY(key, vp->scissorCount);
+        // Usually NULL, since they're dynamic
+        if (vp->pViewports != NULL) hash_key_add(key, vp->viewportCount * sizeof(VkViewport), vp->pViewports);
+        if (vp->pScissors != NULL) hash_key_add(key, vp->scissorCount * sizeof(VkRect2D), vp->pScissors);
+
+        const VkPipelineDepthStencilStateCreateInfo* ds = &s->depth;
+        assert(ds->pNext == NULL);
+        REGISTRY_KEY(key, ds->flags);
+        REGISTRY_KEY(key, ds->depthTestEnable);
+        REGISTRY_KEY(key, ds->depthWriteEnable);
+        REGISTRY_KEY(key, ds->depthCompareOp);
+        REGISTRY_KEY(key, ds->depthBoundsTestEnable);
+        REGISTRY_KEY(key, ds->stencilTestEnable);
+        REGISTRY_KEY(key, ds->front);
+        REGISTRY_KEY(key, ds->back);
+        REGISTRY_KEY(key, ds->minDepthBounds);
+        REGISTRY_KEY(key, ds->maxDepthBounds);
+
+        const VkPipelineMultisampleStateCreateInfo* ms = &s->multisampling;
+        assert(ms->pNext == NULL);
+        REGISTRY_KEY(key, ms->flags);
+        REGISTRY_KEY(key, ms->rasterizationSamples);
+        REGISTRY_KEY(key, ms->sampleShadingEnable);
+        REGISTRY_KEY(key, ms->minSampleShading);
+        if (ms->pSampleMask != NULL) {
+                hash_key_add(key, (ms->rasterizationSamples + 31) / 32 * sizeof(VkSampleMask), ms->pSampleMask);
+        }
+        REGISTRY_KEY(key, ms->alphaToCoverageEnable);
+        REGISTRY_KEY(key, ms->alphaToOneEnable);
+
+        const VkPipelineColorBlendStateCreateInfo* cb = &s->color_blend;
+        assert(cb->pNext == NULL);
+        REGISTRY_KEY(key, cb->flags);
+        REGISTRY_KEY(key, cb->logicOpEnable);
+        REGISTRY_KEY(key, cb->logicOp);
+        REGISTRY_KEY(key, cb->attachmentCount);
+        hash_key_add(key, cb->attachmentCount * sizeof(VkPipelineColorBlendAttachmentState),
+                     cb->pAttachments);
+        REGISTRY_KEY(key, cb->blendConstants);
+
+        const VkPipelineDynamicStateCreateInfo* dyn = &s->dynamic_state;
+        assert(dyn->pNext == NULL);
+        REGISTRY_KEY(key, dyn->flags);
+        REGISTRY_KEY(key, dyn->dynamicStateCount);
+        hash_key_add(key, dyn->dynamicStateCount * sizeof(VkDynamicState), dyn->pDynamicStates);
+}
+
+static void registry_key_stages(struct HashKey* key, uint32_t stage_ct,
+                                const VkPipelineShaderStageCreateInfo* stages)
+{
+        REGISTRY_KEY(key, stage_ct);
+        for (uint32_t i = 0; i < stage_ct; i++) {
+                const VkPipelineShaderStageCreateInfo* stage = &stages[i];
+                assert(stage->pNext == NULL);
+                REGISTRY_KEY(key, stage->flags);
+                REGISTRY_KEY(key, stage->stage);
+                REGISTRY_KEY(key, stage->module);
+                hash_key_add(key, strlen(stage->pName) + 1, stage->pName);
+
+                const VkSpecializationInfo* spec = stage->pSpecializationInfo;
+                uint32_t entry_ct = spec != NULL ? spec->mapEntryCount : 0;
+                REGISTRY_KEY(key, entry_ct);
+                if (spec == NULL) continue;
+                for (uint32_t j = 0; j < entry_ct; j++) {
+                        REGISTRY_KEY(key, spec->pMapEntries[j].constantID);
+                        REGISTRY_KEY(key, spec->pMapEntries[j].offset);
+                        REGISTRY_KEY(key, spec->pMapEntries[j].size);
+                }
+                REGISTRY_KEY(key, spec->dataSize);
+                hash_key_add(key, spec->dataSize, spec->pData);
+        }
+}
+
+static void registry_key(struct HashKey* key, const struct PipelineSettings* settings, uint32_t stage_ct,
+                         const VkPipelineShaderStageCreateInfo* stages, VkPipelineLayout layout,
+                         VkRenderPass rpass, uint32_t subpass)
+{
+        hash_key_reset(key);
+        registry_key_settings(key, settings);
+        registry_key_stages(key, stage_ct, stages);
+        REGISTRY_KEY(key, layout);
+        REGISTRY_KEY(key, rpass);
+        REGISTRY_KEY(key, subpass);
+}
+
+static void registry_job(void* data, uint32_t worker) {
+        (void)(worker);
+        struct RegistryJob* job = data;
+        struct PipelineRegistry* reg = job->reg;
+
+        VkPipelineCache cache = reg->cache != NULL ? reg->cache->handle : VK_NULL_HANDLE;
+        VkResult res = vkCreateGraphicsPipelines(reg->device, cache, job->ct,
+                                                 &reg->pending_infos[job->first], NULL,
+                                                 &reg->pending_pipelines[job->first]);
+        assert(res == VK_SUCCESS);
+
+        pthread_mutex_lock(&reg->lock);
+        reg->remaining--;
+        if (reg->remaining == 0) pthread_cond_signal(&reg->done);
+        pthread_mutex_unlock(&reg->lock);
+}
+
+// Compiles everything requested since the last flush and fills in the requests' outputs.
+void pipeline_registry_flush(struct PipelineRegistry* reg) {
+        if (reg->pending_ct == 0) return;
+        double start = pipeline_now();
+
+        uint32_t job_ct = reg->jobs != NULL ? reg->jobs->thread_ct : 1;
+        if (job_ct > reg->pending_ct) job_ct = reg->pending_ct;
+
+        if (job_ct == 1) {
+                struct RegistryJob job = {reg, 0, reg->pending_ct};
+                reg->remaining = 1;
+                registry_job(&job, 0);
+        } else {
+                struct RegistryJob* jobs = malloc(job_ct * sizeof(jobs[0]));
+                reg->remaining = job_ct;
+                uint32_t per_job = reg->pending_ct / job_ct, extra = reg->pending_ct % job_ct;
+                uint32_t first = 0;
+                for (uint32_t i = 0; i < job_ct; i++) {
+                        jobs[i] = (struct RegistryJob){reg, first, per_job + (i < extra ? 1 : 0)};
+                        first += jobs[i].ct;
+                        jobs_push(reg->jobs, registry_job, &jobs[i]);
+                }
+
+                // Not jobs_wait, the pool might be busy with something else too
+                pthread_mutex_lock(&reg->lock);
+                while (reg->remaining > 0) pthread_cond_wait(&reg->done, &reg->lock);
+                pthread_mutex_unlock(&reg->lock);
+                free(jobs);
+        }
+
+        for (uint32_t i = 0; i < reg->pending_ct; i++) {
+                reg->entries[reg->pending_entries[i]].pipeline = reg->pending_pipelines[i];
+        }
+        for (uint32_t i = 0; i < reg->out_ct; i++) {
+                *reg->outs[i].out = reg->pending_pipelines[reg->outs[i].pending];
+        }
+
+        double elapsed = pipeline_now() - start;
+        reg->stats.compile_ct += reg->pending_ct;
+        reg->stats.compile_s += elapsed;
+        reg->stats.batch_ct++;
+        if (reg->cache != NULL) {
+                reg->cache->pipeline_ct += reg->pending_ct;
+                reg->cache->pipeline_s += elapsed;
+        }
+
+        reg->pending_ct = 0;
+        reg->out_ct = 0;
+}
+
+// Asks for a pipeline without waiting for it. If an identical one exists already `*pipeline` is
+// set straight away, otherwise it's set by the next `pipeline_registry_flush`. Everything passed in
+// (and everything it points to) has to stay valid until then.
+void pipeline_registry_request(struct PipelineRegistry* reg, const struct PipelineSettings* settings,
+                               uint32_t stage_ct, const VkPipelineShaderStageCreateInfo* stages,
+                               VkPipelineLayout layout, VkRenderPass rpass, uint32_t subpass,
+                               VkPipeline* pipeline)
+{
+        registry_key(&reg->key, settings, stage_ct, stages, layout, rpass, subpass);
+        reg->stats.request_ct++;
+
+        struct HashEntry* found = hash_table_find(&reg->table, &reg->key);
+        struct RegistryEntry* entry = found != NULL ? &reg->entries[found->value] : NULL;
+        if (entry != NULL && entry->pipeline != VK_NULL_HANDLE) {
+                reg->stats.hit_ct++;
+                *pipeline = entry->pipeline;
+                return;
+        }
+
+        if (entry != NULL) {
+                reg->stats.hit_ct++;
+        } else {
+                if (reg->pending_ct == reg->pending_cap) {
+                        reg->pending_cap = reg->pending_cap == 0 ? 16 : reg->pending_cap * 2;
+                        reg->pending_infos = realloc(reg->pending_infos,
+                                                     reg->pending_cap * sizeof(reg->pending_infos[0]));
+                        reg->pending_entries = realloc(reg->pending_entries,
+                                                       reg->pending_cap * sizeof(reg->pending_entries[0]));
+                        reg->pending_pipelines = realloc(reg->pending_pipelines,
+                                                         reg->pending_cap * sizeof(reg->pending_pipelines[0]));
+                }
+                uint32_t idx = reg->pending_ct++;
+                pipeline_info_fill(settings, stage_ct, stages, layout, rpass, subpass,
+                                   &reg->pending_infos[idx]);
+                reg->pending_pipelines[idx] = VK_NULL_HANDLE;
+
+                if (reg->ct == reg->cap) {
+                        reg->cap = reg->cap == 0 ? 64 : reg->cap * 2;
+                        reg->entries = realloc(reg->entries, reg->cap * sizeof(reg->entries[0]));
+                }
+                reg->pending_entries[idx] = reg->ct;
+                hash_table_insert(&reg->table, &reg->key, reg->ct);
+                entry = &reg->entries[reg->ct++];
+                entry->pipeline = VK_NULL_HANDLE;
+                entry->pending = idx;
+        }
+
+        if (reg->out_ct == reg->out_cap) {
+                reg->out_cap = reg->out_cap == 0 ? 16 : reg->out_cap * 2;
+                reg->outs = realloc(reg->outs, reg->out_cap * sizeof(reg->outs[0]));
+        }
+        reg->outs[reg->out_ct++] = (struct RegistryOut){entry->pending, pipeline};
+}
+
+// Like `pipeline_create`, but returns the existing pipeline if there's an identical one. Flushes
+// the current batch if it has to compile.
+VkPipeline pipeline_registry_get(struct PipelineRegistry* reg, const struct PipelineSettings* settings,
+                                 uint32_t stage_ct, const VkPipelineShaderStageCreateInfo* stages,
+                                 VkPipelineLayout layout, VkRenderPass rpass, uint32_t subpass)
+{
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        pipeline_registry_request(reg, settings, stage_ct, stages, layout, rpass, subpass, &pipeline);
+        if (pipeline == VK_NULL_HANDLE) pipeline_registry_flush(reg);
+        return pipeline;
+}
+
+void pipeline_registry_stats_print(const struct PipelineRegistry* reg) {
+        const struct RegistryStats* s = &reg->stats;
+        printf("Pipeline registry: %lu requests, %lu deduplicated, %lu compiled in %lu batches "
+               "(%.2f ms, %u threads)\n", (unsigned long) s->request_ct, (unsigned long) s->hit_ct,
+               (unsigned long) s->compile_ct, (unsigned long) s->batch_ct, s->compile_s * 1e3,
+               reg->jobs != NULL ? reg->jobs->thread_ct : 1);
+}
+
+#endif // LL_REGISTRY_H
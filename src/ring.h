@@ -0,0 +1,124 @@
+#ifndef LL_RING_H
+#define LL_RING_H
+
+#include <vulkan/vulkan.h>
+
+#include "buffer.h"
+#include "mem.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A host-visible buffer split into one region per frame in flight. The memory is mapped once, so
+// filling in uniforms is just a pointer write.
+struct Ring {
+        struct Buffer buf;
+        VkDeviceSize alignment;
+
+        uint32_t frame_ct;
+        VkDeviceSize frame_size;
+
+        // Region currently being filled
+        uint32_t frame;
+        VkDeviceSize head;
+
+        // The fence that was signaled by the last submission to read each region, or
+        // VK_NULL_HANDLE if the region hasn't been used yet
+        VkFence* fences;
+};
+
+struct RingSlice {
+        void* ptr;
+        // From the start of the buffer, so it can go straight into a VkDescriptorBufferInfo or be
+        // used as a dynamic offset
+        VkDeviceSize offset;
+        VkDeviceSize size;
+};
+
+// `usage` is usually VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT. Slices are aligned to
+// minUniformBufferOffsetAlignment, and minStorageBufferOffsetAlignment too if `usage` has the
+// storage bit.
+void ring_create(struct MemAllocator* allocator, VkDevice device, VkBufferUsageFlags usage,
+                 VkDeviceSize frame_size, uint32_t frame_ct, struct Ring* ring)
+{
+        bzero(ring, sizeof(*ring));
+
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(allocator->phys_dev, &props);
+        ring->alignment = props.limits.minUniformBufferOffsetAlignment;
+        if ((usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+            && props.limits.minStorageBufferOffsetAlignment > ring->alignment) {
+                ring->alignment = props.limits.minStorageBufferOffsetAlignment;
+        }
+        if (ring->alignment == 0) ring->alignment = 1;
+
+        // Keep every region aligned, not just the first one
+        ring->frame_size = (frame_size + ring->alignment - 1) / ring->alignment * ring->alignment;
+        ring->frame_ct = frame_ct;
+
+        buffer_create(allocator, device, usage,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      ring->frame_size * frame_ct, &ring->buf);
+        assert(ring->buf.alloc.mapped != NULL);
+
+        ring->fences = malloc(frame_ct * sizeof(ring->fences[0]));
+        for (uint32_t i = 0; i < frame_ct; i++) ring->fences[i] = VK_NULL_HANDLE;
+
+        // The first call to `ring_frame_begin` moves to region 0
+        ring->frame = frame_ct - 1;
+}
+
+void ring_destroy(VkDevice device, struct Ring* ring) {
+        buffer_destroy(device, &ring->buf);
+        free(ring->fences);
+}
+
+// Moves on to the next region. `fence` is the fence the upcoming frame's submission will signal;
+// the next time this region comes around, we wait on it before handing out memory again. Call this
+// before resetting `fence` for the new frame, or the wait will never finish.
+void ring_frame_begin(VkDevice device, struct Ring* ring, VkFence fence) {
+        ring->frame = (ring->frame + 1) % ring->frame_ct;
+        ring->head = 0;
+
+        VkFence prev = ring->fences[ring->frame];
+        if (prev != VK_NULL_HANDLE) {
+                VkResult res = vkWaitForFences(device, 1, &prev, VK_TRUE, UINT64_MAX);
+                assert(res == VK_SUCCESS);
+        }
+        ring->fences[ring->frame] = fence;
+}
+
+// Hands out `size` bytes from the current frame's region. Never makes any Vulkan calls.
+void ring_alloc(struct Ring* ring, VkDeviceSize size, struct RingSlice* slice) {
+        VkDeviceSize aligned = (size + ring->alignment - 1) / ring->alignment * ring->alignment;
+        assert(ring->head + aligned <= ring->frame_size);
+
+        slice->offset = ring->frame * ring->frame_size + ring->head;
+        slice->size = size;
+        slice->ptr = (char*) ring->buf.alloc.mapped + slice->offset;
+
+        ring->head += aligned;
+}
+
+// Room for `ct` per-object structs of `elem_size` each, every one at an aligned offset, so a single
+// UNIFORM_BUFFER_DYNAMIC or STORAGE_BUFFER_DYNAMIC descriptor with range `elem_size` reaches all of
+// them. Object i goes at `slice->ptr + i * stride` and its dynamic offset is
+// `slice->offset + i * stride`. Returns the stride.
+VkDeviceSize ring_alloc_objects(struct Ring* ring, VkDeviceSize elem_size, uint32_t ct,
+                                struct RingSlice* slice)
+{
+        VkDeviceSize stride = (elem_size + ring->alignment - 1) / ring->alignment * ring->alignment;
+        ring_alloc(ring, stride * ct, slice);
+        return stride;
+}
+
+// Shorthand for `ring_alloc` followed by a memcpy. Returns the slice's offset.
+VkDeviceSize ring_write(struct Ring* ring, VkDeviceSize size, const void* data) {
+        struct RingSlice slice;
+        ring_alloc(ring, size, &slice);
+        memcpy(slice.ptr, data, size);
+        return slice.offset;
+}
+
+#endif // LL_RING_H
@@ -4,6 +4,7 @@
 #include <vulkan/vulkan.h>
 
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <vulkan/vulkan_core.h>
 #include <string.h>
@@ -11,6 +12,8 @@
 struct DescriptorInfo {
         VkDescriptorType type;
         VkShaderStageFlags stage;
+        // Array size in the shader. 0 is the same as 1, so old initializers keep working.
+        uint32_t count;
 };
 
 struct SetInfo {
@@ -24,8 +27,12 @@ union SetHandle {
 	VkDescriptorImageInfo image;
 };
 
+static uint32_t desc_count(const struct DescriptorInfo* desc) {
+	return desc->count == 0 ? 1 : desc->count;
+}
+
 // Don't use this if you have complicated requirements, just do it yourself. If you have different
-// sets for every frame, this function isn't smart enough to work.
+// sets for every frame, this function isn't smart enough to work; use a DescAllocator.
 void dpool_create(VkDevice device, int set_ct, int desc_ct,
 		  struct DescriptorInfo* descs, VkDescriptorPool *dpool) {
 	// Create a descriptor pool size for every possible descriptor type. Works because they are
@@ -37,7 +44,7 @@ void dpool_create(VkDevice device, int set_ct, int desc_ct,
 	for (int i = 0; i <= MAX_DESCRIPTOR_TYPE; i++) {
 		sizes[i].type = (VkDescriptorType) i;
 		for (int j = 0; j < desc_ct; j++) {
-			if (descs[j].type == i) sizes[i].descriptorCount++;
+			if (descs[j].type == i) sizes[i].descriptorCount += desc_count(&descs[j]);
 		}
 	}
 
@@ -62,23 +69,23 @@ void dpool_create(VkDevice device, int set_ct, int desc_ct,
 	assert(res == VK_SUCCESS);
 }
 
-// Only needs `type` and `shader_stage_flags` from each DescriptorInfo. Useful because one set works
-// for many buffers.
-void set_layout_create(VkDevice device, struct SetInfo* set_info, VkDescriptorSetLayout* layout)
+// `flags` is for things like VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR.
+void set_layout_create_flags(VkDevice device, const struct SetInfo* set_info,
+			     VkDescriptorSetLayoutCreateFlags flags, VkDescriptorSetLayout* layout)
 {
 	VkDescriptorSetLayoutBinding* bindings = malloc(sizeof(bindings[0]) * set_info->desc_ct);
 	bzero(bindings, sizeof(bindings[0]) * set_info->desc_ct);
 	for (int i = 0; i < set_info->desc_ct; i++) {
 		bindings[i].binding = i;
-		// This is only ever >1 for things accessed in the shader as arrays. I don't use
-		// those for now, so don't bother.
-		bindings[i].descriptorCount = 1;
+		// Only >1 for things accessed in the shader as arrays
+		bindings[i].descriptorCount = desc_count(&set_info->descs[i]);
 		bindings[i].descriptorType = set_info->descs[i].type;
 		bindings[i].stageFlags = set_info->descs[i].stage;
 	}
 
         VkDescriptorSetLayoutCreateInfo info = {0};
         info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        info.flags = flags;
         info.bindingCount = set_info->desc_ct;
         info.pBindings = bindings;
 
@@ -88,24 +95,53 @@ void set_layout_create(VkDevice device, struct SetInfo* set_info, VkDescriptorSe
 	free(bindings);
 }
 
-// `handles` must have set_info->desc_ct elements.
-void set_create(VkDevice device, VkDescriptorPool dpool, VkDescriptorSetLayout layout,
-		struct SetInfo* set_info, union SetHandle* handles, VkDescriptorSet *set)
+// Only needs `type` and `shader_stage_flags` from each DescriptorInfo. Useful because one set works
+// for many buffers.
+void set_layout_create(VkDevice device, struct SetInfo* set_info, VkDescriptorSetLayout* layout)
 {
-        VkDescriptorSetAllocateInfo info = {0};
-        info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        info.descriptorPool = dpool;
-        info.descriptorSetCount = 1;
-        info.pSetLayouts = &layout;
+	set_layout_create_flags(device, set_info, 0, layout);
+}
 
-        VkResult res = vkAllocateDescriptorSets(device, &info, set);
-        assert(res == VK_SUCCESS);
+// Exact pool sizes for `set_ct` sets with this layout, as many as there are descriptor types.
+// Returns how many of `sizes` were filled in; `sizes` needs room for MAX_DESCRIPTOR_TYPE + 1.
+uint32_t set_info_pool_sizes(const struct SetInfo* set_info, uint32_t set_ct,
+			     VkDescriptorPoolSize* sizes)
+{
+	uint32_t size_ct = 0;
+	for (int i = 0; i <= MAX_DESCRIPTOR_TYPE; i++) {
+		uint32_t ct = 0;
+		for (int j = 0; j < set_info->desc_ct; j++) {
+			if (set_info->descs[j].type == i) ct += desc_count(&set_info->descs[j]);
+		}
+		if (ct == 0) continue;
 
-        VkWriteDescriptorSet* writes = malloc(set_info->desc_ct * sizeof(writes[0]));
+		sizes[size_ct].type = (VkDescriptorType) i;
+		sizes[size_ct].descriptorCount = ct * set_ct;
+		size_ct++;
+	}
+	return size_ct;
+}
+
+// Sets with up to this many descriptors are written without touching the heap
+#define SET_STACK_WRITES 16
+
+// `handles` must have set_info->desc_ct elements. Only the first element of arrays is written.
+// For sets that get written a lot, a SetTemplate is quicker.
+//
+// For the *_DYNAMIC types, `range` is the size of one object and `offset` is usually 0; the offset
+// given to vkCmdBindDescriptorSets picks the object, see ring_alloc_objects.
+void set_write(VkDevice device, VkDescriptorSet set, const struct SetInfo* set_info,
+	       const union SetHandle* handles)
+{
+	VkWriteDescriptorSet stack_writes[SET_STACK_WRITES];
+        VkWriteDescriptorSet* writes = stack_writes;
+	if (set_info->desc_ct > SET_STACK_WRITES) {
+		writes = malloc(set_info->desc_ct * sizeof(writes[0]));
+	}
 	bzero(writes, set_info->desc_ct * sizeof(writes[0]));
         for (int i = 0; i < set_info->desc_ct; ++i) {
                 writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                writes[i].dstSet = *set;
+                writes[i].dstSet = set;
                 writes[i].dstBinding = i;
                 writes[i].dstArrayElement = 0;
                 writes[i].descriptorType = set_info->descs[i].type;
@@ -113,16 +149,291 @@ void set_create(VkDevice device, VkDescriptorPool dpool, VkDescriptorSetLayout l
 
 		VkDescriptorType type = set_info->descs[i].type;
                 if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
-		    || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+		    || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+		    || type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+		    || type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC) {
                         writes[i].pBufferInfo = &handles[i].buffer;
-                } else if (type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+                } else if (type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+			   || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+			   || type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+			   || type == VK_DESCRIPTOR_TYPE_SAMPLER
+			   || type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT) {
                         writes[i].pImageInfo = &handles[i].image;
                 }
         }
 
         vkUpdateDescriptorSets(device, set_info->desc_ct, writes, 0, NULL);
 
-        free(writes);
+	if (writes != stack_writes) free(writes);
+}
+
+// `handles` must have set_info->desc_ct elements.
+void set_create(VkDevice device, VkDescriptorPool dpool, VkDescriptorSetLayout layout,
+		struct SetInfo* set_info, union SetHandle* handles, VkDescriptorSet *set)
+{
+        VkDescriptorSetAllocateInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        info.descriptorPool = dpool;
+        info.descriptorSetCount = 1;
+        info.pSetLayouts = &layout;
+
+        VkResult res = vkAllocateDescriptorSets(device, &info, set);
+        assert(res == VK_SUCCESS);
+
+	set_write(device, *set, set_info, handles);
+}
+
+// A VkDescriptorUpdateTemplate that reads a SetHandle array, the same one set_write takes, so
+// updating a set is one call with no write structs built. Can also push descriptors
+// (VK_KHR_push_descriptor) straight into a command buffer instead, with no set at all.
+struct SetTemplate {
+	VkDescriptorUpdateTemplate handle;
+	// Push templates only
+	VkPipelineLayout layout;
+	uint32_t set_idx;
+	PFN_vkCmdPushDescriptorSetWithTemplateKHR push;
+};
+
+static void set_template_build(VkDevice device, const struct SetInfo* set_info,
+			       VkDescriptorUpdateTemplateCreateInfo* info, struct SetTemplate* tmpl)
+{
+	VkDescriptorUpdateTemplateEntry stack_entries[SET_STACK_WRITES];
+	VkDescriptorUpdateTemplateEntry* entries = stack_entries;
+	if (set_info->desc_ct > SET_STACK_WRITES) {
+		entries = malloc(set_info->desc_ct * sizeof(entries[0]));
+	}
+
+	for (int i = 0; i < set_info->desc_ct; i++) {
+		entries[i].dstBinding = i;
+		entries[i].dstArrayElement = 0;
+		entries[i].descriptorCount = 1;
+		entries[i].descriptorType = set_info->descs[i].type;
+		// Both union members start at the top, so this works for buffers and images alike
+		entries[i].offset = i * sizeof(union SetHandle);
+		entries[i].stride = sizeof(union SetHandle);
+	}
+
+	info->sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+	info->descriptorUpdateEntryCount = set_info->desc_ct;
+	info->pDescriptorUpdateEntries = entries;
+
+	VkResult res = vkCreateDescriptorUpdateTemplate(device, info, NULL, &tmpl->handle);
+	assert(res == VK_SUCCESS);
+
+	if (entries != stack_entries) free(entries);
+}
+
+// Once per layout. Buffers and images only, like set_write.
+void set_template_create(VkDevice device, const struct SetInfo* set_info,
+			 VkDescriptorSetLayout layout, struct SetTemplate* tmpl)
+{
+	bzero(tmpl, sizeof(*tmpl));
+
+	VkDescriptorUpdateTemplateCreateInfo info = {0};
+	info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	info.descriptorSetLayout = layout;
+	set_template_build(device, set_info, &info, tmpl);
+}
+
+// Needs VK_KHR_push_descriptor enabled, and set `set_idx` of `layout` made with
+// set_layout_create_flags(..., VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR, ...).
+// Good for small per-draw sets that would otherwise be allocated and written every frame. Push
+// descriptor layouts can't have *_DYNAMIC bindings.
+void set_push_template_create(VkDevice device, const struct SetInfo* set_info,
+			      VkPipelineBindPoint bind_point, VkPipelineLayout layout,
+			      uint32_t set_idx, struct SetTemplate* tmpl)
+{
+	bzero(tmpl, sizeof(*tmpl));
+	tmpl->layout = layout;
+	tmpl->set_idx = set_idx;
+	tmpl->push = (PFN_vkCmdPushDescriptorSetWithTemplateKHR)
+		vkGetDeviceProcAddr(device, "vkCmdPushDescriptorSetWithTemplateKHR");
+	if (tmpl->push == NULL) {
+		fprintf(stderr, "VK_KHR_push_descriptor isn't enabled\n");
+		exit(1);
+	}
+
+	VkDescriptorUpdateTemplateCreateInfo info = {0};
+	info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+	info.pipelineBindPoint = bind_point;
+	info.pipelineLayout = layout;
+	info.set = set_idx;
+	set_template_build(device, set_info, &info, tmpl);
+}
+
+void set_template_destroy(VkDevice device, struct SetTemplate* tmpl) {
+	vkDestroyDescriptorUpdateTemplate(device, tmpl->handle, NULL);
+}
+
+// `handles` must have set_info->desc_ct elements, same as set_write.
+void set_write_template(VkDevice device, VkDescriptorSet set, const struct SetTemplate* tmpl,
+			const union SetHandle* handles)
+{
+	vkUpdateDescriptorSetWithTemplate(device, set, tmpl->handle, handles);
+}
+
+// Binds the descriptors in `handles` as the template's set. They're copied into the command buffer,
+// so `handles` can go away right after.
+void set_push(VkCommandBuffer cbuf, const struct SetTemplate* tmpl, const union SetHandle* handles) {
+	assert(tmpl->push != NULL);
+	tmpl->push(cbuf, tmpl->handle, tmpl->layout, tmpl->set_idx, handles);
+}
+
+// Sets per pool are doubled for every pool a chain grows by, up to this
+#define DESC_ALLOC_MAX_POOL_SETS 4096
+
+// The pools for one frame. Only `used` of them have anything allocated from them since the last
+// reset; the rest are left over from busier frames.
+struct DescPoolChain {
+	uint32_t ct;
+	uint32_t cap;
+	uint32_t used;
+	VkDescriptorPool* pools;
+	uint32_t* pool_sets;
+};
+
+struct DescAllocatorStats {
+	uint64_t set_ct;
+	uint32_t pool_ct;
+	// Allocations that found the current pool full
+	uint32_t full_ct;
+	uint64_t reset_ct;
+};
+
+// Hands out descriptor sets from a chain of pools per frame in flight. A chain grows by another
+// (bigger) pool whenever its current one runs out, and the whole chain is reset with
+// vkResetDescriptorPool once its frame comes around again, so sets are never freed one by one.
+// With frame_ct 1 and no desc_allocator_frame_begin it's just a growable pool for long-lived sets.
+struct DescAllocator {
+	VkDevice device;
+	uint32_t frame_ct;
+	uint32_t frame;
+	struct DescPoolChain* chains;
+
+	// Descriptors of each type for one set, on average. Pools hold this times their set count.
+	uint32_t per_set_ct;
+	VkDescriptorPoolSize per_set[MAX_DESCRIPTOR_TYPE + 1];
+	uint32_t first_pool_sets;
+
+	struct DescAllocatorStats stats;
+};
+
+// `per_set` is the descriptor mix of a typical set, e.g. from set_info_pool_sizes with set_ct 1.
+// Getting it wrong only means more pools.
+void desc_allocator_create(VkDevice device, uint32_t frame_ct, uint32_t per_set_ct,
+			   const VkDescriptorPoolSize* per_set, uint32_t first_pool_sets,
+			   struct DescAllocator* alloc)
+{
+	assert(per_set_ct <= MAX_DESCRIPTOR_TYPE + 1);
+	bzero(alloc, sizeof(*alloc));
+	alloc->device = device;
+	alloc->frame_ct = frame_ct;
+	alloc->chains = calloc(frame_ct, sizeof(alloc->chains[0]));
+	alloc->per_set_ct = per_set_ct;
+	memcpy(alloc->per_set, per_set, per_set_ct * sizeof(per_set[0]));
+	alloc->first_pool_sets = first_pool_sets;
+}
+
+void desc_allocator_destroy(struct DescAllocator* alloc) {
+	for (uint32_t i = 0; i < alloc->frame_ct; i++) {
+		struct DescPoolChain* chain = &alloc->chains[i];
+		for (uint32_t j = 0; j < chain->ct; j++) {
+			vkDestroyDescriptorPool(alloc->device, chain->pools[j], NULL);
+		}
+		free(chain->pools);
+		free(chain->pool_sets);
+	}
+	free(alloc->chains);
+}
+
+// Moves to `frame` and resets its pools. The GPU must be done with every set allocated the last
+// time this frame came around, e.g. call this after frames_begin with Frames.idx.
+void desc_allocator_frame_begin(struct DescAllocator* alloc, uint32_t frame) {
+	assert(frame < alloc->frame_ct);
+	alloc->frame = frame;
+
+	struct DescPoolChain* chain = &alloc->chains[frame];
+	for (uint32_t i = 0; i < chain->used; i++) {
+		VkResult res = vkResetDescriptorPool(alloc->device, chain->pools[i], 0);
+		assert(res == VK_SUCCESS);
+		alloc->stats.reset_ct++;
+	}
+	chain->used = 0;
+}
+
+static void desc_allocator_grow(struct DescAllocator* alloc, struct DescPoolChain* chain) {
+	uint32_t set_ct = alloc->first_pool_sets;
+	if (chain->ct > 0) set_ct = chain->pool_sets[chain->ct - 1] * 2;
+	if (set_ct > DESC_ALLOC_MAX_POOL_SETS) set_ct = DESC_ALLOC_MAX_POOL_SETS;
+
+	VkDescriptorPoolSize sizes[MAX_DESCRIPTOR_TYPE + 1];
+	for (uint32_t i = 0; i < alloc->per_set_ct; i++) {
+		sizes[i].type = alloc->per_set[i].type;
+		sizes[i].descriptorCount = alloc->per_set[i].descriptorCount * set_ct;
+	}
+
+	VkDescriptorPoolCreateInfo info = {0};
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	info.maxSets = set_ct;
+	info.poolSizeCount = alloc->per_set_ct;
+	info.pPoolSizes = sizes;
+
+	if (chain->ct == chain->cap) {
+		chain->cap = chain->cap == 0 ? 4 : chain->cap * 2;
+		chain->pools = realloc(chain->pools, chain->cap * sizeof(chain->pools[0]));
+		chain->pool_sets = realloc(chain->pool_sets, chain->cap * sizeof(chain->pool_sets[0]));
+	}
+
+	VkResult res = vkCreateDescriptorPool(alloc->device, &info, NULL, &chain->pools[chain->ct]);
+	assert(res == VK_SUCCESS);
+	chain->pool_sets[chain->ct] = set_ct;
+	chain->ct++;
+	alloc->stats.pool_ct++;
+}
+
+// Only valid until this frame comes around again.
+VkDescriptorSet desc_allocator_alloc(struct DescAllocator* alloc, VkDescriptorSetLayout layout) {
+	struct DescPoolChain* chain = &alloc->chains[alloc->frame];
+
+	VkDescriptorSetAllocateInfo info = {0};
+	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	info.descriptorSetCount = 1;
+	info.pSetLayouts = &layout;
+
+	VkDescriptorSet set;
+	int empty = 0;
+	for (;;) {
+		if (chain->used == 0) {
+			if (chain->ct == 0) desc_allocator_grow(alloc, chain);
+			chain->used = 1;
+			empty = 1;
+		}
+
+		info.descriptorPool = chain->pools[chain->used - 1];
+		VkResult res = vkAllocateDescriptorSets(alloc->device, &info, &set);
+		if (res == VK_SUCCESS) break;
+		assert(res == VK_ERROR_OUT_OF_POOL_MEMORY || res == VK_ERROR_FRAGMENTED_POOL);
+
+		// Every pool has the same mix per set, and later pools are bigger, so a set that doesn't
+		// fit in an empty pool of the biggest size never will
+		if (empty && chain->pool_sets[chain->used - 1] == DESC_ALLOC_MAX_POOL_SETS) {
+			fprintf(stderr, "Descriptor set doesn't fit the allocator's per-set sizes\n");
+			exit(1);
+		}
+		alloc->stats.full_ct++;
+		if (chain->used == chain->ct) desc_allocator_grow(alloc, chain);
+		chain->used++;
+		empty = 1;
+	}
+
+	alloc->stats.set_ct++;
+	return set;
+}
+
+void desc_allocator_stats_print(const struct DescAllocator* alloc) {
+	const struct DescAllocatorStats* s = &alloc->stats;
+	printf("Descriptor allocator: %lu sets from %u pools, %u times full, %lu pool resets\n",
+	       (unsigned long) s->set_ct, s->pool_ct, s->full_ct, (unsigned long) s->reset_ct);
 }
 
 #endif // LL_SET_H
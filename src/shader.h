@@ -3,36 +3,35 @@
 
 #include <vulkan/vulkan.h>
 
+#include "file.h"
+#include "hash.h"
+#include "reflect.h"
+#include "set.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <vulkan/vulkan_core.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // If info is NULL, stage won't be used.
 void load_shader(VkDevice device, const char* path, VkShaderModule* module,
 		 VkShaderStageFlagBits stage, VkPipelineShaderStageCreateInfo* pipeline_info) {
-        FILE *fp = fopen(path, "r");
-        assert(fp != NULL);
-
-        fseek(fp, 0L, SEEK_END);
-        const int byte_ct = ftell(fp);
-        rewind(fp);
-
-        char* buf = malloc(byte_ct);
-        const int read_bytes = fread(buf, 1, byte_ct, fp);
-        assert(read_bytes == byte_ct);
-        fclose(fp);
+        size_t byte_ct;
+        void* code;
+        int ok = file_map(path, &byte_ct, &code);
+        assert(ok);
 
         VkShaderModuleCreateInfo info = {0};
         info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         info.codeSize = byte_ct;
-        info.pCode = (const uint32_t*) buf;
+        info.pCode = code;
 
         VkResult res = vkCreateShaderModule(device, &info, NULL, module);
         assert(res == VK_SUCCESS);
 
-        free(buf);
+        file_unmap(byte_ct, code);
 
 	if (pipeline_info != NULL) {
 		bzero(pipeline_info, sizeof(*pipeline_info));
@@ -43,5 +42,332 @@ void load_shader(VkDevice device, const char* path, VkShaderModule* module,
 	}
 }
 
-#endif // LL_SHADER_H
+struct Shader {
+        uint64_t hash;
+        // A copy of the SPIR-V, so a hash hit can be checked
+        size_t size;
+        void* code;
+        VkShaderModule module;
+        struct Reflection refl;
+};
+
+struct ShaderPath {
+        char* path;
+        struct Shader* shader;
+};
+
+struct ShaderCacheStats {
+        // Answered without touching the file
+        uint32_t path_hits;
+        // Different path, same SPIR-V
+        uint32_t content_hits;
+        uint32_t module_ct;
+        size_t bytes_mapped;
+        double load_s;
+};
+
+// Loads every SPIR-V file once. Files are mapped rather than read, modules are deduplicated by
+// content (hash first, then the bytes) and every module is reflected, so set layouts, pool sizes
+// and push constant ranges can come straight from the shaders. Both lookups are linear, we're
+// talking tens of shaders.
+//
+// Shaders stay alive (and keep the same address) until the cache is destroyed.
+struct ShaderCache {
+        VkDevice device;
+
+        uint32_t shader_ct;
+        uint32_t shader_cap;
+        struct Shader** shaders;
+
+        uint32_t path_ct;
+        uint32_t path_cap;
+        struct ShaderPath* paths;
+
+        struct ShaderCacheStats stats;
+};
+
+void shader_cache_create(VkDevice device, struct ShaderCache* cache) {
+        bzero(cache, sizeof(*cache));
+        cache->device = device;
+}
+
+void shader_cache_destroy(struct ShaderCache* cache) {
+        for (uint32_t i = 0; i < cache->shader_ct; i++) {
+                vkDestroyShaderModule(cache->device, cache->shaders[i]->module, NULL);
+                reflect_destroy(&cache->shaders[i]->refl);
+                free(cache->shaders[i]->code);
+                free(cache->shaders[i]);
+        }
+        for (uint32_t i = 0; i < cache->path_ct; i++) free(cache->paths[i].path);
+        free(cache->shaders);
+        free(cache->paths);
+}
+
+static void shader_cache_add_path(struct ShaderCache* cache, const char* path,
+                                  struct Shader* shader)
+{
+        if (cache->path_ct == cache->path_cap) {
+                cache->path_cap = cache->path_cap == 0 ? 16 : cache->path_cap * 2;
+                cache->paths = realloc(cache->paths, cache->path_cap * sizeof(cache->paths[0]));
+        }
+        cache->paths[cache->path_ct].path = strdup(path);
+        cache->paths[cache->path_ct].shader = shader;
+        cache->path_ct++;
+}
+
+const struct Shader* shader_cache_get(struct ShaderCache* cache, const char* path) {
+        for (uint32_t i = 0; i < cache->path_ct; i++) {
+                if (strcmp(cache->paths[i].path, path) == 0) {
+                        cache->stats.path_hits++;
+                        return cache->paths[i].shader;
+                }
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        size_t size;
+        void* code;
+        if (!file_map(path, &size, &code)) {
+                fprintf(stderr, "Couldn't open %s\n", path);
+                exit(1);
+        }
+        cache->stats.bytes_mapped += size;
+
+        uint64_t hash = hash_bytes_wide(HASH_SEED, size, code);
+        struct Shader* shader = NULL;
+        for (uint32_t i = 0; i < cache->shader_ct && shader == NULL; i++) {
+                struct Shader* other = cache->shaders[i];
+                if (other->hash == hash && other->size == size
+                    && memcmp(other->code, code, size) == 0) {
+                        shader = other;
+                }
+        }
+
+        if (shader != NULL) {
+                cache->stats.content_hits++;
+        } else {
+                shader = malloc(sizeof(*shader));
+                shader->hash = hash;
+                shader->size = size;
+                shader->code = malloc(size);
+                memcpy(shader->code, code, size);
+                reflect_spirv(size, code, &shader->refl);
+
+                VkShaderModuleCreateInfo info = {0};
+                info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+                info.codeSize = size;
+                info.pCode = code;
+
+                VkResult res = vkCreateShaderModule(cache->device, &info, NULL, &shader->module);
+                assert(res == VK_SUCCESS);
+
+                if (cache->shader_ct == cache->shader_cap) {
+                        cache->shader_cap = cache->shader_cap == 0 ? 16 : cache->shader_cap * 2;
+                        cache->shaders = realloc(cache->shaders,
+                                                 cache->shader_cap * sizeof(cache->shaders[0]));
+                }
+                cache->shaders[cache->shader_ct++] = shader;
+                cache->stats.module_ct++;
+        }
+
+        file_unmap(size, code);
+        shader_cache_add_path(cache, path, shader);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        cache->stats.load_s += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        return shader;
+}
+
+// The stage comes from the module's entry point.
+void shader_stage_info(const struct Shader* shader, VkPipelineShaderStageCreateInfo* info) {
+        bzero(info, sizeof(*info));
+        info->sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        info->stage = shader->refl.stage;
+        info->module = shader->module;
+        info->pName = "main";
+}
+
+// One more than the highest set any of the shaders use.
+uint32_t shader_set_ct(const struct Shader* const* shaders, uint32_t shader_ct) {
+        uint32_t set_ct = 0;
+        for (uint32_t i = 0; i < shader_ct; i++) {
+                const struct Reflection* refl = &shaders[i]->refl;
+                for (uint32_t j = 0; j < refl->binding_ct; j++) {
+                        if (refl->bindings[j].set + 1 > set_ct) set_ct = refl->bindings[j].set + 1;
+                }
+        }
+        return set_ct;
+}
+
+// Merges what every shader binds in `set` into a SetInfo for set_layout_create. Each binding's
+// stage flags are all the shaders that use it. SetInfo bindings are 0 to desc_ct - 1, so a gap in
+// the numbering is an error, as is two shaders disagreeing on a binding's type. Runtime-sized
+// arrays come out with count 1; size them yourself. Texel buffers are an error too, since SetHandle
+// has nowhere to put a VkBufferView. Free `descs` when done.
+void shader_set_info(const struct Shader* const* shaders, uint32_t shader_ct, uint32_t set,
+                     struct SetInfo* set_info)
+{
+        uint32_t desc_ct = 0;
+        for (uint32_t i = 0; i < shader_ct; i++) {
+                const struct Reflection* refl = &shaders[i]->refl;
+                for (uint32_t j = 0; j < refl->binding_ct; j++) {
+                        const struct ReflectBinding* b = &refl->bindings[j];
+                        if (b->set == set && b->binding + 1 > desc_ct) desc_ct = b->binding + 1;
+                }
+        }
+
+        set_info->desc_ct = desc_ct;
+        set_info->descs = calloc(desc_ct, sizeof(set_info->descs[0]));
+        for (uint32_t i = 0; i < shader_ct; i++) {
+                const struct Reflection* refl = &shaders[i]->refl;
+                for (uint32_t j = 0; j < refl->binding_ct; j++) {
+                        const struct ReflectBinding* b = &refl->bindings[j];
+                        if (b->set != set) continue;
 
+                        if (b->type == VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+                            || b->type == VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER) {
+                                fprintf(stderr, "Set %u binding %u is a texel buffer, set_write "
+                                        "doesn't support those\n", set, b->binding);
+                                exit(1);
+                        }
+
+                        struct DescriptorInfo* desc = &set_info->descs[b->binding];
+                        if (desc->stage != 0 && desc->type != b->type) {
+                                fprintf(stderr, "Shaders disagree on set %u binding %u\n", set,
+                                        b->binding);
+                                exit(1);
+                        }
+                        desc->type = b->type;
+                        desc->stage |= refl->stage;
+                        if (b->count > desc->count) desc->count = b->count;
+                }
+        }
+
+        for (uint32_t i = 0; i < desc_ct; i++) {
+                if (set_info->descs[i].stage == 0) {
+                        fprintf(stderr, "Set %u has nothing at binding %u\n", set, i);
+                        exit(1);
+                }
+        }
+}
+
+// One range covering every shader's push constants, with all their stages. Returns 0 if none of
+// them have any.
+int shader_push_range(const struct Shader* const* shaders, uint32_t shader_ct,
+                      VkPushConstantRange* range)
+{
+        bzero(range, sizeof(*range));
+        uint32_t end = 0;
+        for (uint32_t i = 0; i < shader_ct; i++) {
+                const struct Reflection* refl = &shaders[i]->refl;
+                if (refl->push_size == 0) continue;
+
+                if (range->stageFlags == 0 || refl->push_offset < range->offset) {
+                        range->offset = refl->push_offset;
+                }
+                if (refl->push_offset + refl->push_size > end) {
+                        end = refl->push_offset + refl->push_size;
+                }
+                range->stageFlags |= refl->stage;
+        }
+        range->size = end - range->offset;
+        return range->stageFlags != 0;
+}
+
+// Specialization constants for one shader stage, so variants are compiled instead of branching
+// on a uniform. Entries and their values are kept sorted by constant id, so setting the same values
+// in a different order gives the same VkSpecializationInfo, and the same pipeline registry key.
+struct SpecMap {
+        uint32_t ct;
+        uint32_t cap;
+        VkSpecializationMapEntry* entries;
+        uint32_t size;
+        uint32_t data_cap;
+        unsigned char* data;
+        VkSpecializationInfo info;
+};
+
+void spec_create(struct SpecMap* spec) {
+        bzero(spec, sizeof(*spec));
+}
+
+void spec_destroy(struct SpecMap* spec) {
+        free(spec->entries);
+        free(spec->data);
+}
+
+// Setting an id again overwrites it; the size has to stay the same.
+static void spec_set(struct SpecMap* spec, uint32_t id, uint32_t size, const void* value) {
+        uint32_t i = 0;
+        while (i < spec->ct && spec->entries[i].constantID < id) i++;
+
+        if (i < spec->ct && spec->entries[i].constantID == id) {
+                assert(spec->entries[i].size == size);
+                memcpy(&spec->data[spec->entries[i].offset], value, size);
+                return;
+        }
+
+        if (spec->ct == spec->cap) {
+                spec->cap = spec->cap == 0 ? 8 : spec->cap * 2;
+                spec->entries = realloc(spec->entries, spec->cap * sizeof(spec->entries[0]));
+        }
+        if (spec->size + size > spec->data_cap) {
+                while (spec->size + size > spec->data_cap) {
+                        spec->data_cap = spec->data_cap == 0 ? 64 : spec->data_cap * 2;
+                }
+                spec->data = realloc(spec->data, spec->data_cap);
+        }
+
+        // Values are kept in id order too, so the data is the same whatever order they were set in
+        uint32_t offset = i < spec->ct ? spec->entries[i].offset : spec->size;
+        memmove(&spec->data[offset + size], &spec->data[offset], spec->size - offset);
+        memmove(&spec->entries[i + 1], &spec->entries[i],
+                (spec->ct - i) * sizeof(spec->entries[0]));
+        spec->ct++;
+        for (uint32_t j = i + 1; j < spec->ct; j++) spec->entries[j].offset += size;
+
+        spec->entries[i].constantID = id;
+        spec->entries[i].offset = offset;
+        spec->entries[i].size = size;
+        memcpy(&spec->data[offset], value, size);
+        spec->size += size;
+
+        spec->info.mapEntryCount = spec->ct;
+        spec->info.pMapEntries = spec->entries;
+        spec->info.dataSize = spec->size;
+        spec->info.pData = spec->data;
+}
+
+// SPIR-V booleans are 32 bits
+void spec_set_bool(struct SpecMap* spec, uint32_t id, int value) {
+        VkBool32 b = value ? VK_TRUE : VK_FALSE;
+        spec_set(spec, id, sizeof(b), &b);
+}
+
+void spec_set_int(struct SpecMap* spec, uint32_t id, int32_t value) {
+        spec_set(spec, id, sizeof(value), &value);
+}
+
+void spec_set_uint(struct SpecMap* spec, uint32_t id, uint32_t value) {
+        spec_set(spec, id, sizeof(value), &value);
+}
+
+void spec_set_float(struct SpecMap* spec, uint32_t id, float value) {
+        spec_set(spec, id, sizeof(value), &value);
+}
+
+// Points the stage at the map, so call it after shader_stage_info. The map has to stay alive until
+// the pipeline is created.
+void spec_apply(struct SpecMap* spec, VkPipelineShaderStageCreateInfo* stage) {
+        stage->pSpecializationInfo = spec->ct > 0 ? &spec->info : NULL;
+}
+
+void shader_cache_stats_print(const struct ShaderCache* cache) {
+        const struct ShaderCacheStats* s = &cache->stats;
+        printf("Shader cache: %u modules from %u paths, %u path hits, %u content hits, "
+               "%.1f KB mapped (%.2f ms)\n", s->module_ct, cache->path_ct, s->path_hits,
+               s->content_hits, s->bytes_mapped / 1024.0, s->load_s * 1e3);
+}
+
+#endif // LL_SHADER_H
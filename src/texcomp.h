@@ -0,0 +1,528 @@
+#ifndef LL_TEXCOMP_H
+#define LL_TEXCOMP_H
+
+#include <vulkan/vulkan.h>
+
+#include "file.h"
+#include "image.h"
+#include "mem.h"
+#include "upload.h"
+
+// Define STB_IMAGE_IMPLEMENTATION before including this in exactly one file
+#include "../external/stb_image/stb_image.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CPU block compression and a small container for block-compressed textures with all their mip
+// levels. The container is a header followed by the levels, each 16-byte aligned, so loading one is
+// an mmap and a copy into staging memory.
+//
+// Supported formats: BC1 (RGB), BC3 (RGBA), BC4 (R), BC5 (RG, for normal maps) and BC7 (RGBA,
+// mode 6 only). The sRGB variants of BC1, BC3 and BC7 work too.
+
+#define TEXCOMP_MAX_LEVELS 16
+
+const uint32_t TEXCOMP_MAGIC = 0x5845544c; // "LTEX"
+const uint32_t TEXCOMP_VERSION = 1;
+
+struct TexcompLevel {
+        // From the start of the file
+        uint64_t offset;
+        uint64_t size;
+};
+
+struct TexcompHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t level_ct;
+        struct TexcompLevel levels[TEXCOMP_MAX_LEVELS];
+        uint64_t file_size;
+};
+
+struct Texcomp {
+        const struct TexcompHeader* header;
+        void* data;
+        size_t size;
+};
+
+// 8 or 16, or 0 if we can't encode `format`
+uint32_t texcomp_block_size(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+                return 8;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC3_SRGB_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+        case VK_FORMAT_BC7_SRGB_BLOCK:
+                return 16;
+        default:
+                return 0;
+        }
+}
+
+int texcomp_is_srgb(VkFormat format) {
+        return format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK
+                || format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+VkDeviceSize texcomp_level_size(VkFormat format, uint32_t width, uint32_t height) {
+        return (VkDeviceSize) ((width + 3) / 4) * ((height + 3) / 4) * texcomp_block_size(format);
+}
+
+// Principal axis of `ct` points with `ch` channels, by power iteration. `axis` is left at zero if
+// all the points are the same.
+static void texcomp_axis(const float (*px)[4], int ct, int ch, float* mean, float* axis) {
+        for (int k = 0; k < 4; k++) mean[k] = axis[k] = 0;
+        for (int i = 0; i < ct; i++) {
+                for (int k = 0; k < ch; k++) mean[k] += px[i][k];
+        }
+        for (int k = 0; k < ch; k++) mean[k] /= ct;
+
+        float cov[4][4] = {{0}};
+        for (int i = 0; i < ct; i++) {
+                for (int a = 0; a < ch; a++) {
+                        for (int b = 0; b < ch; b++) {
+                                cov[a][b] += (px[i][a] - mean[a]) * (px[i][b] - mean[b]);
+                        }
+                }
+        }
+
+        float v[4] = {1, 1, 1, 1};
+        for (int iter = 0; iter < 8; iter++) {
+                float next[4] = {0};
+                for (int a = 0; a < ch; a++) {
+                        for (int b = 0; b < ch; b++) next[a] += cov[a][b] * v[b];
+                }
+                float len = 0;
+                for (int k = 0; k < ch; k++) len += next[k] * next[k];
+                len = sqrtf(len);
+                if (len < 1e-6f) return;
+                for (int k = 0; k < ch; k++) v[k] = next[k] / len;
+        }
+        for (int k = 0; k < ch; k++) axis[k] = v[k];
+}
+
+// Ends of the points' extent along the principal axis
+static void texcomp_endpoints(const float (*px)[4], int ct, int ch, float* lo, float* hi) {
+        float mean[4], axis[4];
+        texcomp_axis(px, ct, ch, mean, axis);
+
+        float t_min = 0, t_max = 0;
+        for (int i = 0; i < ct; i++) {
+                float t = 0;
+                for (int k = 0; k < ch; k++) t += (px[i][k] - mean[k]) * axis[k];
+                if (t < t_min) t_min = t;
+                if (t > t_max) t_max = t;
+        }
+
+        for (int k = 0; k < ch; k++) {
+                lo[k] = fminf(fmaxf(mean[k] + t_min * axis[k], 0), 255);
+                hi[k] = fminf(fmaxf(mean[k] + t_max * axis[k], 0), 255);
+        }
+}
+
+static uint32_t texcomp_nearest(const float* px, int ch, const float (*palette)[4], int palette_ct) {
+        uint32_t best = 0;
+        float best_dist = INFINITY;
+        for (int i = 0; i < palette_ct; i++) {
+                float dist = 0;
+                for (int k = 0; k < ch; k++) dist += (px[k] - palette[i][k]) * (px[k] - palette[i][k]);
+                if (dist < best_dist) {
+                        best_dist = dist;
+                        best = i;
+                }
+        }
+        return best;
+}
+
+static uint16_t texcomp_565(const float* c) {
+        uint32_t r = (uint32_t) (c[0] * 31 / 255 + 0.5f);
+        uint32_t g = (uint32_t) (c[1] * 63 / 255 + 0.5f);
+        uint32_t b = (uint32_t) (c[2] * 31 / 255 + 0.5f);
+        return (r << 11) | (g << 5) | b;
+}
+
+static void texcomp_565_expand(uint16_t c, float* out) {
+        uint32_t r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+        out[0] = (r << 3) | (r >> 2);
+        out[1] = (g << 2) | (g >> 4);
+        out[2] = (b << 3) | (b >> 2);
+        out[3] = 255;
+}
+
+// Always the 4 color mode, so there's no 1-bit alpha
+static void texcomp_bc1_block(const float (*px)[4], uint8_t* out) {
+        float lo[4], hi[4];
+        texcomp_endpoints(px, 16, 3, lo, hi);
+
+        uint16_t c0 = texcomp_565(hi), c1 = texcomp_565(lo);
+        if (c0 < c1) {
+                uint16_t tmp = c0;
+                c0 = c1;
+                c1 = tmp;
+        }
+
+        uint32_t indices = 0;
+        if (c0 != c1) {
+                float palette[4][4];
+                texcomp_565_expand(c0, palette[0]);
+                texcomp_565_expand(c1, palette[1]);
+                for (int k = 0; k < 3; k++) {
+                        palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+                        palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+                }
+                for (int i = 0; i < 16; i++) {
+                        indices |= texcomp_nearest(px[i], 3, (const float (*)[4]) palette, 4) << (2 * i);
+                }
+        }
+
+        out[0] = c0 & 0xff;
+        out[1] = c0 >> 8;
+        out[2] = c1 & 0xff;
+        out[3] = c1 >> 8;
+        for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// One channel of `px`, always the 8 value mode
+static void texcomp_bc4_block(const float (*px)[4], int channel, uint8_t* out) {
+        float lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++) {
+                lo = fminf(lo, px[i][channel]);
+                hi = fmaxf(hi, px[i][channel]);
+        }
+        uint8_t a0 = (uint8_t) (hi + 0.5f), a1 = (uint8_t) (lo + 0.5f);
+
+        uint64_t indices = 0;
+        if (a0 != a1) {
+                float palette[8][4] = {{0}};
+                palette[0][0] = a0;
+                palette[1][0] = a1;
+                for (int i = 1; i < 7; i++) palette[i + 1][0] = ((7 - i) * a0 + i * a1) / 7.0f;
+
+                for (int i = 0; i < 16; i++) {
+                        float v = px[i][channel];
+                        indices |= (uint64_t) texcomp_nearest(&v, 1, (const float (*)[4]) palette, 8)
+                                << (3 * i);
+                }
+        }
+
+        out[0] = a0;
+        out[1] = a1;
+        for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+static void texcomp_write_bits(uint8_t* out, uint32_t* pos, uint32_t value, uint32_t bit_ct) {
+        for (uint32_t i = 0; i < bit_ct; i++) {
+                if (value & (1u << i)) out[*pos / 8] |= 1 << (*pos % 8);
+                (*pos)++;
+        }
+}
+
+// 7 bits plus a shared p-bit per endpoint, whichever p-bit gets closer
+static void texcomp_bc7_quantize(const float* c, uint32_t* c7, uint32_t* p) {
+        float best_err = INFINITY;
+        for (uint32_t pbit = 0; pbit < 2; pbit++) {
+                uint32_t q[4];
+                float err = 0;
+                for (int k = 0; k < 4; k++) {
+                        float v = roundf((c[k] - pbit) / 2);
+                        q[k] = (uint32_t) fminf(fmaxf(v, 0), 127);
+                        float back = (q[k] << 1) | pbit;
+                        err += (back - c[k]) * (back - c[k]);
+                }
+                if (err < best_err) {
+                        best_err = err;
+                        *p = pbit;
+                        memcpy(c7, q, sizeof(q));
+                }
+        }
+}
+
+// Mode 6: one subset, RGBA endpoints, 4-bit indices. Not the best mode for every block, but a good
+// one for most and by far the simplest.
+static void texcomp_bc7_block(const float (*px)[4], uint8_t* out) {
+        static const uint32_t weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+        float lo[4], hi[4];
+        texcomp_endpoints(px, 16, 4, lo, hi);
+
+        uint32_t e[2][4], p[2];
+        texcomp_bc7_quantize(lo, e[0], &p[0]);
+        texcomp_bc7_quantize(hi, e[1], &p[1]);
+
+        float palette[16][4];
+        for (int i = 0; i < 16; i++) {
+                for (int k = 0; k < 4; k++) {
+                        uint32_t a = (e[0][k] << 1) | p[0], b = (e[1][k] << 1) | p[1];
+                        palette[i][k] = ((64 - weights[i]) * a + weights[i] * b + 32) >> 6;
+                }
+        }
+
+        uint32_t indices[16];
+        for (int i = 0; i < 16; i++) {
+                indices[i] = texcomp_nearest(px[i], 4, (const float (*)[4]) palette, 16);
+        }
+
+        // The first index only gets 3 bits, so its top bit has to be 0
+        if (indices[0] & 8) {
+                for (int k = 0; k < 4; k++) {
+                        uint32_t tmp = e[0][k];
+                        e[0][k] = e[1][k];
+                        e[1][k] = tmp;
+                }
+                uint32_t tmp = p[0];
+                p[0] = p[1];
+                p[1] = tmp;
+                for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+        }
+
+        memset(out, 0, 16);
+        uint32_t pos = 0;
+        texcomp_write_bits(out, &pos, 1 << 6, 7);
+        for (int k = 0; k < 4; k++) {
+                texcomp_write_bits(out, &pos, e[0][k], 7);
+                texcomp_write_bits(out, &pos, e[1][k], 7);
+        }
+        texcomp_write_bits(out, &pos, p[0], 1);
+        texcomp_write_bits(out, &pos, p[1], 1);
+        texcomp_write_bits(out, &pos, indices[0], 3);
+        for (int i = 1; i < 16; i++) texcomp_write_bits(out, &pos, indices[i], 4);
+        assert(pos == 128);
+}
+
+// Compresses one level. `rgba` is tightly packed RGBA8, `out` needs `texcomp_level_size` bytes.
+// Partial blocks at the edges repeat the last row/column.
+void texcomp_encode(VkFormat format, const uint8_t* rgba, uint32_t width, uint32_t height,
+                    void* out)
+{
+        uint32_t block_size = texcomp_block_size(format);
+        assert(block_size > 0);
+
+        uint8_t* dst = out;
+        for (uint32_t by = 0; by < height; by += 4) {
+                for (uint32_t bx = 0; bx < width; bx += 4) {
+                        float px[16][4];
+                        for (uint32_t y = 0; y < 4; y++) {
+                                for (uint32_t x = 0; x < 4; x++) {
+                                        uint32_t sx = bx + x < width ? bx + x : width - 1;
+                                        uint32_t sy = by + y < height ? by + y : height - 1;
+                                        const uint8_t* src = &rgba[(sy * width + sx) * 4];
+                                        for (int k = 0; k < 4; k++) px[y * 4 + x][k] = src[k];
+                                }
+                        }
+                        const float (*cpx)[4] = (const float (*)[4]) px;
+
+                        switch (format) {
+                        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                                texcomp_bc1_block(cpx, dst);
+                                break;
+                        case VK_FORMAT_BC3_UNORM_BLOCK:
+                        case VK_FORMAT_BC3_SRGB_BLOCK:
+                                texcomp_bc4_block(cpx, 3, dst);
+                                texcomp_bc1_block(cpx, dst + 8);
+                                break;
+                        case VK_FORMAT_BC4_UNORM_BLOCK:
+                                texcomp_bc4_block(cpx, 0, dst);
+                                break;
+                        case VK_FORMAT_BC5_UNORM_BLOCK:
+                                texcomp_bc4_block(cpx, 0, dst);
+                                texcomp_bc4_block(cpx, 1, dst + 8);
+                                break;
+                        default:
+                                texcomp_bc7_block(cpx, dst);
+                                break;
+                        }
+                        dst += block_size;
+                }
+        }
+}
+
+static float texcomp_srgb_to_linear(float c) {
+        c /= 255;
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float texcomp_linear_to_srgb(float c) {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1 / 2.4f) - 0.055f;
+        return c * 255;
+}
+
+// 2x2 box filter. Color channels of sRGB images are averaged in linear space.
+static void texcomp_downsample(const uint8_t* src, uint32_t width, uint32_t height, int srgb,
+                               uint8_t* dst)
+{
+        uint32_t dst_w = width > 1 ? width / 2 : 1, dst_h = height > 1 ? height / 2 : 1;
+        for (uint32_t y = 0; y < dst_h; y++) {
+                for (uint32_t x = 0; x < dst_w; x++) {
+                        uint32_t x0 = x * 2, y0 = y * 2;
+                        uint32_t x1 = x0 + 1 < width ? x0 + 1 : x0;
+                        uint32_t y1 = y0 + 1 < height ? y0 + 1 : y0;
+                        const uint8_t* p[4] = {
+                                &src[(y0 * width + x0) * 4], &src[(y0 * width + x1) * 4],
+                                &src[(y1 * width + x0) * 4], &src[(y1 * width + x1) * 4],
+                        };
+                        for (int k = 0; k < 4; k++) {
+                                float sum = 0;
+                                for (int i = 0; i < 4; i++) {
+                                        sum += srgb && k < 3 ? texcomp_srgb_to_linear(p[i][k]) : p[i][k];
+                                }
+                                float v = srgb && k < 3 ? texcomp_linear_to_srgb(sum / 4) : sum / 4;
+                                dst[(y * dst_w + x) * 4 + k] = (uint8_t) fminf(fmaxf(v + 0.5f, 0), 255);
+                        }
+                }
+        }
+}
+
+// Builds the mip chain (if `mips` is set), compresses every level and writes the container. The
+// result is malloc'd.
+void texcomp_build(VkFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, int mips,
+                   size_t* size_out, void** blob_out)
+{
+        uint32_t level_ct = mips ? image_mip_levels(width, height) : 1;
+        if (level_ct > TEXCOMP_MAX_LEVELS) level_ct = TEXCOMP_MAX_LEVELS;
+
+        struct TexcompHeader header = {0};
+        header.magic = TEXCOMP_MAGIC;
+        header.version = TEXCOMP_VERSION;
+        header.format = format;
+        header.width = width;
+        header.height = height;
+        header.level_ct = level_ct;
+
+        uint64_t offset = (sizeof(header) + 15) & ~(uint64_t) 15;
+        for (uint32_t i = 0; i < level_ct; i++) {
+                uint32_t w = width >> i > 0 ? width >> i : 1, h = height >> i > 0 ? height >> i : 1;
+                header.levels[i].offset = offset;
+                header.levels[i].size = texcomp_level_size(format, w, h);
+                offset = (offset + header.levels[i].size + 15) & ~(uint64_t) 15;
+        }
+        header.file_size = offset;
+
+        uint8_t* blob = calloc(1, header.file_size);
+        memcpy(blob, &header, sizeof(header));
+
+        const uint8_t* level = rgba;
+        uint8_t* scratch[2] = {NULL, NULL};
+        int srgb = texcomp_is_srgb(format);
+        for (uint32_t i = 0; i < level_ct; i++) {
+                uint32_t w = width >> i > 0 ? width >> i : 1, h = height >> i > 0 ? height >> i : 1;
+                texcomp_encode(format, level, w, h, blob + header.levels[i].offset);
+
+                if (i + 1 < level_ct) {
+                        uint32_t next_w = w > 1 ? w / 2 : 1, next_h = h > 1 ? h / 2 : 1;
+                        uint8_t* next = realloc(scratch[i % 2], (size_t) next_w * next_h * 4);
+                        scratch[i % 2] = next;
+                        texcomp_downsample(level, w, h, srgb, next);
+                        level = next;
+                }
+        }
+        free(scratch[0]);
+        free(scratch[1]);
+
+        *size_out = header.file_size;
+        *blob_out = blob;
+}
+
+// The offline step: decodes any image stb_image can read and writes a compressed container.
+// Returns 0 on failure.
+int texcomp_convert(const char* src_path, const char* dst_path, VkFormat format, int mips) {
+        int width, height, channels;
+        uint8_t* pixels = stbi_load(src_path, &width, &height, &channels, 4);
+        if (pixels == NULL) {
+                fprintf(stderr, "Couldn't load %s: %s\n", src_path, stbi_failure_reason());
+                return 0;
+        }
+
+        size_t size;
+        void* blob;
+        texcomp_build(format, pixels, width, height, mips, &size, &blob);
+        stbi_image_free(pixels);
+
+        int ok = file_write_atomic(dst_path, size, blob);
+        if (!ok) fprintf(stderr, "Couldn't write %s\n", dst_path);
+        free(blob);
+
+        return ok;
+}
+
+// Maps a container. Returns 0 if it doesn't exist or isn't valid.
+int texcomp_open(const char* path, struct Texcomp* tex) {
+        bzero(tex, sizeof(*tex));
+        if (!file_map(path, &tex->size, &tex->data)) return 0;
+
+        const struct TexcompHeader* h = tex->data;
+        int ok = tex->size >= sizeof(*h) && h->magic == TEXCOMP_MAGIC
+                && h->version == TEXCOMP_VERSION && h->file_size == tex->size
+                && h->level_ct > 0 && h->level_ct <= TEXCOMP_MAX_LEVELS
+                && texcomp_block_size(h->format) > 0;
+        for (uint32_t i = 0; ok && i < h->level_ct; i++) {
+                uint32_t w = h->width >> i > 0 ? h->width >> i : 1;
+                uint32_t lh = h->height >> i > 0 ? h->height >> i : 1;
+                ok = h->levels[i].offset % 16 == 0
+                        && h->levels[i].size == texcomp_level_size(h->format, w, lh)
+                        && h->levels[i].offset + h->levels[i].size <= tex->size
+                        && (i == 0 || h->levels[i].offset
+                            >= h->levels[i - 1].offset + h->levels[i - 1].size);
+        }
+
+        if (!ok) {
+                file_unmap(tex->size, tex->data);
+                bzero(tex, sizeof(*tex));
+                return 0;
+        }
+
+        tex->header = h;
+        return 1;
+}
+
+void texcomp_close(struct Texcomp* tex) {
+        file_unmap(tex->size, tex->data);
+        bzero(tex, sizeof(*tex));
+}
+
+// Creates the image and records the upload of every level. Returns 0 (without creating anything)
+// if the device can't sample the format, so the caller can fall back to uncompressed textures.
+int texcomp_upload(struct Upload* up, const struct Texcomp* tex, struct Image* image,
+                   uint64_t* ticket)
+{
+        const struct TexcompHeader* h = tex->header;
+        VkFormatFeatureFlags features = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+                | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (!image_check_format_supported(up->allocator->phys_dev, h->format,
+                                          VK_IMAGE_TILING_OPTIMAL, features)) {
+                fprintf(stderr, "Compressed format %u isn't supported\n", h->format);
+                return 0;
+        }
+
+        image_create(up->allocator, up->device, h->format, VK_IMAGE_TYPE_2D, h->width, h->height, 1,
+                     VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                     VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                     features, h->level_ct, VK_SAMPLE_COUNT_1_BIT, image);
+
+        // The levels are contiguous apart from padding, so they go up as one range
+        uint64_t first = h->levels[0].offset;
+        uint64_t last = h->levels[h->level_ct - 1].offset + h->levels[h->level_ct - 1].size;
+        VkDeviceSize offsets[TEXCOMP_MAX_LEVELS];
+        for (uint32_t i = 0; i < h->level_ct; i++) offsets[i] = h->levels[i].offset - first;
+
+        *ticket = upload_texture_levels(up, image->handle, h->width, h->height, h->level_ct,
+                                        offsets, last - first, (const char*) tex->data + first,
+                                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        image_state_set(image, 0, h->level_ct, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return 1;
+}
+
+#endif // LL_TEXCOMP_H
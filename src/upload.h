@@ -0,0 +1,594 @@
+#ifndef LL_UPLOAD_H
+#define LL_UPLOAD_H
+
+#include <vulkan/vulkan.h>
+
+#include "buffer.h"
+#include "cbuf.h"
+#include "image.h"
+#include "mem.h"
+#include "sync.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How many batches can be in flight before recording has to wait for the GPU
+#define UPLOAD_BATCH_CT 4
+
+// Staging offsets for image copies have to be a multiple of the texel (or block) size and of 4.
+// 48 is a multiple of every size that shows up (1, 2, 3, 4, 6, 8, 12 and 16 bytes).
+const VkDeviceSize UPLOAD_IMAGE_ALIGNMENT = 48;
+
+struct UploadBatch {
+        VkCommandBuffer cbuf;
+        VkFence fence;
+        uint64_t ticket;
+        int recording;
+        int in_flight;
+
+        // Persistently mapped, reused by every submission of this batch
+        struct Buffer staging;
+        VkDeviceSize staging_head;
+
+        // Uploads that didn't fit in `staging` get their own buffer, destroyed once the batch is
+        // done
+        uint32_t extra_ct;
+        uint32_t extra_cap;
+        struct Buffer* extras;
+
+        // Recorded all at once when the batch is submitted. With a separate transfer queue these
+        // are release barriers that hand the resources over to `dst_queue_fam`.
+        uint32_t buffer_barrier_ct;
+        uint32_t buffer_barrier_cap;
+        VkBufferMemoryBarrier* buffer_barriers;
+        uint32_t image_barrier_ct;
+        uint32_t image_barrier_cap;
+        VkImageMemoryBarrier* image_barriers;
+};
+
+// Collects copies into one command buffer per batch and submits the whole thing with a fence, so
+// loading lots of small things doesn't drain the queue every time. Every upload returns the ticket
+// of the batch it went into; pass it to `upload_done` or `upload_wait`.
+//
+// A batch is submitted by `upload_flush`, or automatically once its staging buffer is full.
+//
+// If `queue_fam` and `dst_queue_fam` differ (e.g. base->transfer_queue_fam and base->queue_fam),
+// ownership of everything uploaded is released to `dst_queue_fam`. Finished tickets then also need
+// `upload_acquire` recorded on the destination queue before the resources can be used there.
+struct Upload {
+        struct MemAllocator* allocator;
+        VkDevice device;
+        VkQueue queue;
+        uint32_t queue_fam;
+        uint32_t dst_queue_fam;
+        VkCommandPool cpool;
+        VkDeviceSize staging_size;
+
+        struct UploadBatch batches[UPLOAD_BATCH_CT];
+        // Ticket of the batch being recorded. Tickets start at 1, so 0 is always done.
+        uint64_t ticket;
+
+        // Acquire barriers for finished batches that haven't been passed to `upload_acquire` yet
+        uint32_t acquire_buffer_ct;
+        uint32_t acquire_buffer_cap;
+        VkBufferMemoryBarrier* acquire_buffers;
+        uint32_t acquire_image_ct;
+        uint32_t acquire_image_cap;
+        VkImageMemoryBarrier* acquire_images;
+};
+
+static void upload_push_buffer_barrier(uint32_t* ct, uint32_t* cap, VkBufferMemoryBarrier** barriers,
+                                       const VkBufferMemoryBarrier* barrier)
+{
+        if (*ct == *cap) {
+                *cap = *cap == 0 ? 16 : *cap * 2;
+                *barriers = realloc(*barriers, *cap * sizeof((*barriers)[0]));
+        }
+        (*barriers)[(*ct)++] = *barrier;
+}
+
+static void upload_push_image_barrier(uint32_t* ct, uint32_t* cap, VkImageMemoryBarrier** barriers,
+                                      const VkImageMemoryBarrier* barrier)
+{
+        if (*ct == *cap) {
+                *cap = *cap == 0 ? 16 : *cap * 2;
+                *barriers = realloc(*barriers, *cap * sizeof((*barriers)[0]));
+        }
+        (*barriers)[(*ct)++] = *barrier;
+}
+
+void upload_create(struct MemAllocator* allocator, VkDevice device, VkQueue queue,
+                   uint32_t queue_fam, uint32_t dst_queue_fam, VkDeviceSize staging_size,
+                   struct Upload* up)
+{
+        bzero(up, sizeof(*up));
+        up->allocator = allocator;
+        up->device = device;
+        up->queue = queue;
+        up->queue_fam = queue_fam;
+        up->dst_queue_fam = dst_queue_fam;
+        up->staging_size = staging_size;
+        up->ticket = 1;
+
+        VkCommandPoolCreateInfo cpool_info = {0};
+        cpool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cpool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        cpool_info.queueFamilyIndex = queue_fam;
+
+        VkResult res = vkCreateCommandPool(device, &cpool_info, NULL, &up->cpool);
+        assert(res == VK_SUCCESS);
+
+        for (int i = 0; i < UPLOAD_BATCH_CT; i++) {
+                struct UploadBatch* batch = &up->batches[i];
+                cbuf_alloc(device, up->cpool, &batch->cbuf);
+                fence_create(device, 0, &batch->fence);
+                buffer_create(allocator, device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              staging_size, &batch->staging);
+        }
+}
+
+static void upload_batch_retire(struct Upload* up, struct UploadBatch* batch) {
+        for (uint32_t i = 0; i < batch->extra_ct; i++) buffer_destroy(up->device, &batch->extras[i]);
+        batch->extra_ct = 0;
+
+        // The matching acquire has exactly the same families, layouts and ranges
+        if (up->queue_fam != up->dst_queue_fam) {
+                for (uint32_t i = 0; i < batch->buffer_barrier_ct; i++) {
+                        VkBufferMemoryBarrier barrier = batch->buffer_barriers[i];
+                        barrier.srcAccessMask = 0;
+                        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+                        upload_push_buffer_barrier(&up->acquire_buffer_ct, &up->acquire_buffer_cap,
+                                                   &up->acquire_buffers, &barrier);
+                }
+                for (uint32_t i = 0; i < batch->image_barrier_ct; i++) {
+                        VkImageMemoryBarrier barrier = batch->image_barriers[i];
+                        barrier.srcAccessMask = 0;
+                        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+                        upload_push_image_barrier(&up->acquire_image_ct, &up->acquire_image_cap,
+                                                  &up->acquire_images, &barrier);
+                }
+        }
+        batch->buffer_barrier_ct = 0;
+        batch->image_barrier_ct = 0;
+
+        batch->staging_head = 0;
+        batch->in_flight = 0;
+}
+
+// Returns 1 if everything in `ticket` has finished executing on the GPU.
+int upload_done(struct Upload* up, uint64_t ticket) {
+        if (ticket >= up->ticket) return 0;
+
+        struct UploadBatch* batch = &up->batches[ticket % UPLOAD_BATCH_CT];
+        // The batch has been reused since, so it must have finished
+        if (batch->ticket != ticket || !batch->in_flight) return 1;
+
+        if (vkGetFenceStatus(up->device, batch->fence) != VK_SUCCESS) return 0;
+        upload_batch_retire(up, batch);
+        return 1;
+}
+
+// Returns 1 if recording an upload now won't have to wait for an earlier batch to finish.
+int upload_ready(struct Upload* up) {
+        struct UploadBatch* batch = &up->batches[up->ticket % UPLOAD_BATCH_CT];
+        return batch->recording || !batch->in_flight || upload_done(up, batch->ticket);
+}
+
+// Submits the batch being recorded, if there's anything in it. Returns its ticket.
+uint64_t upload_flush(struct Upload* up) {
+        struct UploadBatch* batch = &up->batches[up->ticket % UPLOAD_BATCH_CT];
+        if (!batch->recording) return up->ticket - 1;
+
+        if (up->queue_fam == up->dst_queue_fam) {
+                // Make the copies visible to whatever gets submitted after this, and do the final
+                // layout transitions
+                VkMemoryBarrier barrier = {0};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+                vkCmdPipelineBarrier(batch->cbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, NULL,
+                                     batch->image_barrier_ct, batch->image_barriers);
+        } else {
+                vkCmdPipelineBarrier(batch->cbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL,
+                                     batch->buffer_barrier_ct, batch->buffer_barriers,
+                                     batch->image_barrier_ct, batch->image_barriers);
+        }
+
+        vkEndCommandBuffer(batch->cbuf);
+
+        VkSubmitInfo info = {0};
+        info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &batch->cbuf;
+
+        VkResult res = vkQueueSubmit(up->queue, 1, &info, batch->fence);
+        assert(res == VK_SUCCESS);
+
+        batch->recording = 0;
+        batch->in_flight = 1;
+        return up->ticket++;
+}
+
+// Blocks until everything in `ticket` has finished, submitting it first if necessary.
+void upload_wait(struct Upload* up, uint64_t ticket) {
+        if (ticket >= up->ticket) {
+                upload_flush(up);
+                // Nothing was recorded, so there's nothing to wait for
+                if (ticket >= up->ticket) return;
+        }
+        if (upload_done(up, ticket)) return;
+
+        struct UploadBatch* batch = &up->batches[ticket % UPLOAD_BATCH_CT];
+        VkResult res = vkWaitForFences(up->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        assert(res == VK_SUCCESS);
+        upload_batch_retire(up, batch);
+}
+
+// Returns the batch currently being recorded, starting it if necessary. This is also where we
+// block if every batch is still in flight.
+static struct UploadBatch* upload_batch_get(struct Upload* up) {
+        struct UploadBatch* batch = &up->batches[up->ticket % UPLOAD_BATCH_CT];
+        if (batch->recording) return batch;
+
+        if (batch->in_flight) upload_wait(up, batch->ticket);
+
+        vkResetFences(up->device, 1, &batch->fence);
+        batch->ticket = up->ticket;
+        batch->recording = 1;
+        cbuf_begin_onetime(batch->cbuf);
+
+        return batch;
+}
+
+// Reserves `size` bytes of staging memory in the current batch and returns where to write them.
+// Use this directly to fill staging memory without an extra copy, then record the copy into the
+// batch's command buffer with one of the upload_*_from functions. Record the copy before staging
+// anything else, since staging can submit the current batch.
+void upload_stage(struct Upload* up, VkDeviceSize size, VkDeviceSize alignment,
+                  VkBuffer* src, VkDeviceSize* src_offset, void** ptr)
+{
+        struct UploadBatch* batch = upload_batch_get(up);
+
+        VkDeviceSize start = (batch->staging_head + alignment - 1) / alignment * alignment;
+        if (start + size > up->staging_size && batch->staging_head > 0) {
+                // Full, send it off and start over in the next batch
+                upload_flush(up);
+                batch = upload_batch_get(up);
+                start = 0;
+        }
+
+        if (start + size > up->staging_size) {
+                // Too big for any staging buffer
+                if (batch->extra_ct == batch->extra_cap) {
+                        batch->extra_cap = batch->extra_cap == 0 ? 4 : batch->extra_cap * 2;
+                        batch->extras = realloc(batch->extras,
+                                                batch->extra_cap * sizeof(batch->extras[0]));
+                }
+                struct Buffer* extra = &batch->extras[batch->extra_ct++];
+                buffer_create(up->allocator, up->device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              size, extra);
+                *src = extra->handle;
+                *src_offset = 0;
+                *ptr = extra->alloc.mapped;
+                return;
+        }
+
+        batch->staging_head = start + size;
+        *src = batch->staging.handle;
+        *src_offset = start;
+        *ptr = (char*) batch->staging.alloc.mapped + start;
+}
+
+// Records a copy from staging memory returned by `upload_stage`.
+uint64_t upload_buffer_from(struct Upload* up, VkBuffer src, VkDeviceSize src_offset,
+                            VkBuffer dst, VkDeviceSize dst_offset, VkDeviceSize size)
+{
+        struct UploadBatch* batch = upload_batch_get(up);
+
+        VkBufferCopy region = {0};
+        region.srcOffset = src_offset;
+        region.dstOffset = dst_offset;
+        region.size = size;
+        vkCmdCopyBuffer(batch->cbuf, src, dst, 1, &region);
+
+        if (up->queue_fam != up->dst_queue_fam) {
+                VkBufferMemoryBarrier barrier = {0};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.srcQueueFamilyIndex = up->queue_fam;
+                barrier.dstQueueFamilyIndex = up->dst_queue_fam;
+                barrier.buffer = dst;
+                barrier.offset = dst_offset;
+                barrier.size = size;
+                upload_push_buffer_barrier(&batch->buffer_barrier_ct, &batch->buffer_barrier_cap,
+                                           &batch->buffer_barriers, &barrier);
+        }
+
+        return batch->ticket;
+}
+
+// `dst` needs VK_BUFFER_USAGE_TRANSFER_DST_BIT.
+uint64_t upload_buffer(struct Upload* up, VkBuffer dst, VkDeviceSize dst_offset,
+                       VkDeviceSize size, const void* data)
+{
+        VkBuffer src;
+        VkDeviceSize src_offset;
+        void* ptr;
+        upload_stage(up, size, 4, &src, &src_offset, &ptr);
+        memcpy(ptr, data, size);
+
+        return upload_buffer_from(up, src, src_offset, dst, dst_offset, size);
+}
+
+// Like `buffer_create_staged`, but doesn't wait for the copy to finish. The buffer can't be used
+// until the returned ticket is done.
+uint64_t upload_buffer_create(struct Upload* up, VkBufferUsageFlags usage,
+                              VkMemoryPropertyFlags props, VkDeviceSize size, const void* data,
+                              struct Buffer* buf)
+{
+	assert(size > 0);
+        buffer_create(up->allocator, up->device, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, props,
+                      size, buf);
+        return upload_buffer(up, buf->handle, 0, size, data);
+}
+
+// Records a copy from staging memory into mip level 0 of `dst`, which can be in any layout
+// beforehand (its contents are discarded) and ends up in `final_layout`.
+uint64_t upload_image_from(struct Upload* up, VkBuffer src, VkDeviceSize src_offset,
+                           VkImage dst, VkImageAspectFlags aspect,
+                           uint32_t width, uint32_t height, uint32_t depth,
+                           VkImageLayout final_layout)
+{
+        struct UploadBatch* batch = upload_batch_get(up);
+
+        cbuf_barrier_image(batch->cbuf, dst, aspect, 1, 0,
+                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkBufferImageCopy region = {0};
+        region.bufferOffset = src_offset;
+	region.imageSubresource.aspectMask = aspect;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = (VkExtent3D){width, height, depth};
+	vkCmdCopyBufferToImage(batch->cbuf, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               1, &region);
+
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = dst;
+	barrier.subresourceRange.aspectMask = aspect;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = final_layout;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        if (up->queue_fam == up->dst_queue_fam) {
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        } else {
+                barrier.srcQueueFamilyIndex = up->queue_fam;
+                barrier.dstQueueFamilyIndex = up->dst_queue_fam;
+        }
+        upload_push_image_barrier(&batch->image_barrier_ct, &batch->image_barrier_cap,
+                                  &batch->image_barriers, &barrier);
+
+        return batch->ticket;
+}
+
+// `data` must be tightly packed.
+uint64_t upload_image(struct Upload* up, VkImage dst, VkImageAspectFlags aspect,
+                      uint32_t width, uint32_t height, uint32_t depth,
+                      VkDeviceSize size, const void* data, VkImageLayout final_layout)
+{
+        VkBuffer src;
+        VkDeviceSize src_offset;
+        void* ptr;
+        upload_stage(up, size, UPLOAD_IMAGE_ALIGNMENT, &src, &src_offset, &ptr);
+        memcpy(ptr, data, size);
+
+        return upload_image_from(up, src, src_offset, dst, aspect, width, height, depth,
+                                 final_layout);
+}
+
+// Records the whole texture upload into the current batch: transition, copy into level 0, the blit
+// chain for the other levels and the transition to `final_layout` (usually
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL). Textures uploaded together all go out in one submit.
+//
+// Blits need a graphics queue, so mipmapped textures can't go through an Upload on a separate
+// transfer queue.
+uint64_t upload_texture_from(struct Upload* up, VkBuffer src, VkDeviceSize src_offset,
+                             VkImage dst, uint32_t width, uint32_t height, uint32_t mip_levels,
+                             VkImageLayout final_layout)
+{
+        assert(mip_levels == 1 || up->queue_fam == up->dst_queue_fam);
+
+        struct UploadBatch* batch = upload_batch_get(up);
+
+        cbuf_barrier_image(batch->cbuf, dst, VK_IMAGE_ASPECT_COLOR_BIT, mip_levels, 0,
+                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+	VkBufferImageCopy region = {0};
+        region.bufferOffset = src_offset;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = (VkExtent3D){width, height, 1};
+	vkCmdCopyBufferToImage(batch->cbuf, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               1, &region);
+
+        image_gen_mips(batch->cbuf, dst, width, height, mip_levels);
+
+        // Everything but the last level ended up as a blit source
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = dst;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.newLayout = final_layout;
+        if (up->queue_fam == up->dst_queue_fam) {
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        } else {
+                barrier.srcQueueFamilyIndex = up->queue_fam;
+                barrier.dstQueueFamilyIndex = up->dst_queue_fam;
+        }
+
+        if (mip_levels > 1) {
+                barrier.subresourceRange.baseMipLevel = 0;
+                barrier.subresourceRange.levelCount = mip_levels - 1;
+                barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+                upload_push_image_barrier(&batch->image_barrier_ct, &batch->image_barrier_cap,
+                                          &batch->image_barriers, &barrier);
+        }
+
+        barrier.subresourceRange.baseMipLevel = mip_levels - 1;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        upload_push_image_barrier(&batch->image_barrier_ct, &batch->image_barrier_cap,
+                                  &batch->image_barriers, &barrier);
+
+        return batch->ticket;
+}
+
+// `data` holds mip level 0, tightly packed. `dst` should come from `image_create_texture`.
+uint64_t upload_texture(struct Upload* up, VkImage dst, uint32_t width, uint32_t height,
+                        uint32_t mip_levels, VkDeviceSize size, const void* data,
+                        VkImageLayout final_layout)
+{
+        VkBuffer src;
+        VkDeviceSize src_offset;
+        void* ptr;
+        upload_stage(up, size, UPLOAD_IMAGE_ALIGNMENT, &src, &src_offset, &ptr);
+        memcpy(ptr, data, size);
+
+        return upload_texture_from(up, src, src_offset, dst, width, height, mip_levels,
+                                   final_layout);
+}
+
+// For textures that come with all their mip levels, e.g. block-compressed ones. `data` holds every
+// level, with level i at `level_offsets[i]` (relative to `data`, multiples of the block size) and
+// `size` bytes in total. No blits, so this works on a transfer queue too.
+uint64_t upload_texture_levels(struct Upload* up, VkImage dst, uint32_t width, uint32_t height,
+                               uint32_t mip_levels, const VkDeviceSize* level_offsets,
+                               VkDeviceSize size, const void* data, VkImageLayout final_layout)
+{
+        VkBuffer src;
+        VkDeviceSize src_offset;
+        void* ptr;
+        upload_stage(up, size, UPLOAD_IMAGE_ALIGNMENT, &src, &src_offset, &ptr);
+        memcpy(ptr, data, size);
+
+        struct UploadBatch* batch = upload_batch_get(up);
+
+        cbuf_barrier_image(batch->cbuf, dst, VK_IMAGE_ASPECT_COLOR_BIT, mip_levels, 0,
+                           VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        VkBufferImageCopy* regions = malloc(mip_levels * sizeof(regions[0]));
+        for (uint32_t i = 0; i < mip_levels; i++) {
+                VkBufferImageCopy region = {0};
+                region.bufferOffset = src_offset + level_offsets[i];
+                region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.imageSubresource.mipLevel = i;
+                region.imageSubresource.baseArrayLayer = 0;
+                region.imageSubresource.layerCount = 1;
+                region.imageExtent.width = width >> i > 0 ? width >> i : 1;
+                region.imageExtent.height = height >> i > 0 ? height >> i : 1;
+                region.imageExtent.depth = 1;
+                regions[i] = region;
+        }
+        vkCmdCopyBufferToImage(batch->cbuf, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               mip_levels, regions);
+        free(regions);
+
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = dst;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mip_levels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = final_layout;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        if (up->queue_fam == up->dst_queue_fam) {
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        } else {
+                barrier.srcQueueFamilyIndex = up->queue_fam;
+                barrier.dstQueueFamilyIndex = up->dst_queue_fam;
+        }
+        upload_push_image_barrier(&batch->image_barrier_ct, &batch->image_barrier_cap,
+                                  &batch->image_barriers, &barrier);
+
+        return batch->ticket;
+}
+
+// Records the acquire half of the ownership transfer for every finished batch. Call it on a command
+// buffer for `dst_queue_fam` before using anything uploaded there. Does nothing if both families are
+// the same.
+void upload_acquire(struct Upload* up, VkCommandBuffer cbuf) {
+        if (up->queue_fam == up->dst_queue_fam) return;
+
+        for (int i = 0; i < UPLOAD_BATCH_CT; i++) {
+                struct UploadBatch* batch = &up->batches[i];
+                if (batch->in_flight) upload_done(up, batch->ticket);
+        }
+
+        if (up->acquire_buffer_ct == 0 && up->acquire_image_ct == 0) return;
+
+        vkCmdPipelineBarrier(cbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL,
+                             up->acquire_buffer_ct, up->acquire_buffers,
+                             up->acquire_image_ct, up->acquire_images);
+        up->acquire_buffer_ct = 0;
+        up->acquire_image_ct = 0;
+}
+
+void upload_destroy(struct Upload* up) {
+        upload_flush(up);
+
+        for (int i = 0; i < UPLOAD_BATCH_CT; i++) {
+                struct UploadBatch* batch = &up->batches[i];
+                if (batch->in_flight) {
+                        vkWaitForFences(up->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+                        upload_batch_retire(up, batch);
+                }
+                free(batch->extras);
+                free(batch->buffer_barriers);
+                free(batch->image_barriers);
+                buffer_destroy(up->device, &batch->staging);
+                vkDestroyFence(up->device, batch->fence, NULL);
+        }
+
+        vkDestroyCommandPool(up->device, up->cpool, NULL);
+
+        free(up->acquire_buffers);
+        free(up->acquire_images);
+}
+
+#endif // LL_UPLOAD_H